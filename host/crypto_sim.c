@@ -0,0 +1,162 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Stand-ins for the AES and SHA-1 engines. SHA-1 is computed in software,
+// so HMACs built on it by hmac.c are real. AES passes data through as it
+// is: the tests look at what the HMACs cover, not at the cipher.
+
+#include "crypto.h"
+#include "sha.h"
+
+#include <string.h>
+
+otp_t otp;
+
+void aes_reset(void)
+{
+}
+
+void aes_set_iv(u8 *iv)
+{
+    (void)iv;
+}
+
+void aes_empty_iv(void)
+{
+}
+
+void aes_set_key(u8 *key)
+{
+    (void)key;
+}
+
+// isfs.c passes the output first
+void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
+{
+    (void)keep_iv;
+    memmove(src, dst, blocks * 16);
+}
+
+void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
+{
+    (void)keep_iv;
+    memmove(src, dst, blocks * 16);
+}
+
+#define ROL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+static void _sha_block(u32 state[SHA_HASH_WORDS], const u8 *block)
+{
+    u32 w[80], a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (u32)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 80; i++)
+        w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    for (int i = 0; i < 80; i++)
+    {
+        u32 f, k;
+        if (i < 20)
+            f = (b & c) | (~b & d), k = 0x5A827999;
+        else if (i < 40)
+            f = b ^ c ^ d, k = 0x6ED9EBA1;
+        else if (i < 60)
+            f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+        else
+            f = b ^ c ^ d, k = 0xCA62C1D6;
+
+        u32 t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha_init(sha_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(sha_ctx));
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+}
+
+void sha_update(sha_ctx *ctx, const void *inbuf, size_t size)
+{
+    const u8 *data = inbuf;
+    u32 used = (ctx->count[0] >> 3) & 63;
+
+    if ((ctx->count[0] += size << 3) < (size << 3))
+        ctx->count[1]++;
+    ctx->count[1] += size >> 29;
+
+    while (size)
+    {
+        size_t chunk = 64 - used < size ? 64 - used : size;
+        memcpy(ctx->buffer + used, data, chunk);
+        used += chunk;
+        data += chunk;
+        size -= chunk;
+        if (used == 64)
+        {
+            _sha_block(ctx->state, ctx->buffer);
+            used = 0;
+        }
+    }
+}
+
+void sha_final(sha_ctx *ctx, void *outbuf)
+{
+    u8 count[8], *digest = outbuf;
+
+    for (int i = 0; i < 8; i++)
+        count[i] = ctx->count[i < 4 ? 1 : 0] >> ((3 - (i & 3)) * 8);
+
+    sha_update(ctx, "\200", 1);
+    while ((ctx->count[0] & 504) != 448)
+        sha_update(ctx, "\0", 1);
+    sha_update(ctx, count, sizeof(count));
+
+    for (int i = 0; i < SHA_HASH_SIZE; i++)
+        digest[i] = ctx->state[i >> 2] >> ((3 - (i & 3)) * 8);
+}
+
+void sha_hash(const void *inbuf, void *outbuf, size_t size)
+{
+    sha_ctx ctx;
+
+    sha_init(&ctx);
+    sha_update(&ctx, inbuf, size);
+    sha_final(&ctx, outbuf);
+}
+
+// the engine finishes at once here
+int sha_start(sha_ctx *ctx, const void *inbuf, u32 blocks)
+{
+    if (blocks == 0 || blocks > SHA_ENGINE_BLOCKS || ((ctx->count[0] >> 3) & 63))
+        return -1;
+
+    sha_update(ctx, inbuf, blocks * SHA_BLOCK_SIZE);
+    return 0;
+}
+
+void sha_wait(sha_ctx *ctx)
+{
+    (void)ctx;
+}
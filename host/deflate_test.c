@@ -0,0 +1,117 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Runs source/lib/deflate.c through uzlib's tinflate, the decoder restore uses.
+
+#include "deflate.h"
+#include "tinf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DATA_LEN        (3 * 1024 * 1024 + 777)
+
+static int failed;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; } } while (0)
+
+// erased pages, zeroed pages, noise and text, like a NAND folder backup
+static void _fill(u8 *p, size_t len)
+{
+    static const char text[] = "the quick brown fox jumps ";
+
+    srand(1);
+    for (size_t i = 0; i < len; i++)
+    {
+        size_t page = i / 2048;
+        if (page % 5 == 0)
+            p[i] = 0xFF;
+        else if (page % 7 == 0)
+            p[i] = 0;
+        else if (page % 3 == 0)
+            p[i] = rand();
+        else
+            p[i] = text[(i * 7 + (i >> 9)) % 26] ^ (rand() % 50 == 0);
+    }
+}
+
+static void _append(u8 *gz, size_t *gz_len, const u8 *out, size_t out_len)
+{
+    memcpy(gz + *gz_len, out, out_len);
+    *gz_len += out_len;
+}
+
+// compresses in slabs and inflates it back, returns the compressed length
+static size_t _roundtrip(const u8 *data, size_t len, size_t slab)
+{
+    deflate_stream *z = deflate_begin(slab);
+    u8 *gz = malloc(len * 2 + 1024);
+    u8 *back = malloc(len + 1);
+    size_t gz_len = 0;
+    const u8 *out;
+    size_t out_len;
+    TINF_DATA d = {0};
+    int res;
+
+    CHECK(z && gz && back);
+    if (!z || !gz || !back)
+        return 0;
+
+    for (size_t off = 0; off < len; off += slab)
+    {
+        size_t chunk = len - off < slab ? len - off : slab;
+        CHECK(deflate_slab(z, data + off, chunk, &out, &out_len) == 0);
+        _append(gz, &gz_len, out, out_len);
+    }
+    CHECK(deflate_end(z, &out, &out_len) == 0);
+    _append(gz, &gz_len, out, out_len);
+    deflate_free(z);
+
+    uzlib_init();
+    uzlib_uncompress_init(&d, NULL, 0);
+    d.source = gz;
+    CHECK(uzlib_gzip_parse_header(&d) == TINF_OK);
+
+    d.dest = back;
+    do
+    {
+        d.destSize = 1;
+        res = uzlib_uncompress_chksum(&d);
+    } while (res == TINF_OK && (size_t)(d.dest - back) <= len);
+
+    CHECK(res == TINF_DONE);
+    CHECK((size_t)(d.dest - back) == len);
+    CHECK(!memcmp(back, data, len));
+
+    free(back);
+    free(gz);
+    return gz_len;
+}
+
+int main(void)
+{
+    static const size_t slabs[] = {1024 * 1024, 128 * 1024, 5000};
+    u8 *data = malloc(DATA_LEN);
+
+    _fill(data, DATA_LEN);
+    for (int i = 0; i < 3; i++)
+    {
+        size_t gz_len = _roundtrip(data, DATA_LEN, slabs[i]);
+        CHECK(gz_len && gz_len < DATA_LEN / 2);
+    }
+
+    // the stream is still a valid gzip file with nothing or almost nothing in it
+    CHECK(_roundtrip(data, 0, 4096) != 0);
+    CHECK(_roundtrip((const u8 *)"ab", 2, 4096) != 0);
+    free(data);
+
+    printf("deflate_test: %s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
@@ -0,0 +1,213 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Runs source/lib/gfx.c on framebuffers in memory: checks its output against
+// plain per-pixel drawing, the way gfx used to work, and times both.
+
+#include "gfx.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define TV_FB           (0x14000000 + 0x3500000)
+#define TV_W            (1280)
+#define TV_H            (720)
+#define DRC_FB          (0x14000000 + 0x38C0000)
+#define DRC_W           (896)
+#define DRC_H           (504)
+#define ROUNDS          (200)
+
+extern const u8 msx_font[];
+
+static u32 *tv, *drc;
+static u32 ref_tv[TV_W * TV_H], ref_drc[DRC_W * DRC_H];
+static int failed;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; } } while (0)
+
+// gfx.c brings its own printf, which prints through these
+void serial_send(u8 val)
+{
+    putchar(val);
+}
+
+void serial_line_inc(void)
+{
+}
+
+void *gpu_tv_primary_surface_addr(void)
+{
+    return tv;
+}
+
+static void _ref_char(u32 *fb, int width, char c, int x, int y, u32 color)
+{
+    if (c < 32)
+        return;
+
+    const u8 *glyph = &msx_font[8 * (c - 32)];
+    fb += x + y * width;
+    for (int i = 0; i < 8; i++, fb += width)
+        for (int j = 0; j < 8; j++)
+            fb[j] = (glyph[i] & (128 >> j)) ? color : BLACK;
+}
+
+static void _ref_rect(u32 *fb, int width, int height, int x, int y, int w, int h, u32 color)
+{
+    for (int row = y; row < y + h; row++)
+        for (int col = x; col < x + w; col++)
+            if (row >= 0 && row < height && col >= 0 && col < width)
+                fb[col + row * width] = color;
+}
+
+static void _ref_clear(u32 color)
+{
+    for (int i = 0; i < TV_W * TV_H; i++)
+        ref_tv[i] = color;
+    for (int i = 0; i < DRC_W * DRC_H; i++)
+        ref_drc[i] = color;
+}
+
+static bool _same(void)
+{
+    return !memcmp(tv, ref_tv, sizeof(ref_tv)) && !memcmp(drc, ref_drc, sizeof(ref_drc));
+}
+
+static double _ms(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// every glyph in a few colors, on both screens at once and on each alone
+static void test_glyphs(void)
+{
+    static const u32 colors[] = {WHITE, 0x3F7C7C00, 0x12345678};
+
+    gfx_clear(GFX_ALL, 0xDEADBEEF);
+    _ref_clear(0xDEADBEEF);
+    for (int c = 0; c < 128; c++)
+    {
+        u32 color = colors[c % 3];
+        int x = 10 + (c % 64) * 9, y = 10 + (c / 64) * 9;
+
+        gfx_draw_char(GFX_ALL, c, x, y, color);
+        gfx_draw_char(GFX_TV, c, x, y + 40, color);
+        gfx_draw_char(GFX_DRC, c, x, y + 80, color);
+        _ref_char(ref_tv, TV_W, c, x, y, color);
+        _ref_char(ref_drc, DRC_W, c, x, y, color);
+        _ref_char(ref_tv, TV_W, c, x, y + 40, color);
+        _ref_char(ref_drc, DRC_W, c, x, y + 80, color);
+    }
+    CHECK(_same());
+}
+
+// rectangles are clipped to each screen
+static void test_rects(void)
+{
+    gfx_clear(GFX_ALL, BLACK);
+    _ref_clear(BLACK);
+
+    gfx_fill_rect(GFX_ALL, 10, 10, 1263, 4, 0x3F7C7C00);
+    gfx_fill_rect(GFX_ALL, -5, 600, 50, 200, WHITE);
+    gfx_fill_rect(GFX_TV, 1270, 700, 40, 40, 0x11223344);
+    gfx_fill_rect(GFX_DRC, 3, 3, 0, 10, WHITE);
+    _ref_rect(ref_tv, TV_W, TV_H, 10, 10, 1263, 4, 0x3F7C7C00);
+    _ref_rect(ref_drc, DRC_W, DRC_H, 10, 10, 1263, 4, 0x3F7C7C00);
+    _ref_rect(ref_tv, TV_W, TV_H, -5, 600, 50, 200, WHITE);
+    _ref_rect(ref_drc, DRC_W, DRC_H, -5, 600, 50, 200, WHITE);
+    _ref_rect(ref_tv, TV_W, TV_H, 1270, 700, 40, 40, 0x11223344);
+    CHECK(_same());
+}
+
+// a screen full of text on both screens, ROUNDS times over
+static void bench_text(void)
+{
+    struct timespec start;
+    double ref, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++)
+        for (int line = 0; line < 60; line++)
+            for (int k = 0; k < 100; k++)
+            {
+                char c = 33 + (k + line) % 90;
+                if (10 + k * 8 + 8 <= DRC_W && 10 + line * 8 + 8 <= DRC_H)
+                    _ref_char(ref_drc, DRC_W, c, 10 + k * 8, 10 + line * 8, WHITE);
+                _ref_char(ref_tv, TV_W, c, 10 + k * 8, 10 + line * 8, WHITE);
+            }
+    ref = _ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++)
+        for (int line = 0; line < 60; line++)
+            for (int k = 0; k < 100; k++)
+            {
+                char c = 33 + (k + line) % 90;
+                bool both = 10 + k * 8 + 8 <= DRC_W && 10 + line * 8 + 8 <= DRC_H;
+                gfx_draw_char(both ? GFX_ALL : GFX_TV, c, 10 + k * 8, 10 + line * 8, WHITE);
+            }
+    now = _ms(&start);
+
+    printf("text: per pixel %.1f ms, gfx %.1f ms, %.2fx\n", ref / ROUNDS, now / ROUNDS, ref / now);
+}
+
+// the console border, once plotted pixel by pixel
+static void bench_border(void)
+{
+    const int cx = 10, cy = 10, cw = TV_W - 20, ch = TV_H - 20, bw = 3;
+    struct timespec start;
+    double ref, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++)
+        for (int y = cy; y < ch + cy + bw; y++)
+            for (int x = cx; x < cw + cx + bw; x++)
+                if ((x >= cx && x <= cx + bw) || (y >= cy && y <= cy + bw) ||
+                    (x >= cw + cx - 1 && x <= cw + cx - 1 + bw) ||
+                    (y >= ch + cy - 1 && y <= ch + cy - 1 + bw))
+                    ref_tv[x + y * TV_W] = r;
+    ref = _ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        gfx_fill_rect(GFX_TV, cx, cy, cw + bw, bw + 1, r);
+        gfx_fill_rect(GFX_TV, cx, cy + ch - 1, cw + bw, bw + 1, r);
+        gfx_fill_rect(GFX_TV, cx, cy, bw + 1, ch + bw, r);
+        gfx_fill_rect(GFX_TV, cx + cw - 1, cy, bw + 1, ch + bw, r);
+    }
+    now = _ms(&start);
+
+    CHECK(!memcmp(tv, ref_tv, sizeof(ref_tv)));
+    printf("border: per pixel %.2f ms, gfx %.2f ms, %.2fx\n", ref / ROUNDS, now / ROUNDS, ref / now);
+}
+
+int main(void)
+{
+    tv = host_mem_map(TV_FB, sizeof(ref_tv));
+    drc = host_mem_map(DRC_FB, sizeof(ref_drc));
+    gfx_init();
+
+    test_glyphs();
+    test_rects();
+
+    // both sides start from the same picture, so the results compare
+    gfx_clear(GFX_ALL, BLACK);
+    _ref_clear(BLACK);
+    bench_text();
+    CHECK(_same());
+    bench_border();
+
+    printf("gfx_bench: %s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
@@ -0,0 +1,61 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _HOST_SYS_IOSUPPORT_H
+#define _HOST_SYS_IOSUPPORT_H
+
+// The parts of devkitARM's newlib device table the drivers fill in. Host
+// tests call the drivers directly, so nothing ever goes through it.
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct _reent {
+    int _errno;
+};
+
+typedef struct {
+    struct _reent *r;
+    void *device;
+    void *dirStruct;
+} DIR_ITER;
+
+typedef struct {
+    const char *name;
+    int structSize;
+    int (*open_r)();
+    int (*close_r)();
+    ssize_t (*write_r)();
+    ssize_t (*read_r)();
+    off_t (*seek_r)();
+    int (*fstat_r)();
+    int (*stat_r)();
+    int (*link_r)();
+    int (*unlink_r)();
+    int (*chdir_r)();
+    int (*rename_r)();
+    int (*mkdir_r)();
+    int dirStateSize;
+    DIR_ITER *(*diropen_r)();
+    int (*dirreset_r)();
+    int (*dirnext_r)();
+    int (*dirclose_r)();
+    int (*statvfs_r)();
+    int (*ftruncate_r)();
+    int (*fsync_r)();
+    void *deviceData;
+    int (*chmod_r)();
+    int (*fchmod_r)();
+    int (*rmdir_r)();
+} devoptab_t;
+
+int AddDevice(const devoptab_t *device);
+int RemoveDevice(const char *name);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _HOST_TARGET_H
+#define _HOST_TARGET_H
+
+// Forced into every host build with -include. The register accessors of
+// utils.h are ARM inline asm: the real header is read with them renamed,
+// which takes its include guard, and calls go to host/target.c instead.
+#define read32      target_read32
+#define write32     target_write32
+#define set32       target_set32
+#define clear32     target_clear32
+#define mask32      target_mask32
+#include "utils.h"
+#undef read32
+#undef write32
+#undef set32
+#undef clear32
+#undef mask32
+
+u32 read32(u32 addr);
+void write32(u32 addr, u32 data);
+u32 set32(u32 addr, u32 set);
+u32 clear32(u32 addr, u32 clear);
+u32 mask32(u32 addr, u32 clear, u32 set);
+
+// one register window a stand-in serves, offsets are from its base
+typedef struct host_mmio {
+    u32 base;
+    u32 size;
+    u32 (*read)(void *ctx, u32 off);
+    void (*write)(void *ctx, u32 off, u32 data);
+    void *ctx;
+} host_mmio;
+
+void host_mmio_map(const host_mmio *window);
+
+// memory below 4 GiB, so pointers survive the u32 casts of the target code
+void *host_dma_alloc(u32 size);
+
+// zeroed memory at a fixed target address, for code with hardwired buffers
+void *host_mem_map(u32 addr, u32 size);
+
+#endif
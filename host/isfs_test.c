@@ -0,0 +1,263 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Runs the writing side of source/lib/isfs.c on a freshly formatted SLC in
+// the NAND stand-in, checking every data cluster's HMAC the way IOS does.
+
+#include "gfx.h"
+#include "isfs.h"
+#include "nand_sim.h"
+#include "rednand.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILE_SIZE       (5 * CLUSTER_SIZE + 1234)
+
+static isfs_ctx *ctx;
+static u8 *data;
+static int failed;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; } } while (0)
+
+// what isfs.c links against besides the flash and the crypto engines
+rednand_config rednand;
+otp_t *redotp;
+
+int AddDevice(const devoptab_t *device)
+{
+    (void)device;
+    return 0;
+}
+
+int RemoveDevice(const char *name)
+{
+    (void)name;
+    return 0;
+}
+
+int sdcard_read(u32 blk_start, u32 blk_count, void *buf)
+{
+    (void)blk_start;
+    (void)blk_count;
+    (void)buf;
+    return -1;
+}
+
+int sdcard_write(u32 blk_start, u32 blk_count, void *buf)
+{
+    (void)blk_start;
+    (void)blk_count;
+    (void)buf;
+    return -1;
+}
+
+FRESULT f_lseek(FIL *fp, DWORD ofs)
+{
+    (void)fp;
+    (void)ofs;
+    return FR_DISK_ERR;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+    (void)fp;
+    (void)buff;
+    (void)btr;
+    *br = 0;
+    return FR_DISK_ERR;
+}
+
+u8 smc_wait_events(u8 mask)
+{
+    return mask;
+}
+
+void gfx_clear(gfx_screen_t screen, u32 color)
+{
+    (void)screen;
+    (void)color;
+}
+
+// an empty SFS! volume: the superblock slots reserved at the end, the root
+// directory alone in the FST
+static void _format(void)
+{
+    nand_sim_init();
+
+    ctx = isfs_get_volume(ISFSVOL_SLC);
+    free(ctx->super);
+    ctx->super = memalign(NAND_DATA_ALIGN, ISFSSUPER_SIZE);
+    memset(ctx->super, 0, ISFSSUPER_SIZE);
+    memcpy(ctx->super, "SFS!", 4);
+
+    u16 *fat = _isfs_get_fat(ctx);
+    for (u32 c = 0; c < CLUSTER_COUNT; c++)
+        fat[c] = c < CLUSTER_COUNT - ctx->super_count * ISFSSUPER_CLUSTERS ? FAT_CLUSTER_EMPTY : FAT_CLUSTER_RESERVED;
+
+    isfs_fst *root = (isfs_fst *)&ctx->super[0x10000 + 0x0C];
+    memcpy(root->name, "/", 1);
+    root->mode = 0x16;
+    root->sub = 0xFFFF;
+    root->sib = 0xFFFF;
+
+    for (int i = 0; i < sizeof(ctx->hmac); i++)
+        ctx->hmac[i] = i * 13 + 1;
+    ctx->version = 1;
+    ctx->index = 0;
+    ctx->batch = 0;
+    ctx->dirty = false;
+    ctx->mounted = true;
+}
+
+static u32 _used_clusters(void)
+{
+    u16 *fat = _isfs_get_fat(ctx);
+    u32 used = 0;
+
+    for (u32 c = 0; c < CLUSTER_COUNT; c++)
+        used += fat[c] < FAT_CLUSTER_LAST || fat[c] == FAT_CLUSTER_LAST;
+    return used;
+}
+
+// every cluster must carry the HMAC of its file's name, FST index and position
+static bool _hmac_ok(const char *path, const char *name)
+{
+    static u8 cluster[CLUSTER_SIZE] ALIGNED(NAND_DATA_ALIGN);
+    isfs_fst *fst = isfs_stat(path);
+    isfs_fst *root = (isfs_fst *)&ctx->super[0x10000 + 0x0C];
+    u16 *fat = _isfs_get_fat(ctx);
+
+    if (!fst)
+        return false;
+
+    isfs_hmac_data seed = {
+        .x1 = fst->x1,
+        .uid = fst->uid,
+        .ifst = fst - root,
+        .x3 = fst->x3,
+    };
+    strncpy(seed.name, name, sizeof(seed.name));
+
+    for (u16 c = fst->sub; c < FAT_CLUSTER_LAST; c = fat[c], seed.iblk++)
+    {
+        int res = isfs_read_volume(ctx, c, 1, ISFSVOL_FLAG_ENCRYPTED | ISFSVOL_FLAG_HMAC, &seed, cluster);
+        if (res < 0 || (res & ISFSVOL_HMAC_PARTIAL))
+            return false;
+    }
+    return true;
+}
+
+static bool _data_ok(const char *path)
+{
+    u8 *back = malloc(FILE_SIZE);
+    isfs_file file;
+    size_t read = 0;
+    bool ok = false;
+
+    if (back && !isfs_open(&file, path) && !isfs_read(&file, back, FILE_SIZE, &read))
+        ok = read == FILE_SIZE && !memcmp(back, data, FILE_SIZE);
+    free(back);
+    return ok;
+}
+
+static void test_write(void)
+{
+    _format();
+    CHECK(isfs_mkdir("slc:/a", NULL) == 0);
+    CHECK(isfs_mkdir("slc:/b", NULL) == 0);
+    CHECK(isfs_write_file("slc:/a/file", NULL, data, FILE_SIZE) == 0);
+
+    CHECK(_data_ok("slc:/a/file"));
+    CHECK(_hmac_ok("slc:/a/file", "file"));
+    CHECK(!_hmac_ok("slc:/a/file", "other"));
+}
+
+// a new name means new HMACs, the old clusters are given back
+static void test_rename(void)
+{
+    u32 used = _used_clusters();
+    u16 sub = isfs_stat("slc:/a/file")->sub;
+
+    CHECK(isfs_rename("slc:/a/file", "slc:/a/renamed") == 0);
+    CHECK(!isfs_stat("slc:/a/file"));
+    CHECK(_data_ok("slc:/a/renamed"));
+    CHECK(_hmac_ok("slc:/a/renamed", "renamed"));
+    CHECK(isfs_stat("slc:/a/renamed")->sub != sub);
+    CHECK(_used_clusters() == used);
+}
+
+// moving to another directory under the same name leaves the data alone
+static void test_move(void)
+{
+    u16 sub = isfs_stat("slc:/a/renamed")->sub;
+    u32 erases = nand_stats.erases;
+
+    CHECK(isfs_rename("slc:/a/renamed", "slc:/b/renamed") == 0);
+    CHECK(isfs_stat("slc:/b/renamed")->sub == sub);
+    CHECK(_hmac_ok("slc:/b/renamed", "renamed"));
+
+    // only the superblock, two blocks
+    CHECK(nand_stats.erases - erases == ISFSSUPER_CLUSTERS / BLOCK_CLUSTERS);
+
+    erases = nand_stats.erases;
+    CHECK(isfs_rename("slc:/b", "slc:/c") == 0);
+    CHECK(nand_stats.erases - erases == ISFSSUPER_CLUSTERS / BLOCK_CLUSTERS);
+    CHECK(_hmac_ok("slc:/c/renamed", "renamed"));
+}
+
+// replacing a file frees both the old target and the source's old clusters
+static void test_replace(void)
+{
+    static u8 small[CLUSTER_SIZE];
+    u32 used = _used_clusters();
+
+    memset(small, 0x5A, sizeof(small));
+    CHECK(isfs_write_file("slc:/a/target", NULL, small, 100) == 0);
+    CHECK(isfs_rename("slc:/c/renamed", "slc:/a/target") == 0);
+    CHECK(!isfs_stat("slc:/c/renamed"));
+    CHECK(_data_ok("slc:/a/target"));
+    CHECK(_hmac_ok("slc:/a/target", "target"));
+    CHECK(_used_clusters() == used);
+}
+
+// a batch commits once, the data is resealed right away
+static void test_batch(void)
+{
+    u32 gen, gen2;
+
+    CHECK(isfs_get_generation("slc:/", &gen) == 0);
+    CHECK(isfs_batch_begin("slc:/") == 0);
+    CHECK(isfs_rename("slc:/a/target", "slc:/a/one") == 0);
+    CHECK(isfs_rename("slc:/a/one", "slc:/a/two") == 0);
+    CHECK(isfs_get_generation("slc:/", &gen2) == 0 && gen2 == gen);
+    CHECK(isfs_batch_end("slc:/") == 0);
+    CHECK(isfs_get_generation("slc:/", &gen2) == 0 && gen2 == gen + 1);
+    CHECK(_data_ok("slc:/a/two"));
+    CHECK(_hmac_ok("slc:/a/two", "two"));
+}
+
+int main(void)
+{
+    data = memalign(NAND_DATA_ALIGN, (FILE_SIZE + CLUSTER_SIZE - 1) / CLUSTER_SIZE * CLUSTER_SIZE);
+    for (u32 i = 0; i < FILE_SIZE; i++)
+        data[i] = (u8)(i * 7 + (i >> 11));
+
+    test_write();
+    test_rename();
+    test_move();
+    test_replace();
+    test_batch();
+
+    printf("isfs_test: %s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
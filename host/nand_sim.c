@@ -0,0 +1,93 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "nand.h"
+#include "nand_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIM_PAGE_SIZE   (PAGE_SIZE + PAGE_SPARE_SIZE)
+
+nand_sim nand_stats;
+
+// pages are kept inverted, so untouched zero pages of the mapping read erased
+static u8 *flash;
+
+void nand_sim_init(void)
+{
+    size_t size = (size_t)PAGE_COUNT * SIM_PAGE_SIZE;
+
+    if (flash)
+        munmap(flash, size);
+    flash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (flash == MAP_FAILED)
+    {
+        perror("nand_sim: mmap");
+        abort();
+    }
+    memset(&nand_stats, 0, sizeof(nand_stats));
+}
+
+static u8 *_page(u32 pageno)
+{
+    if (pageno >= PAGE_COUNT)
+    {
+        fprintf(stderr, "nand_sim: page %x out of range\n", pageno);
+        abort();
+    }
+    return flash + (size_t)pageno * SIM_PAGE_SIZE;
+}
+
+void nand_initialize(u32 bank)
+{
+    (void)bank;
+}
+
+int nand_read_page(u32 pageno, void *data, void *ecc)
+{
+    u8 *p = _page(pageno);
+
+    for (u32 i = 0; i < PAGE_SIZE; i++)
+        ((u8 *)data)[i] = ~p[i];
+    for (u32 i = 0; i < PAGE_SPARE_SIZE; i++)
+        ((u8 *)ecc)[i] = ~p[PAGE_SIZE + i];
+    nand_stats.reads++;
+    return 0;
+}
+
+int nand_correct(u32 pageno, void *data, void *ecc)
+{
+    (void)pageno;
+    (void)data;
+    (void)ecc;
+    return NAND_ECC_OK;
+}
+
+// programming only clears bits, like the chip
+int nand_write_page(u32 pageno, void *data, void *ecc)
+{
+    u8 *p = _page(pageno);
+
+    for (u32 i = 0; i < PAGE_SIZE; i++)
+        p[i] |= (u8)~((u8 *)data)[i];
+    for (u32 i = 0; i < PAGE_SPARE_SIZE; i++)
+        p[PAGE_SIZE + i] |= (u8)~((u8 *)ecc)[i];
+    nand_stats.writes++;
+    return 0;
+}
+
+int nand_erase_block(u32 pageno)
+{
+    memset(_page(pageno & ~(BLOCK_PAGES - 1)), 0, BLOCK_PAGES * SIM_PAGE_SIZE);
+    nand_stats.erases++;
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _NAND_SIM_H
+#define _NAND_SIM_H
+
+#include "types.h"
+
+// The nand.h calls on a RAM flash with a spare area per page. Pages only
+// program from erased, as on the chip, and ECC never finds anything.
+typedef struct nand_sim {
+    u32 erases;
+    u32 writes;
+    u32 reads;
+} nand_sim;
+
+extern nand_sim nand_stats;
+
+void nand_sim_init(void);
+
+#endif
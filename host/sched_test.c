@@ -0,0 +1,148 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Runs source/lib/sched.c on its own stacks, switched by host/sched_switch.S.
+
+#include "sched.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SLABS           (5)
+
+static bool display = true;
+static int order[64], count;
+static int failed;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; } } while (0)
+
+void gfx_printf_to_display(bool on)
+{
+    display = on;
+}
+
+bool gfx_get_printf_to_display(void)
+{
+    return display;
+}
+
+// a copy: each slab spends a slice of alarm ticks on I/O, then yields
+static int _copy(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+
+    for (int s = 0; s < SLABS; s++)
+    {
+        order[count++] = id * 10 + s;
+        CHECK(job_current() && !display == job_in_background());
+        for (int k = 0; k < JOB_SLICE; k++)
+            sched_alarm();
+        sched_progress(s + 1, SLABS);
+        job_yield();
+
+        if (job_cancelled())
+        {
+            errno = ECANCELED;
+            return -1;
+        }
+    }
+
+    if (id == 3)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+// a job that never reaches a slice runs to the end in one go
+static int _quick(void *arg)
+{
+    (void)arg;
+    order[count++] = 40;
+    job_yield();
+    order[count++] = 41;
+    return 7;
+}
+
+static void test_jobs(void)
+{
+    job *a = job_start("a", _copy, (void *)1);
+    job *b = job_start("b", _copy, (void *)2);
+    job *c = job_start("c", _copy, (void *)3);
+    job *d = job_start("d", _quick, NULL);
+    int runs = 0, left;
+
+    CHECK(a && b && c && d);
+    CHECK(job_first() == a && a->state == JOB_QUEUED);
+    job_detach(b);
+
+    // the UI's errno and screen survive every slice
+    errno = 42;
+    while ((left = sched_run()))
+    {
+        runs++;
+        CHECK(errno == 42);
+        CHECK(display);
+        CHECK(!job_current());
+        if (runs == SLABS + 2)
+            job_cancel(b);
+    }
+    CHECK(runs == 14);
+
+    // one at a time, oldest first, b sees the cancel when it gets the CPU back
+    static const int expect[] = {10, 11, 12, 13, 14, 20, 30, 31, 32, 33, 34, 40, 41};
+    CHECK(count == sizeof(expect) / sizeof(expect[0]));
+    for (int i = 0; i < count; i++)
+        CHECK(order[i] == expect[i]);
+
+    CHECK(a->state == JOB_DONE && a->result == 0 && a->error == 0);
+    CHECK(a->done == SLABS && a->total == SLABS);
+    CHECK(b->state == JOB_CANCELLED && b->error == ECANCELED);
+    CHECK(c->state == JOB_FAILED && c->error == EIO);
+    CHECK(d->state == JOB_DONE && d->result == 7);
+    CHECK(!a->stack && !b->stack && !c->stack && !d->stack);
+
+    job_reap(a);
+    job_reap(c);
+    job_reap(b);
+    job_reap(d);
+    CHECK(!job_first());
+    CHECK(sched_run() == 0);
+}
+
+// a job started while others wait goes to the back of the queue
+static void test_queue(void)
+{
+    count = 0;
+    job *a = job_start("a", _copy, (void *)1);
+    CHECK(sched_run() == 1);
+    job *b = job_start("b", _quick, NULL);
+    CHECK(sched_run() == 2);
+    CHECK(count == 2 && order[1] == 11);
+
+    job_reap(a);
+    CHECK(job_first() == a);
+    while (sched_run());
+    CHECK(order[SLABS - 1] == 14 && order[SLABS] == 40);
+
+    job_reap(a);
+    job_reap(b);
+    CHECK(!job_first());
+}
+
+int main(void)
+{
+    test_jobs();
+    test_queue();
+
+    printf("sched_test: %s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
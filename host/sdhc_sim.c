@@ -0,0 +1,252 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "sdhc_sim.h"
+#include "sdhc.h"
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REG(off)        sim->regs[(off) >> 2]
+#define NINTR(sim)      ((sim)->regs[SDHC_NINTR_STATUS >> 2])
+
+// status bits live in the low half of the word, errors in the high half
+static void _sim_raise(sdhc_sim *sim, u16 status, u16 error)
+{
+    NINTR(sim) |= status | ((u32)error << 16);
+    if (error)
+        NINTR(sim) |= SDHC_ERROR_INTERRUPT;
+}
+
+static void _sim_done(sdhc_sim *sim)
+{
+    sim->left = 0;
+    // the driver reads a zero block count as transfer complete
+    REG(SDHC_BLOCK_SIZE) &= 0xFFFF;
+    _sim_raise(sim, SDHC_TRANSFER_COMPLETE, 0);
+}
+
+static void _sim_copy(sdhc_sim *sim, u8 *mem, u32 len)
+{
+    if (sim->read)
+        memcpy(mem, sim->pos, len);
+    else
+        memcpy(sim->pos, mem, len);
+    sim->pos += len;
+    sim->left -= len;
+}
+
+static void _sim_adma_error(sdhc_sim *sim)
+{
+    REG(SDHC_ADMA_ERROR_STATUS) = 1;
+    _sim_raise(sim, 0, SDHC_ADMA_ERROR);
+}
+
+static void _sim_adma2(sdhc_sim *sim)
+{
+    u32 table = REG(SDHC_ADMA_SYSTEM_ADDR);
+
+    if (sim->fail_adma)
+    {
+        sim->fail_adma = false;
+        _sim_adma_error(sim);
+        return;
+    }
+
+    // the controller reads the table little-endian
+    for (int i = 0; i < 256; i++)
+    {
+        const struct sdhc_adma2_desc *d = (const void *)(uintptr_t)(table + i * sizeof(*d));
+        u32 attr = le32toh(d->attr_len);
+        u32 len = attr >> SDHC_ADMA2_LEN_SHIFT;
+
+        sim->adma_descs++;
+        if (!(attr & SDHC_ADMA2_VALID))
+            break;
+
+        if ((attr & SDHC_ADMA2_ACT_LINK) == SDHC_ADMA2_ACT_TRAN)
+        {
+            if (!len)
+                len = 0x10000;
+            if (len > sim->left)
+                break;
+            _sim_copy(sim, (u8 *)(uintptr_t)le32toh(d->addr), len);
+        }
+
+        if (attr & SDHC_ADMA2_END)
+        {
+            if (sim->left)
+                break;
+            _sim_done(sim);
+            return;
+        }
+    }
+
+    // an invalid descriptor, or the table and the block count disagree
+    _sim_adma_error(sim);
+}
+
+// runs until the transfer ends or the address crosses the SDMA boundary
+static void _sim_sdma(sdhc_sim *sim)
+{
+    u32 addr = REG(SDHC_DMA_ADDR);
+    u32 boundary = 4096 << ((REG(SDHC_BLOCK_SIZE) >> 12) & 7);
+    u32 len = boundary - (addr & (boundary - 1));
+
+    if (len > sim->left)
+        len = sim->left;
+    _sim_copy(sim, (u8 *)(uintptr_t)addr, len);
+
+    if (!sim->left)
+    {
+        _sim_done(sim);
+        return;
+    }
+
+    // the driver writes the next address back to carry on
+    REG(SDHC_DMA_ADDR) = addr + len;
+    sim->dma_irqs++;
+    _sim_raise(sim, SDHC_DMA_INTERRUPT, 0);
+}
+
+static void _sim_command(sdhc_sim *sim, u32 value)
+{
+    u16 command = value >> 16;
+    u16 mode = value & 0xFFFF;
+    u32 blksize = REG(SDHC_BLOCK_SIZE) & 0xFFF;
+    u32 blkcount = (mode & SDHC_BLOCK_COUNT_ENABLE) ? REG(SDHC_BLOCK_SIZE) >> 16 : 1;
+    u32 arg = REG(SDHC_ARGUMENT);
+
+    sim->commands++;
+    // R1 with the card in the transfer state
+    REG(SDHC_RESPONSE) = 4 << 9;
+    _sim_raise(sim, SDHC_COMMAND_COMPLETE, 0);
+
+    if (!(command & SDHC_DATA_PRESENT_SELECT))
+        return;
+
+    sim->data_commands++;
+    if (!blksize || (u64)arg * 512 + blksize * blkcount > (u64)sim->card_blocks * 512)
+    {
+        _sim_raise(sim, 0, SDHC_DATA_TIMEOUT_ERROR);
+        return;
+    }
+
+    // SDHC cards take a block address
+    sim->read = mode & SDHC_READ_MODE;
+    sim->pos = sim->card + arg * 512;
+    sim->left = blksize * blkcount;
+    sim->pio = !(mode & SDHC_DMA_ENABLE);
+
+    if (sim->pio)
+        return;
+    if ((REG(SDHC_HOST_CTL) & SDHC_DMA_SELECT_MASK) == SDHC_DMA_SELECT_ADMA2)
+        _sim_adma2(sim);
+    else
+        _sim_sdma(sim);
+}
+
+static u32 _sim_read(void *ctx, u32 off)
+{
+    sdhc_sim *sim = ctx;
+
+    switch (off)
+    {
+    case SDHC_DATA:
+    {
+        u32 v = 0;
+        if (sim->pio && sim->read && sim->left)
+        {
+            // the port is little-endian
+            v = sim->pos[0] | sim->pos[1] << 8 | sim->pos[2] << 16 | (u32)sim->pos[3] << 24;
+            sim->pos += 4;
+            sim->left -= 4;
+            sim->pio_words++;
+            if (!sim->left)
+                _sim_done(sim);
+        }
+        return v;
+    }
+    case SDHC_PRESENT_STATE:
+    {
+        u32 state = SDHC_CARD_INSERTED | SDHC_CARD_STATE_STABLE;
+        if (sim->pio && sim->left)
+            state |= sim->read ? SDHC_BUFFER_READ_ENABLE : SDHC_BUFFER_WRITE_ENABLE;
+        return state;
+    }
+    default:
+        return sim->regs[off >> 2];
+    }
+}
+
+static void _sim_write(void *ctx, u32 off, u32 data)
+{
+    sdhc_sim *sim = ctx;
+
+    switch (off)
+    {
+    case SDHC_DMA_ADDR:
+        REG(SDHC_DMA_ADDR) = data;
+        if (!sim->pio && sim->left)
+            _sim_sdma(sim);
+        break;
+    case SDHC_TRANSFER_MODE:
+        REG(SDHC_TRANSFER_MODE) = data;
+        _sim_command(sim, data);
+        break;
+    case SDHC_DATA:
+        if (sim->pio && !sim->read && sim->left)
+        {
+            sim->pos[0] = data;
+            sim->pos[1] = data >> 8;
+            sim->pos[2] = data >> 16;
+            sim->pos[3] = data >> 24;
+            sim->pos += 4;
+            sim->left -= 4;
+            sim->pio_words++;
+            if (!sim->left)
+                _sim_done(sim);
+        }
+        break;
+    case SDHC_CLOCK_CTL:
+        // the clock settles at once, resets finish at once
+        if (data & SDHC_INTCLK_ENABLE)
+            data |= SDHC_INTCLK_STABLE;
+        if ((data >> 24) & (SDHC_RESET_ALL | SDHC_RESET_DAT))
+            sim->left = 0;
+        REG(SDHC_CLOCK_CTL) = data & 0x00FFFFFF;
+        break;
+    case SDHC_NINTR_STATUS:
+        // write one to clear, for the status and the error halves
+        NINTR(sim) &= ~data;
+        if (!(NINTR(sim) >> 16))
+            NINTR(sim) &= ~SDHC_ERROR_INTERRUPT;
+        break;
+    case SDHC_CAPABILITIES:
+    case SDHC_SLOT_INTR_STATUS:
+    case SDHC_PRESENT_STATE:
+        break;
+    default:
+        sim->regs[off >> 2] = data;
+        break;
+    }
+}
+
+void sdhc_sim_init(sdhc_sim *sim, u32 caps, u16 version, u32 card_blocks)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->card = calloc(card_blocks, 512);
+    sim->card_blocks = card_blocks;
+    REG(SDHC_CAPABILITIES) = caps;
+    REG(SDHC_SLOT_INTR_STATUS) = (u32)version << 16;
+
+    host_mmio window = {SDHC_SIM_BASE, 0x100, _sim_read, _sim_write, sim};
+    host_mmio_map(&window);
+}
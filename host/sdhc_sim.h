@@ -0,0 +1,47 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _SDHC_SIM_H
+#define _SDHC_SIM_H
+
+#include "types.h"
+
+// where the stand-in's register set is mapped, SD0 on the real console
+#define SDHC_SIM_BASE   (0x0D070000)
+
+// A register-level SD host controller with an SDHC card behind it. It
+// serves the standard register set through host_mmio_map() and runs data
+// commands against a RAM disk by PIO, SDMA (with boundary interrupts) or
+// ADMA2 (walking the descriptor table in memory).
+typedef struct sdhc_sim {
+    u32 regs[64];
+    u8 *card;
+    u32 card_blocks;
+
+    // data phase of the command in flight
+    bool pio;
+    bool read;
+    u8 *pos;
+    u32 left;
+
+    // counters the tests look at
+    u32 commands;
+    u32 data_commands;
+    u32 adma_descs;
+    u32 dma_irqs;
+    u32 pio_words;
+
+    // the next ADMA2 transfer fails with an ADMA error
+    bool fail_adma;
+} sdhc_sim;
+
+// caps are SDHC_CAPABILITIES, version the SDHC_SPEC_* of the controller
+void sdhc_sim_init(sdhc_sim *sim, u32 caps, u16 version, u32 card_blocks);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// Runs source/lib/sdhc.c against the register-level stand-in.
+
+#include "sdhc.h"
+#include "sdhc_sim.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CARD_BLOCKS     (8192)
+#define CAPS_BASE       (SDHC_VOLTAGE_SUPP_3_3V | (50 << SDHC_BASE_FREQ_SHIFT))
+
+static sdhc_sim sim;
+static struct sdhc_host *hp;
+static int aborts;
+static int failed;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); failed++; } } while (0)
+
+static void _attach(struct sdhc_host *host)
+{
+    (void)host;
+}
+
+static void _abort(void)
+{
+    aborts++;
+}
+
+static void _host(u32 caps, int usedma)
+{
+    struct sdhc_host_params pa = {_attach, _abort, RB_SD0, WB_SD0};
+
+    sdhc_sim_init(&sim, caps, SDHC_SPEC_V2, CARD_BLOCKS);
+    if (!hp)
+        hp = host_dma_alloc(sizeof(struct sdhc_host));
+    CHECK(sdhc_host_found(hp, &pa, 0, SDHC_SIM_BASE, usedma) == 0);
+}
+
+static void _fill(u8 *p, u32 len, u32 seed)
+{
+    for (u32 i = 0; i < len; i++)
+        p[i] = (u8)(seed + i * 7 + (i >> 9));
+}
+
+static int _xfer(bool read, u32 block, void *data, struct sdmmc_sg *sg, int sgcount, u32 len)
+{
+    struct sdmmc_command cmd = {0};
+
+    cmd.c_opcode = read ? MMC_READ_BLOCK_MULTIPLE : MMC_WRITE_BLOCK_MULTIPLE;
+    cmd.c_arg = block;
+    cmd.c_data = data;
+    cmd.c_sg = sg;
+    cmd.c_sgcount = sgcount;
+    cmd.c_datalen = len;
+    cmd.c_blklen = 512;
+    cmd.c_flags = SCF_RSP_R1 | (read ? SCF_CMD_READ : 0);
+    sdhc_exec_command(hp, &cmd);
+
+    return cmd.c_error;
+}
+
+// one command scatters 1 MiB over three buffers and reads it back whole
+static void test_adma2(void)
+{
+    static const u32 sizes[] = {0x20000, 0x80000, 0x60000};
+    struct sdmmc_sg sg[3];
+    u32 total = 0;
+
+    _host(CAPS_BASE | SDHC_DMA_SUPPORT | SDHC_ADMA2_SUPP, 1);
+    CHECK(sdhc_can_sg(hp));
+    CHECK(sdhc_max_block_count(hp) == 2048);
+
+    for (int i = 0; i < 3; i++)
+    {
+        sg[i].sg_addr = host_dma_alloc(sizes[i]);
+        sg[i].sg_len = sizes[i];
+        _fill(sg[i].sg_addr, sizes[i], i);
+        total += sizes[i];
+    }
+
+    CHECK(_xfer(false, 16, NULL, sg, 3, total) == 0);
+    CHECK(sim.data_commands == 1);
+    CHECK(sim.adma_descs == 32);
+    CHECK(sim.dma_irqs == 0);
+
+    u8 *card = sim.card + 16 * 512;
+    for (int i = 0; i < 3; card += sizes[i], i++)
+        CHECK(!memcmp(card, sg[i].sg_addr, sizes[i]));
+
+    u8 *back = host_dma_alloc(total);
+    CHECK(_xfer(true, 16, back, NULL, 0, total) == 0);
+    CHECK(sim.data_commands == 2);
+    CHECK(!memcmp(back, sim.card + 16 * 512, total));
+}
+
+static void test_adma2_errors(void)
+{
+    struct sdmmc_sg sg = {host_dma_alloc(4096), 100};
+
+    _host(CAPS_BASE | SDHC_DMA_SUPPORT | SDHC_ADMA2_SUPP, 1);
+
+    // a segment that isn't whole cache lines never reaches the controller
+    CHECK(_xfer(false, 0, NULL, &sg, 1, 512) == EINVAL);
+    CHECK(sim.commands == 0);
+
+    // more than one table holds
+    u8 *big = host_dma_alloc(0x108000);
+    CHECK(_xfer(true, 0, big, NULL, 0, 0x108000) == EINVAL);
+
+    // the controller gives up on the table
+    aborts = 0;
+    sim.fail_adma = true;
+    CHECK(_xfer(true, 0, big, NULL, 0, 4096) != 0);
+    CHECK(aborts == 1);
+
+    // and the next command works again
+    CHECK(_xfer(true, 0, big, NULL, 0, 4096) == 0);
+}
+
+// SDMA stops at every 512 KiB boundary and the driver carries it on
+static void test_sdma(void)
+{
+    u8 *buf = host_dma_alloc(0x100000);
+    u8 *data = buf + 0x80000 - 0x10000;
+
+    _host(CAPS_BASE | SDHC_DMA_SUPPORT, 1);
+    CHECK(!sdhc_can_sg(hp));
+    CHECK(sdhc_max_block_count(hp) == SDHC_BLOCK_COUNT_MAX);
+
+    // let the buffer straddle a boundary wherever the arena put it
+    data = (u8 *)(((uintptr_t)data + 0x7FFFF) & ~0x7FFFFull) - 0x10000;
+    _fill(sim.card, 0x20000, 3);
+    CHECK(_xfer(true, 0, data, NULL, 0, 0x20000) == 0);
+    CHECK(sim.dma_irqs == 1);
+    CHECK(!memcmp(data, sim.card, 0x20000));
+
+    CHECK(_xfer(true, 0, data, NULL, 0, 0x20200) == EINVAL);
+}
+
+static void test_pio(void)
+{
+    u8 *out = host_dma_alloc(2048);
+    u8 *in = host_dma_alloc(2048);
+
+    _host(CAPS_BASE | SDHC_DMA_SUPPORT | SDHC_ADMA2_SUPP, 0);
+    CHECK(!sdhc_can_sg(hp));
+
+    _fill(out, 2048, 5);
+    CHECK(_xfer(false, 100, out, NULL, 0, 2048) == 0);
+    CHECK(!memcmp(sim.card + 100 * 512, out, 2048));
+    CHECK(_xfer(true, 100, in, NULL, 0, 2048) == 0);
+    CHECK(!memcmp(in, out, 2048));
+    CHECK(sim.pio_words == 1024);
+}
+
+int main(void)
+{
+    test_adma2();
+    test_adma2_errors();
+    test_sdma();
+    test_pio();
+
+    printf("sdhc_test: %s\n", failed ? "FAILED" : "ok");
+    return failed != 0;
+}
@@ -0,0 +1,160 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+// What the target code links against on the host: register accesses go to
+// the stand-in mapped with host_mmio_map(), caches and delays are no-ops and
+// the assembly helpers are plain C.
+
+#include "types.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HOST_DMA_ARENA  (64 << 20)
+
+static host_mmio mmio;
+static u8 *arena;
+static u32 arena_used;
+
+void host_mmio_map(const host_mmio *window)
+{
+    mmio = *window;
+}
+
+static host_mmio *_host_mmio(u32 addr)
+{
+    if (!mmio.size || addr < mmio.base || addr - mmio.base >= mmio.size || (addr & 3))
+    {
+        fprintf(stderr, "host: stray register access at %08x\n", addr);
+        abort();
+    }
+    return &mmio;
+}
+
+u32 read32(u32 addr)
+{
+    host_mmio *m = _host_mmio(addr);
+    return m->read(m->ctx, addr - m->base);
+}
+
+void write32(u32 addr, u32 data)
+{
+    host_mmio *m = _host_mmio(addr);
+    m->write(m->ctx, addr - m->base, data);
+}
+
+u32 set32(u32 addr, u32 set)
+{
+    u32 data = read32(addr) | set;
+    write32(addr, data);
+    return data;
+}
+
+u32 clear32(u32 addr, u32 clear)
+{
+    u32 data = read32(addr) & ~clear;
+    write32(addr, data);
+    return data;
+}
+
+u32 mask32(u32 addr, u32 clear, u32 set)
+{
+    u32 data = (read32(addr) & ~clear) | set;
+    write32(addr, data);
+    return data;
+}
+
+void *host_dma_alloc(u32 size)
+{
+    if (!arena)
+    {
+        arena = mmap(NULL, HOST_DMA_ARENA, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+        if (arena == MAP_FAILED)
+        {
+            perror("host: mmap");
+            abort();
+        }
+    }
+
+    size = (size + 31) & ~31;
+    if (arena_used + size > HOST_DMA_ARENA)
+    {
+        fprintf(stderr, "host: DMA arena exhausted\n");
+        abort();
+    }
+
+    void *p = arena + arena_used;
+    arena_used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+void *host_mem_map(u32 addr, u32 size)
+{
+    void *p = mmap((void *)(uintptr_t)addr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)(uintptr_t)addr)
+    {
+        fprintf(stderr, "host: cannot map %08x+%x\n", addr, size);
+        abort();
+    }
+    return p;
+}
+
+void memset32(void *dst, u32 value, u32 size)
+{
+    u32 *p = dst;
+    for (size /= 4; size--; )
+        *p++ = value;
+}
+
+void fill32(void *dst, u32 value, u32 size)
+{
+    memset32(dst, value, size);
+}
+
+u32 can_sdcard_dma_addr(void *p)
+{
+    return !((uintptr_t)p & 0x1F) && (uintptr_t)p < 0x100000000ull;
+}
+
+void dc_flushrange(const void *start, u32 size)
+{
+    (void)start;
+    (void)size;
+}
+
+void dc_invalidaterange(void *start, u32 size)
+{
+    (void)start;
+    (void)size;
+}
+
+void ahb_flush_to(enum rb_client dev)
+{
+    (void)dev;
+}
+
+void udelay(u32 d)
+{
+    (void)d;
+}
+
+void trace_event(u16 event, u16 status, u32 a, u32 b, u32 start)
+{
+    (void)event;
+    (void)status;
+    (void)a;
+    (void)b;
+    (void)start;
+}
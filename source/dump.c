@@ -1,5 +1,6 @@
 #include "dump.h"
 #include "console.h"
+#include "isfs.h"
 
 #include <unistd.h>
 #include <stdio.h>
@@ -7,168 +8,2857 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <malloc.h>
+#include <stdlib.h>
+
+#include "latte.h"
+#include "utils.h"
+#include "sha.h"
+#include "crc32.h"
+#include "minini.h"
+#include "progress.h"
+#include "deflate.h"
+#include "tinf.h"
+#include "sched.h"
+#include "elm.h"
 
 // from minute/dump.c
 
-int copy_file(const char* from, const char* to)
+// slabs are at least one SD multi-block command worth and a whole number of
+// the larger device unit (NAND cluster or FAT cluster)
+#define COPY_SLAB_MIN   (128 * 1024)
+#define COPY_SLAB_MAX   (1024 * 1024)
+#define COPY_SLAB_ALIGN 128
+// a slab is written in pieces of at least a FAT cluster and at most what the
+// hash engine takes at once, the next slab is read a piece at a time under them
+#define COPY_PIECE_MIN  (32 * 1024)
+#define COPY_PIECE_MAX  (SHA_ENGINE_BLOCKS * SHA_BLOCK_SIZE)
+
+#define COPY_MANIFEST_DIR   "sdmc:/antani"
+
+static struct {
+    int verify;
+    bool readback;
+    bool manifest;
+    u32 journal_mib;
+    bool compress;
+} copy_opts = {
+    .verify = COPY_VERIFY_SHA1,
+    .journal_mib = 16,
+};
+
+// The digest follows the stream through the slabs. SHA-1 runs on the hash
+// engine, which reads up to SHA_ENGINE_BLOCKS of a slab by itself per start:
+// _digest_feed() starts it on the first share and _digest_pump() hands it the
+// next one after each piece is written, so it works while the CPU sits in the
+// drivers. _digest_sync() only waits for what is left.
+typedef struct {
+    int mode;
+    u32 crc;
+    sha_ctx sha;
+    const u8 *hw_ptr;
+    u32 hw_blocks;
+    const u8 *tail;
+    size_t tail_len;
+    u8 hash[SHA_HASH_SIZE];
+} copy_digest;
+
+static void _digest_init(copy_digest *d, int mode)
+{
+    memset(d, 0, sizeof(*d));
+    d->mode = mode;
+    if (mode == COPY_VERIFY_SHA1)
+        sha_init(&d->sha);
+}
+
+static void _digest_pump(copy_digest *d)
+{
+    if (d->mode != COPY_VERIFY_SHA1)
+        return;
+
+    sha_wait(&d->sha);
+    if (!d->hw_blocks)
+        return;
+
+    u32 blocks = d->hw_blocks > SHA_ENGINE_BLOCKS ? SHA_ENGINE_BLOCKS : d->hw_blocks;
+    if (sha_start(&d->sha, d->hw_ptr, blocks) < 0)
+    {
+        // a partial block is buffered, finish on the CPU side
+        blocks = d->hw_blocks;
+        sha_update(&d->sha, d->hw_ptr, blocks * SHA_BLOCK_SIZE);
+    }
+
+    d->hw_ptr += blocks * SHA_BLOCK_SIZE;
+    d->hw_blocks -= blocks;
+}
+
+// the slab must stay untouched until _digest_sync()
+static void _digest_feed(copy_digest *d, const void *buf, size_t len)
+{
+    switch (d->mode)
+    {
+    case COPY_VERIFY_CRC32:
+        d->crc = crc32_update(d->crc, buf, len);
+        break;
+    case COPY_VERIFY_SHA1:
+        d->hw_ptr = buf;
+        d->hw_blocks = len / SHA_BLOCK_SIZE;
+        d->tail = d->hw_ptr + d->hw_blocks * SHA_BLOCK_SIZE;
+        d->tail_len = len % SHA_BLOCK_SIZE;
+        _digest_pump(d);
+        break;
+    }
+}
+
+static void _digest_sync(copy_digest *d)
+{
+    if (d->mode != COPY_VERIFY_SHA1)
+        return;
+
+    while (d->hw_blocks)
+        _digest_pump(d);
+    sha_wait(&d->sha);
+
+    if (d->tail_len)
+        sha_update(&d->sha, d->tail, d->tail_len);
+    d->tail_len = 0;
+}
+
+static void _digest_final(copy_digest *d)
+{
+    _digest_sync(d);
+
+    if (d->mode == COPY_VERIFY_SHA1)
+        sha_final(&d->sha, d->hash);
+    else if (d->mode == COPY_VERIFY_CRC32)
+        memcpy(d->hash, &d->crc, sizeof(d->crc));
+}
+
+static size_t _digest_size(const copy_digest *d)
+{
+    switch (d->mode)
+    {
+    case COPY_VERIFY_CRC32: return sizeof(u32);
+    case COPY_VERIFY_SHA1: return SHA_HASH_SIZE;
+    default: return 0;
+    }
+}
+
+static void _digest_hex(const copy_digest *d, char *out)
+{
+    for (size_t i = 0; i < _digest_size(d); i++)
+        sprintf(out + i * 2, "%02x", d->hash[i]);
+    out[_digest_size(d) * 2] = '\0';
+}
+
+int copy_ini(const char* key, const char* value)
+{
+    if (!strcmp(key, "verify"))
+    {
+        if (!strcmp(value, "none"))
+            copy_opts.verify = COPY_VERIFY_NONE;
+        else if (!strcmp(value, "crc32"))
+            copy_opts.verify = COPY_VERIFY_CRC32;
+        else if (!strcmp(value, "sha1"))
+            copy_opts.verify = COPY_VERIFY_SHA1;
+    }
+    else if (!strcmp(key, "readback"))
+        copy_opts.readback = minini_get_bool(value, copy_opts.readback);
+    else if (!strcmp(key, "manifest"))
+        copy_opts.manifest = minini_get_bool(value, copy_opts.manifest);
+    else if (!strcmp(key, "journal_mib"))
+        copy_opts.journal_mib = minini_get_uint(value, copy_opts.journal_mib);
+    else if (!strcmp(key, "compress"))
+        copy_opts.compress = minini_get_bool(value, copy_opts.compress);
+
+    return 0;
+}
+
+static size_t _copy_unit(const char *path)
+{
+    struct stat st;
+    struct statvfs vfs;
+
+    if (stat(path, &st) == 0 && st.st_blksize > 0)
+        return st.st_blksize;
+
+    // the destination usually doesn't exist yet, ask its volume
+    if (statvfs(path, &vfs) == 0 && vfs.f_bsize > 0)
+        return vfs.f_bsize;
+
+    return 512;
+}
+
+static size_t _copy_slab_size(const char *from, const char *to)
+{
+    size_t unit_from = _copy_unit(from);
+    size_t unit_to = _copy_unit(to);
+    size_t unit = unit_from > unit_to ? unit_from : unit_to;
+    size_t slab = COPY_SLAB_MIN;
+
+    if (unit > COPY_SLAB_MAX)
+        unit = COPY_SLAB_MAX;
+
+    slab = (slab + unit - 1) / unit * unit;
+    if (slab > COPY_SLAB_MAX)
+        slab = COPY_SLAB_MAX;
+
+    return slab;
+}
+
+static size_t _copy_piece_size(const char *from, const char *to)
+{
+    size_t unit_from = _copy_unit(from);
+    size_t unit_to = _copy_unit(to);
+    size_t piece = unit_from > unit_to ? unit_from : unit_to;
+
+    if (piece < COPY_PIECE_MIN)
+        piece = COPY_PIECE_MIN;
+    if (piece > COPY_PIECE_MAX)
+        piece = COPY_PIECE_MAX;
+
+    return piece;
+}
+
+// LT_TIMER wraps after ~37 minutes, so time is accumulated per slab
+static u32 _copy_ticks(u32 *mark)
+{
+    u32 now = read32(LT_TIMER);
+    u32 delta = now - *mark;
+    *mark = now;
+    return delta;
+}
+
+static ssize_t _copy_fill(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        ssize_t nread = read(fd, (char*)buf + done, size - done);
+
+        if (nread == 0)
+            break;
+        if (nread < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += nread;
+    }
+
+    return done;
+}
+
+static int _copy_drain(int fd, const void *buf, size_t size)
+{
+    const char *out_ptr = buf;
+
+    while (size > 0)
+    {
+        ssize_t nwritten = write(fd, out_ptr, size);
+
+        if (nwritten >= 0)
+        {
+            size -= nwritten;
+            out_ptr += nwritten;
+        }
+        else if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void copy_stats_print(const char *what, const copy_stats *stats)
+{
+    // ticks are 1.898 per microsecond
+    u64 ms = stats->ticks / 1898;
+    u64 kbps = ms ? stats->bytes * 1000 / 1024 / ms : 0;
+
+    printf("%s: %llu KiB in %llu.%03llu s, %llu KiB/s\n", what,
+            stats->bytes / 1024, ms / 1000, ms % 1000, kbps);
+}
+
+// only the destination is read again, the source digest is already known
+static int _copy_readback(const char *to, void *buf, size_t size, const copy_digest *want)
+{
+    copy_digest got;
+    ssize_t nread;
+    int fd = open(to, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    _digest_init(&got, want->mode);
+    while ((nread = _copy_fill(fd, buf, size)) > 0)
+    {
+        _digest_feed(&got, buf, nread);
+        _digest_sync(&got);
+    }
+    close(fd);
+
+    if (nread < 0)
+        return -1;
+
+    _digest_final(&got);
+    if (memcmp(got.hash, want->hash, _digest_size(want)))
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+// one "<digest>  <path>" line per file, the format sha1sum -c reads
+static void _copy_manifest(const char *to, const copy_digest *d)
+{
+    char hex[SHA_HASH_SIZE * 2 + 1];
+    const char *name = d->mode == COPY_VERIFY_SHA1 ? COPY_MANIFEST_DIR "/manifest.sha1" : COPY_MANIFEST_DIR "/manifest.crc32";
+
+    mkdir(COPY_MANIFEST_DIR, 0777);
+
+    FILE *f = fopen(name, "a");
+    if (!f)
+    {
+        printf("Cannot open %s: %s\n", name, strerror(errno));
+        return;
+    }
+
+    _digest_hex(d, hex);
+    fprintf(f, "%s  %s\n", hex, to);
+    fclose(f);
+}
+
+// The journal describes the running job (what to copy where), how many of
+// its entries are finished and how far the current file got. It is rewritten
+// every journal_mib MiB, right after the destination is synced, so the
+// recorded offset is always on the card. Entries are indices into the job's
+// own deterministic order: the tree scan, or the sorted batch list.
+#define COPY_JOURNAL        COPY_MANIFEST_DIR "/journal"
+#define COPY_JOURNAL_TMP    COPY_JOURNAL ".tmp"
+#define COPY_JOURNAL_MAGIC  0x414A4E4C // AJNL
+#define COPY_JOURNAL_TAIL   (64 * 1024)
+
+enum {
+    JOURNAL_FILE_COPY,
+    JOURNAL_FILE_MOVE,
+    JOURNAL_DIR_COPY,
+    JOURNAL_DIR_MOVE,
+    JOURNAL_BATCH_COPY,
+    JOURNAL_BATCH_MOVE,
+};
+
+typedef struct {
+    u32 magic;
+    u32 crc;        // of everything after this field
+    u32 op;
+    u32 count;      // source paths following the destination
+    u32 done;       // finished entries
+    u32 tail_crc;   // crc32 of the tail_len bytes before offset
+    u32 tail_len;
+    u32 pad;
+    u64 offset;     // bytes of entry `done` already written
+} journal_hdr;
+
+static struct {
+    bool active;
+    journal_hdr hdr;
+    const char *dest;
+    char **paths;
+    u64 unflushed;
+
+    // where the job being resumed left off
+    bool resuming;
+    journal_hdr resume;
+} journal;
+
+static void _journal_flush(void)
+{
+    size_t len = sizeof(journal_hdr) + strlen(journal.dest) + 1;
+    for (u32 i = 0; i < journal.hdr.count; i++)
+        len += strlen(journal.paths[i]) + 1;
+
+    u8 *buf = malloc(len);
+    if (!buf)
+        return;
+
+    u8 *p = buf + sizeof(journal_hdr);
+    p = (u8*)stpcpy((char*)p, journal.dest) + 1;
+    for (u32 i = 0; i < journal.hdr.count; i++)
+        p = (u8*)stpcpy((char*)p, journal.paths[i]) + 1;
+
+    journal.hdr.magic = COPY_JOURNAL_MAGIC;
+    memcpy(buf, &journal.hdr, sizeof(journal_hdr));
+    journal.hdr.crc = crc32(buf + 8, len - 8);
+    memcpy(buf, &journal.hdr, sizeof(journal_hdr));
+
+    // The old journal stays until a complete new one is on the card. FAT's
+    // rename won't replace a file, so there is a window with only the
+    // temporary one left; _journal_load looks there first.
+    mkdir(COPY_MANIFEST_DIR, 0777);
+    FILE *f = fopen(COPY_JOURNAL_TMP, "wb");
+    bool ok = f && fwrite(buf, len, 1, f) == 1;
+    if (f && fclose(f) != 0)
+        ok = false;
+    free(buf);
+
+    if (!ok)
+    {
+        printf("Cannot update the copy journal: %s\n", strerror(errno));
+        unlink(COPY_JOURNAL_TMP);
+        return;
+    }
+
+    unlink(COPY_JOURNAL);
+    if (rename(COPY_JOURNAL_TMP, COPY_JOURNAL) < 0)
+        return;
+    journal.unflushed = 0;
+}
+
+static void _journal_begin(int op, const char *dest, char **paths, u32 count)
+{
+    if (!copy_opts.journal_mib || journal.active)
+        return;
+
+    memset(&journal.hdr, 0, sizeof(journal.hdr));
+    journal.active = true;
+    journal.hdr.op = op;
+    journal.hdr.count = count;
+    journal.dest = dest;
+    journal.paths = paths;
+
+    // until the resumed job passes it, the old resume point stays valid
+    if (journal.resuming)
+    {
+        journal.hdr.done = journal.resume.done;
+        journal.hdr.offset = journal.resume.offset;
+        journal.hdr.tail_crc = journal.resume.tail_crc;
+        journal.hdr.tail_len = journal.resume.tail_len;
+    }
+    _journal_flush();
+}
+
+// a job that ran to completion has nothing left to resume
+static void _journal_end(int res)
+{
+    if (!journal.active)
+        return;
+
+    journal.active = false;
+    journal.resuming = false;
+    if (res == 0)
+    {
+        unlink(COPY_JOURNAL);
+        unlink(COPY_JOURNAL_TMP);
+    }
+}
+
+static void _journal_entry(u32 index)
+{
+    if (!journal.active)
+        return;
+
+    journal.hdr.done = index;
+    journal.hdr.offset = 0;
+    journal.hdr.tail_len = 0;
+}
+
+// resume offset of a job entry, 0 unless it is the one that was interrupted
+static u64 _journal_skip(u32 index, bool *skip)
+{
+    *skip = journal.resuming && index < journal.resume.done;
+    if (journal.resuming && index == journal.resume.done)
+        return journal.resume.offset;
+    return 0;
+}
+
+static void _journal_progress(int fd_to, u64 offset, const u8 *end, size_t len, bool force)
+{
+    if (!journal.active)
+        return;
+
+    journal.unflushed += len;
+    if (!force && journal.unflushed < (u64)copy_opts.journal_mib * 1024 * 1024)
+        return;
+
+    size_t tail = len > COPY_JOURNAL_TAIL ? COPY_JOURNAL_TAIL : len;
+    fsync(fd_to);
+    journal.hdr.offset = offset;
+    journal.hdr.tail_len = tail;
+    journal.hdr.tail_crc = crc32(end - tail, tail);
+    _journal_flush();
+}
+
+static int _journal_read(const char *path, journal_hdr *hdr, char **buf)
+{
+    struct stat st;
+    FILE *f;
+
+    *buf = NULL;
+    if (stat(path, &st) < 0 || st.st_size <= sizeof(journal_hdr))
+        return -1;
+
+    *buf = malloc(st.st_size + 1);
+    f = *buf ? fopen(path, "rb") : NULL;
+    if (!f)
+        return -1;
+
+    size_t len = fread(*buf, 1, st.st_size, f);
+    fclose(f);
+    (*buf)[len] = '\0';
+
+    memcpy(hdr, *buf, sizeof(journal_hdr));
+    if (len != st.st_size || hdr->magic != COPY_JOURNAL_MAGIC || hdr->crc != crc32(*buf + 8, len - 8))
+        return -1;
+
+    return len;
+}
+
+// a valid temporary journal is newer than the one it was meant to replace
+static int _journal_load(journal_hdr *hdr, char **buf)
+{
+    int len = _journal_read(COPY_JOURNAL_TMP, hdr, buf);
+    if (len >= 0)
+        return len;
+
+    free(*buf);
+    return _journal_read(COPY_JOURNAL, hdr, buf);
+}
+
+static int _copy_resume(int fd_from, int fd_to, u64 start, copy_digest *digest, void *buf, size_t size)
+{
+    u64 done = 0;
+
+    // the tail recorded with the offset must still be what the card holds
+    if (lseek(fd_to, start - journal.resume.tail_len, SEEK_SET) < 0 ||
+        _copy_fill(fd_to, buf, journal.resume.tail_len) != journal.resume.tail_len ||
+        crc32(buf, journal.resume.tail_len) != journal.resume.tail_crc)
+        return -1;
+
+    // the digest covers the whole file, take the prefix from the copy
+    if (digest->mode != COPY_VERIFY_NONE)
+    {
+        lseek(fd_to, 0, SEEK_SET);
+        while (done < start)
+        {
+            size_t chunk = start - done > size ? size : start - done;
+            if (_copy_fill(fd_to, buf, chunk) != chunk)
+                return -1;
+            _digest_feed(digest, buf, chunk);
+            _digest_sync(digest);
+            done += chunk;
+        }
+    }
+
+    if (lseek(fd_to, start, SEEK_SET) < 0 || lseek(fd_from, start, SEEK_SET) < 0)
+        return -1;
+
+    return 0;
+}
+
+enum {
+    COPY_POLL_NONE,
+    COPY_POLL_ABORT,    // POWER/Q, the user still confirms it
+    COPY_POLL_CANCEL,   // cancelled from the jobs screen
+};
+
+// Called between slabs: lets the menu run when the copy is a job, sends the
+// job to the background on B and looks for a request to stop.
+static int _copy_poll(void)
+{
+    job_yield();
+    if (job_cancelled())
+        return COPY_POLL_CANCEL;
+    // the menu owns the buttons while a job runs in the background
+    if (job_in_background())
+        return COPY_POLL_NONE;
+
+    int input = console_select_poll();
+    if ((input & CONSOLE_KEY_B) && job_current())
+    {
+        printf("Continuing in the background, see Jobs in the main menu.\n");
+        job_detach(job_current());
+    }
+
+    return (input & (CONSOLE_KEY_POWER | CONSOLE_KEY_Q)) ? COPY_POLL_ABORT : COPY_POLL_NONE;
+}
+
+static int _copy_file(const char* from, const char* to, copy_stats *total, u64 start)
+{
+    copy_digest digest = {0};
+    copy_stats file = {0};
+    int fd_to = -1, fd_from = -1;
+    int saved_errno, ret = -1;
+    u32 mark = read32(LT_TIMER), stage;
+    u64 offset = 0;
+    struct stat st;
+    size_t size = _copy_slab_size(from, to);
+    size_t piece = _copy_piece_size(from, to);
+    u8 *slab[2];
+    ssize_t len[2];
+    int cur = 0;
+
+    slab[0] = memalign(COPY_SLAB_ALIGN, 2 * size);
+    if (!slab[0])
+    {
+        errno = ENOMEM;
+        goto out;
+    }
+    slab[1] = slab[0] + size;
+
+    fd_from = open(from, O_RDONLY);
+    if (fd_from < 0)
+        goto out;
+
+    _digest_init(&digest, copy_opts.verify);
+
+    if (start)
+    {
+        fd_to = open(to, O_RDWR);
+        if (fd_to >= 0 && _copy_resume(fd_from, fd_to, start, &digest, slab[0], size) == 0)
+        {
+            printf("Resuming %s at %llu KiB\n", from, start / 1024);
+            offset = start;
+        }
+        else
+        {
+            printf("Cannot resume %s, starting over\n", from);
+            if (fd_to >= 0)
+                close(fd_to);
+            fd_to = -1;
+            _digest_init(&digest, copy_opts.verify);
+            lseek(fd_from, 0, SEEK_SET);
+        }
+    }
+
+    if (fd_to < 0)
+        fd_to = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_to < 0)
+        goto out;
+
+    console_select_flush();
+    progress_begin(fstat(fd_from, &st) == 0 && st.st_size > offset ? st.st_size - offset : 0);
+
+    // Two slabs: each piece of one is left writing on the card while the same
+    // share of the other is read, so a NAND read runs under the SD write. The
+    // hash engine takes the next piece of the slab being written meanwhile.
+    // Each stage is charged the time the CPU waits on it.
+    ELM_WriteBehind(slab[0], 2 * size);
+    stage = read32(LT_TIMER);
+    len[cur] = _copy_fill(fd_from, slab[cur], size);
+    progress_stage(PROGRESS_READ, _copy_ticks(&stage));
+    while (len[cur] > 0)
+    {
+        int next = !cur;
+
+        _digest_feed(&digest, slab[cur], len[cur]);
+        progress_stage(PROGRESS_HASH, _copy_ticks(&stage));
+
+        len[next] = 0;
+        for (size_t done = 0; done < len[cur]; done += piece)
+        {
+            size_t chunk = len[cur] - done < piece ? len[cur] - done : piece;
+
+            if (_copy_drain(fd_to, slab[cur] + done, chunk) < 0)
+                goto out;
+            progress_stage(PROGRESS_WRITE, _copy_ticks(&stage));
+            _digest_pump(&digest);
+            progress_stage(PROGRESS_HASH, _copy_ticks(&stage));
+
+            // a short read was the end of the source
+            if (len[next] == done)
+            {
+                ssize_t nread = _copy_fill(fd_from, slab[next] + done, chunk);
+                if (nread < 0)
+                    goto out;
+                len[next] += nread;
+                progress_stage(PROGRESS_READ, _copy_ticks(&stage));
+            }
+        }
+
+        // the last piece is still on its way, and this slab is read next
+        if (ELM_WriteBehind(slab[0], 2 * size) < 0)
+        {
+            errno = EIO;
+            goto out;
+        }
+        progress_stage(PROGRESS_WRITE, _copy_ticks(&stage));
+
+        _digest_sync(&digest);
+        progress_stage(PROGRESS_HASH, _copy_ticks(&stage));
+        offset += len[cur];
+        file.bytes += len[cur];
+        file.ticks += _copy_ticks(&mark);
+        progress_advance(len[cur]);
+
+        int poll = _copy_poll();
+        bool abort = poll == COPY_POLL_CANCEL;
+        if (poll == COPY_POLL_ABORT)
+        {
+            printf("Abort the copy of %s?%s\n", from, journal.active ? " It can be resumed later." : "");
+            abort = console_abort_confirmation("Abort", "Continue");
+            if (!abort)
+                progress_redraw();
+        }
+        // time spent prompting or in other jobs isn't copy time
+        mark = stage = read32(LT_TIMER);
+
+        _journal_progress(fd_to, offset, slab[cur] + len[cur], len[cur], abort);
+        if (abort)
+        {
+            errno = ECANCELED;
+            goto out;
+        }
+        cur = next;
+    }
+
+    if (len[cur] < 0)
+        goto out;
+    progress_end();
+
+    ret = close(fd_to);
+    fd_to = -1;
+    if (ret < 0)
+        goto out;
+
+    _digest_final(&digest);
+    if (copy_opts.verify != COPY_VERIFY_NONE && copy_opts.readback)
+    {
+        ret = _copy_readback(to, slab[0], size, &digest);
+        if (ret < 0)
+        {
+            printf("Read back of %s doesn't match!\n", to);
+            goto out;
+        }
+    }
+
+    file.ticks += _copy_ticks(&mark);
+    file.files = 1;
+    copy_stats_print("Copied", &file);
+
+    if (copy_opts.verify != COPY_VERIFY_NONE)
+    {
+        char hex[SHA_HASH_SIZE * 2 + 1];
+        _digest_hex(&digest, hex);
+        printf("%s %s%s\n", copy_opts.verify == COPY_VERIFY_SHA1 ? "SHA-1" : "CRC32", hex,
+                copy_opts.readback ? " (verified)" : "");
+
+        if (copy_opts.manifest)
+            _copy_manifest(to, &digest);
+    }
+
+    if (total)
+    {
+        total->bytes += file.bytes;
+        total->ticks += file.ticks;
+        total->files += file.files;
+    }
+
+  out:
+    saved_errno = errno;
+    progress_end();
+    ELM_WriteBehind(NULL, 0);
+
+    // the engine may still be reading a slab
+    if (digest.mode == COPY_VERIFY_SHA1)
+        sha_wait(&digest.sha);
+
+    if (fd_from >= 0)
+        close(fd_from);
+    if (fd_to >= 0)
+        close(fd_to);
+    free(slab[0]);
+
+    errno = saved_errno;
+    return ret;
+}
+
+int copy_file(const char* from, const char* to, copy_stats *total)
+{
+    return _copy_file(from, to, total, 0);
+}
+
+// a job entry: skipped when the resumed journal already finished it
+static int _copy_entry(u32 index, const char *from, const char *to, copy_stats *total)
+{
+    bool skip;
+    u64 start = _journal_skip(index, &skip);
+
+    if (skip)
+        return 0;
+
+    _journal_entry(index);
+    return _copy_file(from, to, total, start);
+}
+
+int copy_single(const char *from, const char *to)
+{
+    char *paths[] = {(char*)from};
+    int res;
+
+    _journal_begin(JOURNAL_FILE_COPY, to, paths, 1);
+    res = _copy_entry(0, from, to, NULL);
+    _journal_end(res);
+
+    return res;
+}
+
+int same_volume(const char *a, const char *b)
+{
+    const char *colon = strchr(a, ':');
+
+    return colon && !strncmp(a, b, colon - a + 1);
+}
+
+// rename() refuses to replace on sdmc, the caller already confirmed it
+static int _rename_replace(const char *from, const char *to)
+{
+    struct stat st;
+
+    if (rename(from, to) == 0)
+        return 0;
+
+    if (errno != EEXIST || stat(to, &st) < 0 || S_ISDIR(st.st_mode))
+        return -1;
+
+    if (delete_file(to) < 0)
+        return -1;
+
+    return rename(from, to);
+}
+
+int move_file(const char *from, const char *to)
+{
+    if (same_volume(from, to))
+    {
+        if (_rename_replace(from, to) == 0)
+            return 0;
+
+        // devices without rename fall through to the copy
+        if (errno != ENOSYS && errno != EXDEV)
+            return -1;
+    }
+
+    char *paths[] = {(char*)from};
+    int res;
+
+    _journal_begin(JOURNAL_FILE_MOVE, to, paths, 1);
+    res = _copy_entry(0, from, to, NULL);
+    if (res == 0)
+        res = delete_file(from);
+    _journal_end(res);
+
+    return res;
+}
+
+// directory trees are flattened into a list before any data moves: the list
+// is walked by index, so it is also the queue of directories still to scan,
+// parents always precede their children and no level recurses on the stack
+typedef struct {
+    char *path;     // relative to the job root, "" for the root itself
+    bool dir;
+    off_t size;
+    u32 ino;        // start cluster where the device reports one
+} tree_entry;
+
+typedef struct {
+    tree_entry *entry;
+    u32 count;
+    u32 alloc;
+    u32 dirs;
+    u32 files;
+    u64 bytes;
+} tree_job;
+
+static char *_tree_join(const char *a, const char *b)
+{
+    size_t len = strlen(a) + strlen(b) + 2;
+    char *path = malloc(len);
+
+    if (path)
+        snprintf(path, len, "%s%s%s", a, (*a && *b) ? "/" : "", b);
+    return path;
+}
+
+static int _tree_push(tree_job *job, char *path, bool dir, off_t size, u32 ino)
+{
+    if (!path)
+        return -1;
+
+    if (job->count == job->alloc)
+    {
+        u32 alloc = job->alloc ? job->alloc * 2 : 64;
+        tree_entry *entry = realloc(job->entry, alloc * sizeof(tree_entry));
+        if (!entry)
+        {
+            free(path);
+            errno = ENOMEM;
+            return -1;
+        }
+        job->entry = entry;
+        job->alloc = alloc;
+    }
+
+    job->entry[job->count++] = (tree_entry){path, dir, size, ino};
+    if (dir)
+        job->dirs++;
+    else
+    {
+        job->files++;
+        job->bytes += size;
+    }
+    return 0;
+}
+
+static void _tree_free(tree_job *job)
+{
+    for (u32 i = 0; i < job->count; i++)
+        free(job->entry[i].path);
+    free(job->entry);
+    memset(job, 0, sizeof(*job));
+}
+
+static int _tree_scan(tree_job *job, const char *root)
+{
+    if (_tree_push(job, _tree_join("", ""), true, 0, 0) < 0)
+        return -1;
+
+    for (u32 i = 0; i < job->count; i++)
+    {
+        if (!job->entry[i].dir)
+            continue;
+
+        char *dir = _tree_join(root, job->entry[i].path);
+        DIR *dfd = dir ? opendir(dir) : NULL;
+        if (!dfd)
+        {
+            printf("ERROR opening %s: %i\n", dir ? dir : root, errno);
+            free(dir);
+            return -1;
+        }
+
+        struct dirent *dp;
+        while ((dp = readdir(dfd)))
+        {
+            if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+                continue;
+
+            char *path = _tree_join(job->entry[i].path, dp->d_name);
+            bool is_dir = dp->d_type == DT_DIR;
+            struct stat st = {0};
+
+            if (path && !is_dir)
+            {
+                char *src = _tree_join(root, path);
+                if (!src || stat(src, &st) < 0)
+                    st.st_size = 0;
+                free(src);
+            }
+
+            if (_tree_push(job, path, is_dir, st.st_size, st.st_ino) < 0)
+            {
+                closedir(dfd);
+                free(dir);
+                return -1;
+            }
+        }
+
+        closedir(dfd);
+        free(dir);
+    }
+
+    return 0;
+}
+
+static int _tree_check_space(const tree_job *job, const char *to)
+{
+    struct statvfs vfs;
+    u64 needed = job->dirs;
+
+    if (statvfs(to, &vfs) < 0 || !vfs.f_frsize)
+        return 0;
+
+    for (u32 i = 0; i < job->count; i++)
+        if (!job->entry[i].dir)
+            needed += (job->entry[i].size + vfs.f_frsize - 1) / vfs.f_frsize;
+
+    if (needed > vfs.f_bavail)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+// files first, then directories deepest first
+static int _tree_delete(const tree_job *job, const char *root, bool dirs_only)
+{
+    int failed = 0;
+
+    isfs_batch_begin(root);
+
+    for (u32 pass = dirs_only ? 1 : 0; pass < 2; pass++)
+    {
+        for (u32 n = 0; n < job->count; n++)
+        {
+            const tree_entry *e = &job->entry[pass ? job->count - 1 - n : n];
+            if (e->dir != (pass == 1))
+                continue;
+
+            char *path = _tree_join(root, e->path);
+            if (!path || (e->dir ? rmdir(path) : delete_file(path)) < 0)
+            {
+                printf("Error deleting %s: %s\n", path ? path : e->path, strerror(errno));
+                failed++;
+            }
+            free(path);
+        }
+    }
+
+    if (isfs_batch_end(root) == -EIO)
+    {
+        printf("Error committing %s\n", root);
+        failed++;
+    }
+
+    return failed ? -1 : 0;
+}
+
+// relink moves the files by rename on the same volume instead of copying
+static int _tree_copy(const tree_job *job, const char *dir, const char *dest, copy_stats *total, bool relink)
+{
+    int failed = 0;
+
+    printf("%lu directories, %lu files, %llu KiB\n", job->dirs, job->files, job->bytes / 1024);
+
+    if (!relink && _tree_check_space(job, dest) < 0)
+        return -1;
+
+    isfs_batch_begin(dest);
+    if (!relink)
+        progress_job_begin(job->bytes);
+
+    // the whole directory skeleton goes down before any file data
+    for (u32 i = 0; i < job->count && !failed; i++)
+    {
+        if (!job->entry[i].dir)
+            continue;
+
+        char *path = _tree_join(dest, job->entry[i].path);
+        if (!path || (mkdir(path, 0777) < 0 && errno != EEXIST))
+        {
+            printf("ERROR creating %s: %s\n", path ? path : dest, strerror(errno));
+            failed++;
+        }
+        free(path);
+    }
+
+    for (u32 i = 0; i < job->count && !failed; i++)
+    {
+        if (job->entry[i].dir)
+            continue;
+
+        char *src = _tree_join(dir, job->entry[i].path);
+        char *dst = _tree_join(dest, job->entry[i].path);
+
+        printf("%s %s\n", relink ? "Moving" : "Copying", src ? src : job->entry[i].path);
+        if (!src || !dst || (relink ? _rename_replace(src, dst) : _copy_entry(i, src, dst, total)) < 0)
+        {
+            printf("Error %s %s: %s\n", relink ? "moving" : "copying", src ? src : job->entry[i].path, strerror(errno));
+            failed++;
+        }
+        free(src);
+        free(dst);
+    }
+
+    progress_job_end();
+    if (isfs_batch_end(dest) == -EIO)
+        failed++;
+
+    if (total->files > 1)
+        copy_stats_print("Total", total);
+
+    return failed ? -1 : 0;
+}
+
+static int _tree_prepare(tree_job *job, const char *dir, const char *dest)
+{
+    size_t len = strlen(dir);
+
+    if (!strncmp(dest, dir, len) && (dest[len] == '/' || dest[len] == '\0'))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    printf("Scanning %s\n", dir);
+    return _tree_scan(job, dir);
+}
+
+int copy_dir(const char* dir, const char* dest, copy_stats *total)
+{
+    tree_job job = {0};
+    copy_stats local = {0};
+    char *paths[] = {(char*)dir};
+    int res;
+
+    res = _tree_prepare(&job, dir, dest);
+    if (res == 0)
+    {
+        _journal_begin(JOURNAL_DIR_COPY, dest, paths, 1);
+        res = _tree_copy(&job, dir, dest, total ? total : &local, false);
+        _journal_end(res);
+    }
+
+    _tree_free(&job);
+    return res;
+}
+
+int move_dir(const char* dir, const char* dest)
+{
+    tree_job job = {0};
+    copy_stats total = {0};
+    bool relink = same_volume(dir, dest);
+    int res;
+
+    res = _tree_prepare(&job, dir, dest);
+
+    // a new name on the same volume is a single directory entry update,
+    // only merging into an existing folder needs the tree
+    if (res == 0 && relink && rename(dir, dest) == 0)
+    {
+        printf("Renamed %s\n", dir);
+        _tree_free(&job);
+        return 0;
+    }
+    if (relink && errno != EEXIST && errno != ENOTEMPTY)
+        relink = false;
+
+    // the source is only touched once every file has landed, a move within
+    // one ISFS volume commits once for both halves
+    char *paths[] = {(char*)dir};
+    if (res == 0 && !relink)
+        _journal_begin(JOURNAL_DIR_MOVE, dest, paths, 1);
+    isfs_batch_begin(dir);
+    if (res == 0)
+        res = _tree_copy(&job, dir, dest, &total, relink);
+    if (res == 0)
+        res = _tree_delete(&job, dir, relink);
+    if (isfs_batch_end(dir) == -EIO)
+        res = -1;
+    _journal_end(res);
+
+    _tree_free(&job);
+    return res;
+}
+
+int delete_file(const char *file)
+{
+    return unlink(file);
+}
+
+int delete_dir(const char *dir)
+{
+    tree_job job = {0};
+    int res;
+
+    if (_tree_scan(&job, dir) < 0)
+    {
+        _tree_free(&job);
+        return -1;
+    }
+
+    printf("Deleting %lu directories, %lu files\n", job.dirs, job.files);
+    res = _tree_delete(&job, dir, false);
+    _tree_free(&job);
+    return res;
+}
+
+int check_free_space(const char *from, const char *to)
+{
+    struct stat st;
+    struct statvfs vfs;
+    unsigned long long needed, avail;
+
+    if (stat(from, &st) < 0)
+        return -1;
+
+    // devices without statvfs can't tell, let the copy find out
+    if (statvfs(to, &vfs) < 0 || !vfs.f_frsize)
+        return 0;
+
+    needed = (st.st_size + vfs.f_frsize - 1) / vfs.f_frsize;
+    avail = vfs.f_bavail;
+
+    // a replaced file gives its clusters back, the stat glue of both
+    // filesystems leaves st_mode 0 for files so only directories are told apart
+    if (stat(to, &st) == 0 && !S_ISDIR(st.st_mode))
+        avail += (st.st_size + vfs.f_frsize - 1) / vfs.f_frsize;
+
+    if (needed > avail)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    return 0;
+}
+
+int exist_file(const char *file)
+{
+    return access(file, F_OK) == 0;
+}
+
+const char *get_file_name(const char *file)
+{
+    const char *volume = strchr(file, ':');
+    const char *name = strrchr(file, '/');
+
+    // "/name" of the last component, volume roots have none
+    if (!volume || !name || name < volume || name[1] == '\0')
+        return NULL;
+
+    return name;
+}
+
+// A batch is planned in full before anything runs: every source is stat'ed
+// for the totals shown with the single confirmation, and the list is put in
+// start cluster order so the source device reads front to back.
+struct batch_job {
+    int op;
+    char *dest;
+    u32 replaced;
+    tree_job list;
+};
+
+// stable, so entries without a start cluster keep the marking order
+static void _batch_sort(tree_job *list)
+{
+    for (u32 i = 1; i < list->count; i++)
+    {
+        tree_entry e = list->entry[i];
+        u32 j = i;
+
+        for (; j > 0 && list->entry[j - 1].ino > e.ino; j--)
+            list->entry[j] = list->entry[j - 1];
+        list->entry[j] = e;
+    }
+}
+
+static char *_batch_dest(const batch_job *job, const char *src)
+{
+    const char *name = get_file_name(src);
+    return name ? _tree_join(job->dest, name + 1) : NULL;
+}
+
+batch_job *batch_plan(int op, char **paths, int count, const char *dest)
+{
+    batch_job *job = calloc(1, sizeof(batch_job));
+    if (!job)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    job->op = op;
+    if (op != BATCH_DELETE && !(job->dest = strdup(dest)))
+        goto fail;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+
+        if (stat(paths[i], &st) < 0)
+        {
+            printf("Skipping %s: %s\n", paths[i], strerror(errno));
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            printf("Skipping %s: %s\n", paths[i], strerror(EISDIR));
+            continue;
+        }
+        if (_tree_push(&job->list, strdup(paths[i]), false, st.st_size, st.st_ino) < 0)
+            goto fail;
+    }
+
+    if (!job->list.count)
+    {
+        errno = ENOENT;
+        goto fail;
+    }
+
+    _batch_sort(&job->list);
+
+    if (op != BATCH_DELETE)
+    {
+        for (u32 i = 0; i < job->list.count; i++)
+        {
+            const char *name = get_file_name(job->list.entry[i].path);
+
+            // marks span folders but only the name goes to the destination:
+            // two files with one name would land on the same path, the second
+            // replacing the first. FAT ignores case, so this does too.
+            for (u32 j = 0; name && j < i; j++)
+            {
+                const char *other = get_file_name(job->list.entry[j].path);
+                if (other && !strcasecmp(name, other))
+                {
+                    printf("Both %s and %s would go to %s%s\n", job->list.entry[j].path,
+                        job->list.entry[i].path, dest, name);
+                    errno = EEXIST;
+                    goto fail;
+                }
+            }
+
+            char *dst = _batch_dest(job, job->list.entry[i].path);
+            if (dst && exist_file(dst))
+                job->replaced++;
+            free(dst);
+        }
+    }
+
+    printf("%lu files, %llu KiB", job->list.files, job->list.bytes / 1024);
+    if (job->replaced)
+        printf(", %lu will be replaced", job->replaced);
+    printf("\n");
+
+    bool relink = op == BATCH_MOVE && same_volume(job->list.entry[0].path, dest);
+    if (op != BATCH_DELETE && !relink && _tree_check_space(&job->list, dest) < 0)
+        goto fail;
+
+    return job;
+
+  fail:
+    batch_free(job);
+    return NULL;
+}
+
+int batch_run(batch_job *job)
+{
+    copy_stats total = {0};
+    const char *src_root = job->list.entry[0].path;
+    int failed = 0;
+
+    char **paths = NULL;
+    if (job->op != BATCH_DELETE && (paths = malloc(job->list.count * sizeof(char*))))
+    {
+        for (u32 i = 0; i < job->list.count; i++)
+            paths[i] = job->list.entry[i].path;
+        _journal_begin(job->op == BATCH_MOVE ? JOURNAL_BATCH_MOVE : JOURNAL_BATCH_COPY,
+                job->dest, paths, job->list.count);
+    }
+
+    isfs_batch_begin(src_root);
+    if (job->dest)
+        isfs_batch_begin(job->dest);
+    progress_job_begin(job->list.bytes);
+
+    for (u32 i = 0; i < job->list.count; i++)
+    {
+        const char *src = job->list.entry[i].path;
+        char *dst = NULL;
+        bool skip;
+        int res;
+
+        _journal_skip(i, &skip);
+        if (skip)
+            continue;
+
+        if (job->op == BATCH_DELETE)
+        {
+            printf("Deleting %s\n", src);
+            res = delete_file(src);
+        }
+        else if (!(dst = _batch_dest(job, src)))
+        {
+            errno = EINVAL;
+            res = -1;
+        }
+        else if (job->op == BATCH_MOVE && same_volume(src, dst))
+        {
+            printf("Moving %s\n", src);
+            res = _rename_replace(src, dst);
+        }
+        else
+        {
+            printf("Copying %s\n", src);
+            res = _copy_entry(i, src, dst, &total);
+            if (res == 0 && job->op == BATCH_MOVE)
+                res = delete_file(src);
+        }
+
+        if (res < 0)
+        {
+            printf("Error on %s: %s\n", src, strerror(errno));
+            failed++;
+        }
+        free(dst);
+
+        if (res < 0 && errno == ECANCELED)
+            break;
+    }
+
+    progress_job_end();
+    if (job->dest && isfs_batch_end(job->dest) == -EIO)
+        failed++;
+    if (isfs_batch_end(src_root) == -EIO)
+        failed++;
+
+    if (total.files > 1)
+        copy_stats_print("Total", &total);
+    if (failed)
+        printf("%d of %lu files failed\n", failed, job->list.count);
+
+    _journal_end(failed);
+    free(paths);
+    return failed ? -1 : 0;
+}
+
+void batch_free(batch_job *job)
+{
+    if (!job)
+        return;
+
+    _tree_free(&job->list);
+    free(job->dest);
+    free(job);
+}
+
+int copy_resume(void)
+{
+    static const char *what[] = {
+        "copy", "move", "folder copy", "folder move", "batch copy", "batch move",
+    };
+    journal_hdr hdr;
+    char *buf, *dest;
+    char **paths = NULL;
+    int res = -1;
+
+    if (_journal_load(&hdr, &buf) < 0)
+    {
+        free(buf);
+        return 0;
+    }
+
+    if (hdr.op > JOURNAL_BATCH_MOVE || !hdr.count)
+        goto discard;
+    if (hdr.op >= JOURNAL_BATCH_COPY && hdr.done >= hdr.count)
+        goto discard;
+    if (!(paths = malloc(hdr.count * sizeof(char*))))
+        goto discard;
+
+    dest = buf + sizeof(journal_hdr);
+    char *p = dest + strlen(dest) + 1;
+    for (u32 i = 0; i < hdr.count; i++)
+    {
+        paths[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    printf("An interrupted %s of %s%s to %s was found,\n", what[hdr.op], paths[0], hdr.count > 1 ? " and others" : "", dest);
+    printf("stopped at entry %lu, %llu KiB into it. Resume it?\n", hdr.done, hdr.offset / 1024);
+    if (console_abort_confirmation("Discard", "Resume"))
+        goto discard;
+
+    journal.resuming = true;
+    journal.resume = hdr;
+
+    switch (hdr.op)
+    {
+    case JOURNAL_FILE_COPY:
+        res = copy_single(paths[0], dest);
+        break;
+    case JOURNAL_FILE_MOVE:
+        res = move_file(paths[0], dest);
+        break;
+    case JOURNAL_DIR_COPY:
+        res = copy_dir(paths[0], dest, NULL);
+        break;
+    case JOURNAL_DIR_MOVE:
+        res = move_dir(paths[0], dest);
+        break;
+    case JOURNAL_BATCH_COPY:
+    case JOURNAL_BATCH_MOVE:
+    {
+        // finished moves are gone from the source, the batch restarts at
+        // the interrupted entry
+        batch_job *job = batch_plan(hdr.op == JOURNAL_BATCH_MOVE ? BATCH_MOVE : BATCH_COPY,
+                paths + hdr.done, hdr.count - hdr.done, dest);
+        journal.resume.done = 0;
+        if (job)
+            res = batch_run(job);
+        batch_free(job);
+        break;
+    }
+    }
+
+    journal.resuming = false;
+    if (res == 0)
+        printf("Success!\n");
+    else
+        printf("Failed: %s!\n", strerror(errno));
+    free(paths);
+    free(buf);
+    return 1;
+
+  discard:
+    unlink(COPY_JOURNAL);
+    unlink(COPY_JOURNAL_TMP);
+    free(paths);
+    free(buf);
+    return 0;
+}
+
+// Archives are tar-style: every entry is a block sized header followed by its
+// data padded to whole blocks, written front to back through one large
+// buffer. An index of all entries and a trailer block close the archive, so
+// single entries can be found without reading the ones before them.
+// Compressed archives are the same stream in gzip, read front to back.
+#define ARCHIVE_BLOCK           512
+#define ARCHIVE_MAGIC           0x41415231 // "AAR1"
+#define ARCHIVE_INDEX_MAGIC     0x41494458 // "AIDX"
+#define ARCHIVE_GZIP_DICT       (32 * 1024)
+
+typedef struct {
+    u32 magic;
+    u32 crc;        // crc32 of the header after this field
+    u8 mode;        // isfs_fst mode, the low bits are the type: 1 file, 2 directory
+    u8 attr;
+    u16 uid;
+    u16 gid;
+    u16 x1;
+    u32 x3;
+    u32 size;
+    char path[ARCHIVE_BLOCK - 24];  // relative to the archived folder
+} archive_hdr;
+_Static_assert(sizeof(archive_hdr) == ARCHIVE_BLOCK, "archive_hdr must be one block!");
+
+typedef struct {
+    u64 offset;     // of the entry header
+    u32 size;
+    u32 crc;        // crc32 of the data
+    u32 path;       // into the string table after the index
+    u32 pad;
+} archive_index;
+
+typedef struct {
+    u32 magic;
+    u32 crc;        // crc32 of the index and string table
+    u32 count;
+    u32 len;        // of the index and string table
+    u64 offset;     // of the index
+    u8 pad[ARCHIVE_BLOCK - 24];
+} archive_trailer;
+_Static_assert(sizeof(archive_trailer) == ARCHIVE_BLOCK, "archive_trailer must be one block!");
+
+typedef struct {
+    int fd;
+    u8 *buf;
+    size_t len;
+    u64 offset;     // of buf[0] in the archive
+    deflate_stream *z;
+} archive_out;
+
+// the inflater pulls compressed bytes through readSource
+typedef struct {
+    TINF_DATA d;
+    int fd;
+    u8 *buf;
+    size_t len;
+    size_t pos;
+    bool eof;
+    u8 *dict;
+} archive_gzip;
+
+typedef struct {
+    int fd;
+    u64 offset;     // in the archive stream
+    u64 size;       // of the stream, from the gzip trailer mod 4 GiB
+    archive_gzip *gz;
+} archive_in;
+
+static size_t _archive_pad(u64 size)
+{
+    return (ARCHIVE_BLOCK - size % ARCHIVE_BLOCK) % ARCHIVE_BLOCK;
+}
+
+static bool _archive_is_gzip(const char *archive)
+{
+    size_t len = strlen(archive);
+    return len > 3 && !strcasecmp(archive + len - 3, ".gz");
+}
+
+const char *archive_suffix(void)
+{
+    return copy_opts.compress ? ".aar.gz" : ".aar";
+}
+
+static int _archive_write(archive_out *out, const void *data, size_t len)
+{
+    u32 stage = read32(LT_TIMER);
+    int res = _copy_drain(out->fd, data, len);
+
+    progress_stage(PROGRESS_WRITE, _copy_ticks(&stage));
+    return res;
+}
+
+static int _archive_flush(archive_out *out)
+{
+    const void *data = out->buf;
+    size_t len = out->len;
+
+    if (out->z)
+    {
+        u32 stage = read32(LT_TIMER);
+        deflate_slab(out->z, out->buf, out->len, (const u8**)&data, &len);
+        progress_stage(PROGRESS_ZIP, _copy_ticks(&stage));
+    }
+
+    out->offset += out->len;
+    out->len = 0;
+    return _archive_write(out, data, len);
+}
+
+static int _archive_put(archive_out *out, const void *data, size_t len)
+{
+    while (len)
+    {
+        size_t chunk = COPY_SLAB_MAX - out->len;
+        if (chunk > len)
+            chunk = len;
+
+        if (data)
+            memcpy(out->buf + out->len, data, chunk);
+        else
+            memset(out->buf + out->len, 0, chunk);
+        out->len += chunk;
+        len -= chunk;
+        if (data)
+            data = (const u8*)data + chunk;
+
+        if (out->len == COPY_SLAB_MAX && _archive_flush(out) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// file data goes straight from the source into the buffer
+static int _archive_put_file(archive_out *out, const char *path, u32 size, u32 *crc)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    *crc = 0;
+    while (size)
+    {
+        // whole clusters keep ISFS reads off its bounce buffer
+        size_t chunk = COPY_SLAB_MAX - out->len;
+        if (chunk > CLUSTER_SIZE)
+            chunk -= chunk % CLUSTER_SIZE;
+        if (chunk > size)
+            chunk = size;
+
+        u32 stage = read32(LT_TIMER);
+        ssize_t nread = _copy_fill(fd, out->buf + out->len, chunk);
+        if (nread != chunk)
+        {
+            // the file shrank since the scan
+            if (nread >= 0)
+                errno = EIO;
+            close(fd);
+            return -1;
+        }
+        progress_stage(PROGRESS_READ, _copy_ticks(&stage));
+        *crc = crc32_update(*crc, out->buf + out->len, chunk);
+        progress_stage(PROGRESS_HASH, _copy_ticks(&stage));
+        progress_advance(chunk);
+        job_yield();
+
+        out->len += chunk;
+        size -= chunk;
+        if (out->len == COPY_SLAB_MAX && _archive_flush(out) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+static void _archive_meta(archive_hdr *hdr, const char *path, bool dir)
+{
+    isfs_fst *fst = isfs_stat(path);
+
+    if (fst)
+    {
+        hdr->mode = fst->mode;
+        hdr->attr = fst->attr;
+        hdr->uid = fst->uid;
+        hdr->gid = fst->gid;
+        hdr->x1 = fst->x1;
+        hdr->x3 = fst->x3;
+    }
+    else
+    {
+        hdr->mode = dir ? 2 : 1;
+    }
+}
+
+static int _archive_index(archive_out *out, const tree_job *job, archive_index *entry)
+{
+    archive_trailer trailer = {0};
+    size_t strings = 0;
+    int res = -1;
+
+    for (u32 i = 0; i < job->count; i++)
+        strings += strlen(job->entry[i].path) + 1;
+
+    trailer.len = job->count * sizeof(archive_index) + strings;
+    u8 *index = malloc(trailer.len);
+    if (!index)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *table = (char*)index + job->count * sizeof(archive_index);
+    char *p = table;
+    for (u32 i = 0; i < job->count; i++)
+    {
+        entry[i].path = p - table;
+        p = stpcpy(p, job->entry[i].path) + 1;
+    }
+    memcpy(index, entry, job->count * sizeof(archive_index));
+
+    trailer.magic = ARCHIVE_INDEX_MAGIC;
+    trailer.count = job->count;
+    trailer.offset = out->offset + out->len;
+    trailer.crc = crc32(index, trailer.len);
+
+    if (_archive_put(out, index, trailer.len) == 0 &&
+        _archive_put(out, NULL, _archive_pad(trailer.len)) == 0 &&
+        _archive_put(out, &trailer, sizeof(trailer)) == 0 &&
+        _archive_flush(out) == 0)
+        res = 0;
+
+    free(index);
+    return res;
+}
+
+int archive_create(const char *dir, const char *archive)
+{
+    tree_job job = {0};
+    archive_out out = {.fd = -1};
+    archive_index *index = NULL;
+    int failed = 0, saved_errno;
+    copy_stats stats = {0};
+    u32 mark = read32(LT_TIMER);
+
+    if (_tree_prepare(&job, dir, archive) < 0)
+        goto out;
+
+    printf("%lu directories, %lu files, %llu KiB\n", job.dirs, job.files, job.bytes / 1024);
+    // compressed archives take what they take, the raw size is the bound
+    if (_tree_check_space(&job, archive) < 0)
+        goto out;
+
+    index = calloc(job.count, sizeof(archive_index));
+    out.buf = memalign(COPY_SLAB_ALIGN, COPY_SLAB_MAX);
+    if (_archive_is_gzip(archive))
+        out.z = deflate_begin(COPY_SLAB_MAX);
+    if (!index || !out.buf || (_archive_is_gzip(archive) && !out.z))
+    {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    out.fd = open(archive, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out.fd < 0)
+        goto out;
+
+    // thousands of small entries: the bar is the only output per entry
+    console_select_flush();
+    progress_begin(job.bytes);
+
+    for (u32 i = 0; i < job.count; i++)
+    {
+        archive_hdr hdr = {0};
+        char *src = _tree_join(dir, job.entry[i].path);
+        size_t len = strlen(job.entry[i].path);
+
+        if (!src || len >= sizeof(hdr.path))
+        {
+            printf("ERROR archiving %s: %s\n", src ? src : job.entry[i].path, strerror(src ? ENAMETOOLONG : ENOMEM));
+            free(src);
+            failed++;
+            break;
+        }
+
+        _archive_meta(&hdr, src, job.entry[i].dir);
+        memcpy(hdr.path, job.entry[i].path, len);
+        hdr.magic = ARCHIVE_MAGIC;
+        hdr.size = job.entry[i].dir ? 0 : job.entry[i].size;
+        hdr.crc = crc32((u8*)&hdr + 8, sizeof(hdr) - 8);
+
+        index[i].offset = out.offset + out.len;
+        index[i].size = hdr.size;
+        if (_archive_put(&out, &hdr, sizeof(hdr)) < 0 ||
+            (!job.entry[i].dir && (_archive_put_file(&out, src, hdr.size, &index[i].crc) < 0 ||
+             _archive_put(&out, NULL, _archive_pad(hdr.size)) < 0)))
+        {
+            printf("ERROR archiving %s: %s\n", src, strerror(errno));
+            free(src);
+            failed++;
+            break;
+        }
+        free(src);
+
+        int poll = _copy_poll();
+        if (poll == COPY_POLL_ABORT)
+        {
+            printf("Abort the backup of %s?\n", dir);
+            if (console_abort_confirmation("Abort", "Continue"))
+                poll = COPY_POLL_CANCEL;
+            else
+                progress_redraw();
+        }
+        if (poll == COPY_POLL_CANCEL)
+        {
+            errno = ECANCELED;
+            failed++;
+            break;
+        }
+    }
+
+    if (!failed && _archive_index(&out, &job, index) < 0)
+    {
+        printf("ERROR writing the index: %s\n", strerror(errno));
+        failed++;
+    }
+    if (!failed && out.z)
+    {
+        const u8 *tail;
+        size_t tail_len;
+
+        deflate_end(out.z, &tail, &tail_len);
+        if (_archive_write(&out, tail, tail_len) < 0)
+            failed++;
+    }
+    progress_end();
+
+    if (!failed)
+    {
+        stats.bytes = out.offset;
+        stats.ticks = _copy_ticks(&mark);
+        stats.files = job.files;
+        copy_stats_print("Archived", &stats);
+    }
+
+  out:
+    saved_errno = errno;
+    if (out.fd >= 0 && close(out.fd) < 0 && !failed)
+    {
+        saved_errno = errno;
+        failed++;
+    }
+    if (out.fd >= 0 && failed)
+        unlink(archive);
+    deflate_free(out.z);
+    free(out.buf);
+    free(index);
+    _tree_free(&job);
+    errno = saved_errno;
+    return (failed || out.fd < 0) ? -1 : 0;
+}
+
+static unsigned char _archive_gzip_byte(TINF_DATA *d)
+{
+    archive_gzip *gz = (archive_gzip*)d;
+
+    if (gz->pos == gz->len)
+    {
+        ssize_t nread = gz->eof ? 0 : _copy_fill(gz->fd, gz->buf, COPY_SLAB_MIN);
+        gz->pos = 0;
+        gz->len = nread > 0 ? nread : 0;
+        // a truncated stream decodes zeros until the checks catch it
+        if (!gz->len)
+        {
+            gz->eof = true;
+            return 0;
+        }
+    }
+    return gz->buf[gz->pos++];
+}
+
+static int _archive_open(archive_in *in, const char *archive)
+{
+    memset(in, 0, sizeof(*in));
+    in->fd = open(archive, O_RDONLY);
+    if (in->fd < 0)
+        return -1;
+    if (!_archive_is_gzip(archive))
+        return 0;
+
+    archive_gzip *gz = in->gz = calloc(1, sizeof(archive_gzip));
+    if (gz)
+    {
+        gz->buf = malloc(COPY_SLAB_MIN);
+        gz->dict = malloc(ARCHIVE_GZIP_DICT);
+    }
+    if (!gz || !gz->buf || !gz->dict)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // gzip ends in the stream size, read before the header takes the fd
+    u32 isize;
+    off_t end = lseek(in->fd, 0, SEEK_END);
+    if (end >= 4 && lseek(in->fd, end - 4, SEEK_SET) >= 0 && _copy_fill(in->fd, &isize, 4) == 4)
+        in->size = _byteswap_ulong(isize);
+    if (lseek(in->fd, 0, SEEK_SET) < 0)
+        return -1;
+
+    gz->fd = in->fd;
+    gz->d.readSource = _archive_gzip_byte;
+    uzlib_init();
+    uzlib_uncompress_init(&gz->d, gz->dict, ARCHIVE_GZIP_DICT);
+    if (uzlib_gzip_parse_header(&gz->d) != TINF_OK)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static void _archive_close(archive_in *in)
+{
+    if (in->fd >= 0)
+        close(in->fd);
+    if (in->gz)
+    {
+        free(in->gz->buf);
+        free(in->gz->dict);
+        free(in->gz);
+    }
+}
+
+static int _archive_read(archive_in *in, void *buf, size_t len)
+{
+    if (!len)
+        return 0;
+
+    if (!in->gz)
+    {
+        if (_copy_fill(in->fd, buf, len) != len)
+        {
+            errno = EILSEQ;
+            return -1;
+        }
+    }
+    else
+    {
+        in->gz->d.dest = buf;
+        in->gz->d.destSize = len;
+        if (uzlib_uncompress_chksum(&in->gz->d) != TINF_OK || in->gz->eof)
+        {
+            errno = EILSEQ;
+            return -1;
+        }
+    }
+
+    in->offset += len;
+    progress_advance(len);
+    return 0;
+}
+
+// gzip streams only go forward, the skipped data is inflated into buf
+static int _archive_seek(archive_in *in, u64 offset, void *buf)
+{
+    if (!in->gz)
+    {
+        if (lseek(in->fd, offset, SEEK_SET) < 0)
+            return -1;
+        in->offset = offset;
+        return 0;
+    }
+
+    if (offset < in->offset)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    while (in->offset < offset)
+    {
+        size_t chunk = offset - in->offset > COPY_SLAB_MAX ? COPY_SLAB_MAX : offset - in->offset;
+        if (_archive_read(in, buf, chunk) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// the whole gzip stream is checked once its end is reached
+static int _archive_gzip_check(archive_in *in, void *buf)
+{
+    int res;
+
+    do
+    {
+        in->gz->d.dest = buf;
+        in->gz->d.destSize = COPY_SLAB_MAX;
+        res = uzlib_uncompress_chksum(&in->gz->d);
+    } while (res == TINF_OK && !in->gz->eof);
+
+    if (res != TINF_DONE)
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+    return 0;
+}
+
+// index and string table of an archive, NULL with errno set when it is damaged
+static u8 *_archive_load_index(int fd, archive_trailer *trailer)
+{
+    off_t end = lseek(fd, 0, SEEK_END);
+
+    if (end < (off_t)sizeof(*trailer) || lseek(fd, end - sizeof(*trailer), SEEK_SET) < 0 ||
+        _copy_fill(fd, trailer, sizeof(*trailer)) != sizeof(*trailer) ||
+        trailer->magic != ARCHIVE_INDEX_MAGIC || trailer->offset + trailer->len > end ||
+        trailer->count * sizeof(archive_index) > trailer->len)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    u8 *index = malloc(trailer->len + 1);
+    if (!index)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (lseek(fd, trailer->offset, SEEK_SET) < 0 ||
+        _copy_fill(fd, index, trailer->len) != trailer->len ||
+        crc32(index, trailer->len) != trailer->crc)
+    {
+        free(index);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // the string table always ends in a terminator
+    index[trailer->len] = '\0';
+    return index;
+}
+
+// crc is the one from the index, gzip archives are checked as a whole instead
+static int _archive_restore_file(archive_in *in, const archive_hdr *hdr, const char *to, bool isfs,
+        void *buf, const u32 *crc)
 {
-    int fd_to, fd_from;
-    char buf[4096];
-    ssize_t nread;
-    int saved_errno;
+    u32 size = hdr->size, got = 0;
 
-    fd_from = open(from, O_RDONLY);
-    if (fd_from < 0)
-        return -1;
+    if (isfs)
+    {
+        // ISFS files are written whole, padded out to a cluster
+        size_t padded = ((size + CLUSTER_SIZE - 1) / CLUSTER_SIZE) * CLUSTER_SIZE;
+        u8 *data = memalign(COPY_SLAB_ALIGN, padded);
+        if (!data)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        memset(data + size, 0, padded - size);
+
+        if (_archive_read(in, data, size) < 0 || (crc && crc32(data, size) != *crc))
+        {
+            free(data);
+            errno = EILSEQ;
+            return -1;
+        }
+
+        isfs_fst meta = {
+            .mode = hdr->mode,
+            .attr = hdr->attr,
+            .uid = hdr->uid,
+            .gid = hdr->gid,
+            .x1 = hdr->x1,
+            .x3 = hdr->x3,
+        };
+        int res = isfs_write_file(to, &meta, data, size);
+        if (res == -EEXIST && (res = isfs_unlink(to)) == 0)
+            res = isfs_write_file(to, &meta, data, size);
+        free(data);
+
+        if (res)
+        {
+            errno = -res;
+            return -1;
+        }
+        return 0;
+    }
 
-    fd_to = open(to, O_WRONLY | O_CREAT, 0666);
+    int fd_to = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
     if (fd_to < 0)
-        goto out_error;
+        return -1;
 
-    while (nread = read(fd_from, buf, sizeof buf), nread > 0)
+    while (size)
     {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+        size_t chunk = size > COPY_SLAB_MAX ? COPY_SLAB_MAX : size;
+        if (_archive_read(in, buf, chunk) < 0)
+            break;
+        got = crc32_update(got, buf, chunk);
+        if (_copy_drain(fd_to, buf, chunk) < 0)
+            break;
+        size -= chunk;
 
-        do {
-            nwritten = write(fd_to, out_ptr, nread);
+        job_yield();
+        if (size && job_cancelled())
+        {
+            errno = ECANCELED;
+            break;
+        }
+    }
 
-            if (nwritten >= 0)
-            {
-                nread -= nwritten;
-                out_ptr += nwritten;
-            }
-            else if (errno != EINTR)
+    int res = close(fd_to);
+    if (res == 0 && !size && crc && got != *crc)
+    {
+        errno = EILSEQ;
+        res = -1;
+    }
+    if (res < 0 || size)
+    {
+        unlink(to);
+        return -1;
+    }
+    return 0;
+}
+
+static bool _archive_member(const char *path, const char *member, size_t len)
+{
+    return !member || (!strncmp(path, member, len) && (path[len] == '/' || path[len] == '\0'));
+}
+
+int archive_restore(const char *archive, const char *dest, const char *member)
+{
+    archive_trailer trailer = {0};
+    archive_in in;
+    u8 *index = NULL;
+    void *buf = NULL;
+    int failed = 0, saved_errno;
+    size_t strip = 0, member_len = member ? strlen(member) : 0;
+    u64 total = 0, next = 0;
+    bool isfs = false;
+
+    if (_archive_open(&in, archive) < 0)
+    {
+        failed++;
+        goto out;
+    }
+
+    // plain archives are walked through their index, gzip ones front to back
+    // up to where the index starts
+    if (!in.gz && !(index = _archive_load_index(in.fd, &trailer)))
+    {
+        failed++;
+        goto out;
+    }
+
+    buf = memalign(COPY_SLAB_ALIGN, COPY_SLAB_MAX);
+    if (!buf)
+    {
+        errno = ENOMEM;
+        failed++;
+        goto out;
+    }
+
+    const archive_index *entry = (const archive_index*)index;
+    const char *strings = (const char*)index + trailer.count * sizeof(archive_index);
+
+    // a member comes out under dest with the path below its parent
+    if (member)
+    {
+        const char *slash = strrchr(member, '/');
+        strip = slash ? slash - member + 1 : 0;
+    }
+
+    if (index)
+    {
+        for (u32 i = 0; i < trailer.count; i++)
+        {
+            if (entry[i].path >= trailer.len - trailer.count * sizeof(archive_index))
             {
-                goto out_error;
+                errno = EINVAL;
+                failed++;
+                goto out;
             }
-        } while (nread > 0);
+            if (_archive_member(strings + entry[i].path, member, member_len))
+                total += ARCHIVE_BLOCK + entry[i].size;
+        }
+        printf("Restoring %lu entries, %llu KiB\n", trailer.count, total / 1024);
+    }
+    else
+    {
+        total = in.size;
+        printf("Restoring %s, %llu KiB\n", archive, total / 1024);
     }
 
-    if (nread == 0)
+    // ISFS restores land in the superblock once, at the end
+    isfs = isfs_batch_begin(dest) == 0;
+    progress_begin(total);
+
+    for (u32 i = 0; index ? i < trailer.count : true; i++)
     {
-        if (close(fd_to) < 0)
+        archive_hdr hdr;
+
+        if (index && !_archive_member(strings + entry[i].path, member, member_len))
+            continue;
+
+        if (_archive_seek(&in, index ? entry[i].offset : next, buf) < 0 ||
+            _archive_read(&in, &hdr, sizeof(hdr)) < 0)
         {
-            fd_to = -1;
-            goto out_error;
+            printf("ERROR reading %s: %s\n", archive, strerror(errno));
+            failed++;
+            break;
         }
-        close(fd_from);
 
-        /* Success! */
-        return 0;
+        // a gzip archive ran into its index
+        if (!index && hdr.magic == ARCHIVE_INDEX_MAGIC)
+            break;
+
+        hdr.path[sizeof(hdr.path) - 1] = '\0';
+        if (hdr.magic != ARCHIVE_MAGIC || hdr.crc != crc32((u8*)&hdr + 8, sizeof(hdr) - 8) ||
+            (index && strcmp(hdr.path, strings + entry[i].path)))
+        {
+            printf("ERROR: the header of entry %lu is damaged\n", i);
+            errno = EINVAL;
+            failed++;
+            break;
+        }
+
+        next = in.offset + hdr.size + _archive_pad(hdr.size);
+        if (!_archive_member(hdr.path, member, member_len))
+            continue;
+
+        // the archived folder itself is dest, which is already there
+        const char *rel = hdr.path + (strlen(hdr.path) < strip ? strlen(hdr.path) : strip);
+        if (!*rel)
+            continue;
+
+        char *to = _tree_join(dest, rel);
+        if (!to)
+        {
+            errno = ENOMEM;
+            failed++;
+            break;
+        }
+
+        int res = 0;
+        if ((hdr.mode & 3) == 2)
+        {
+            if (isfs)
+            {
+                isfs_fst meta = {
+                    .mode = hdr.mode,
+                    .attr = hdr.attr,
+                    .uid = hdr.uid,
+                    .gid = hdr.gid,
+                    .x1 = hdr.x1,
+                    .x3 = hdr.x3,
+                };
+                res = isfs_mkdir(to, &meta);
+                if (res == -EEXIST)
+                    res = 0;
+                errno = -res;
+            }
+            else if (mkdir(to, 0777) < 0 && errno != EEXIST)
+            {
+                res = -1;
+            }
+        }
+        else
+        {
+            res = _archive_restore_file(&in, &hdr, to, isfs, buf, index ? &entry[i].crc : NULL);
+        }
+
+        if (res)
+        {
+            printf("ERROR restoring %s: %s\n", to, strerror(errno));
+            failed++;
+        }
+        free(to);
+        if (failed)
+            break;
     }
+    progress_end();
 
-  out_error:
-    saved_errno = errno;
+    if (!failed && in.gz && _archive_gzip_check(&in, buf) < 0)
+    {
+        printf("ERROR: %s is damaged\n", archive);
+        failed++;
+    }
 
-    close(fd_from);
-    if (fd_to >= 0)
-        close(fd_to);
+    if (isfs && isfs_batch_end(dest) == -EIO)
+    {
+        errno = EIO;
+        failed++;
+    }
 
+  out:
+    saved_errno = errno;
+    _archive_close(&in);
+    free(index);
+    free(buf);
     errno = saved_errno;
-    return -1;
+    return failed ? -1 : 0;
+}
+
+// The store keeps every file content once, named by its SHA-1, under
+// objects/<first byte>/<rest of the digest>. A backup is just a manifest of
+// the tree pointing into it, numbered per source folder. An unchanged
+// superblock generation means nothing on the volume changed and the last
+// manifest still holds. Otherwise every file is hashed again: ISFS hands out
+// freed clusters first fit, so a file that was deleted and written again
+// usually gets back the same size and FAT chain start with other data.
+#define STORE_DIR           COPY_MANIFEST_DIR "/store"
+#define STORE_OBJECTS       STORE_DIR "/objects"
+#define STORE_MAGIC         0x4153544D // "ASTM"
+#define STORE_OBJECT_LEN    (sizeof(STORE_OBJECTS) + SHA_HASH_SIZE * 2 + 2)
+
+typedef struct {
+    u32 magic;
+    u32 crc;        // crc32 of the entries and string table
+    u32 generation; // of the source superblock, 0 when it is no ISFS volume
+    u32 count;
+    u32 len;        // of the entries and string table
+    u32 pad[3];
+} store_hdr;
+
+typedef struct {
+    u8 hash[SHA_HASH_SIZE];  // zero for directories
+    u32 size;
+    u16 sub;        // start of the FAT chain
+    u8 mode;
+    u8 attr;
+    u16 uid;
+    u16 gid;
+    u16 x1;
+    u16 pad;
+    u32 x3;
+    u32 path;       // into the string table
+} store_entry;
+
+typedef struct {
+    u32 hashed;
+    u32 objects;
+    u64 written;
+} store_stats;
+
+// "slc:/sys/title" -> "slc_sys_title"
+static void _store_key(const char *dir, char *key, size_t size)
+{
+    size_t n = 0;
+
+    for (; *dir && n + 1 < size; dir++)
+    {
+        char c = (*dir == ':' || *dir == '/') ? '_' : *dir;
+        if (c == '_' && (!n || key[n - 1] == '_'))
+            continue;
+        key[n++] = c;
+    }
+    while (n && key[n - 1] == '_')
+        n--;
+    key[n] = '\0';
 }
 
-void copy_dir(const char* dir, const char* dest)
+static void _store_object(const u8 *hash, char *path)
 {
-    printf("Copying %s\n", dir);
+    char *p = path + sprintf(path, "%s/%02x/", STORE_OBJECTS, hash[0]);
 
-    int res = mkdir(dest, 777);
-    if(res){
-        if(errno != EEXIST) {
-            printf("ERROR creating %s: %i\n", dest, errno);
-            console_power_to_continue();
-            return;
-        }
-        printf("Warning: '%s' directory already exists\n", dest);
-        if (console_abort_confirmation_power_no_eject_yes()) 
-            return;
+    for (int i = 1; i < SHA_HASH_SIZE; i++)
+        p += sprintf(p, "%02x", hash[i]);
+}
+
+// entries and string table of a manifest, NULL with errno set when it is damaged
+static u8 *_store_load(const char *manifest, store_hdr *hdr)
+{
+    u8 *data = NULL;
+    int fd = open(manifest, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    if (_copy_fill(fd, hdr, sizeof(*hdr)) != sizeof(*hdr) || hdr->magic != STORE_MAGIC ||
+        hdr->count * sizeof(store_entry) > hdr->len)
+    {
+        errno = EINVAL;
+        goto out;
     }
-    DIR *dfd = opendir(dir);
-    if(!dfd){
-        printf("ERROR opening %s: %i\n", dir, errno);
-        console_power_to_continue();
-        return;
+
+    data = malloc(hdr->len + 1);
+    if (!data)
+    {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    if (_copy_fill(fd, data, hdr->len) != hdr->len || crc32(data, hdr->len) != hdr->crc)
+    {
+        free(data);
+        data = NULL;
+        errno = EINVAL;
+        goto out;
     }
-    struct dirent *dp;
-    while(dp = readdir(dfd)){
-        char src_pathbuf[255];
-        snprintf(src_pathbuf, 254, "%s/%s", dir, dp->d_name);
-        char dst_pathbuf[255];
-        snprintf(dst_pathbuf, 254, "%s/%s", dest, dp->d_name);
 
-        printf("Copying %s\n", src_pathbuf);
-        int res = copy_file(src_pathbuf, dst_pathbuf);
-        if(!res){
-            printf("Error copying %s\n", src_pathbuf);
+    // the string table always ends in a terminator
+    data[hdr->len] = '\0';
+    const store_entry *entry = (const store_entry*)data;
+    for (u32 i = 0; i < hdr->count; i++)
+    {
+        if (entry[i].path >= hdr->len - hdr->count * sizeof(store_entry))
+        {
+            free(data);
+            data = NULL;
+            errno = EINVAL;
+            break;
         }
-    } 
+    }
 
-    closedir(dfd);
+  out:
+    close(fd);
+    return data;
 }
 
-int delete_file(const char *file)
+// number of the newest manifest in a folder, 0 when there is none
+static u32 _store_latest(const char *keydir)
 {
-    return unlink(file);
+    DIR *dfd = opendir(keydir);
+    struct dirent *dp;
+    u32 latest = 0;
+
+    if (!dfd)
+        return 0;
+
+    while ((dp = readdir(dfd)))
+    {
+        char *end;
+        u32 seq = strtoul(dp->d_name, &end, 16);
+        if (!strcasecmp(end, ".man") && seq > latest)
+            latest = seq;
+    }
+
+    closedir(dfd);
+    return latest;
 }
 
-void delete_dir(const char *dir)
+// the digest pass keeps files of up to a slab in buf, so only larger new
+// ones are read a second time to be stored
+static int _store_put(const char *src, u32 size, u8 *hash, void *buf, store_stats *stats)
 {
-    DIR *dfd = opendir(dir);
-    if(!dfd){
-        printf("ERROR opening %s: %i\n", dir, errno);
-        console_power_to_continue();
-        return;
+    char object[STORE_OBJECT_LEN], tmp[STORE_OBJECT_LEN + 4];
+    copy_digest digest;
+    u32 left = size;
+    int fd_to, res = -1;
+    int fd = open(src, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    _digest_init(&digest, COPY_VERIFY_SHA1);
+    while (left)
+    {
+        size_t chunk = left > COPY_SLAB_MAX ? COPY_SLAB_MAX : left;
+        u32 stage = read32(LT_TIMER);
+
+        if (_copy_fill(fd, buf, chunk) != chunk)
+        {
+            errno = EIO;
+            goto out;
+        }
+        progress_stage(PROGRESS_READ, _copy_ticks(&stage));
+        _digest_feed(&digest, buf, chunk);
+        _digest_sync(&digest);
+        progress_stage(PROGRESS_HASH, _copy_ticks(&stage));
+        progress_advance(chunk);
+        job_yield();
+        left -= chunk;
+    }
+    _digest_final(&digest);
+    memcpy(hash, digest.hash, SHA_HASH_SIZE);
+    stats->hashed++;
+
+    _store_object(hash, object);
+    if (exist_file(object))
+    {
+        res = 0;
+        goto out;
     }
-    struct dirent *dp;
-    while(dp = readdir(dfd)){
-        char src_pathbuf[255];
-        snprintf(src_pathbuf, 254, "%s/%s", dir, dp->d_name);
 
-        printf("Deleting %s\n", src_pathbuf);
-        int res = delete_file(src_pathbuf);
-        if(!res){
-            printf("Error deleting %s\n", src_pathbuf);
+    // objects appear under their name only once they are complete
+    *strrchr(object, '/') = '\0';
+    mkdir(object, 0777);
+    _store_object(hash, object);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", object);
+
+    if (size > COPY_SLAB_MAX && lseek(fd, 0, SEEK_SET) < 0)
+        goto out;
+
+    fd_to = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_to < 0)
+        goto out;
+
+    for (left = size; left; )
+    {
+        size_t chunk = left > COPY_SLAB_MAX ? COPY_SLAB_MAX : left;
+        u32 stage = read32(LT_TIMER);
+
+        if (size > COPY_SLAB_MAX && _copy_fill(fd, buf, chunk) != chunk)
+        {
+            errno = EIO;
+            break;
         }
-    } 
+        progress_stage(PROGRESS_READ, _copy_ticks(&stage));
+        if (_copy_drain(fd_to, buf, chunk) < 0)
+            break;
+        progress_stage(PROGRESS_WRITE, _copy_ticks(&stage));
+        left -= chunk;
+    }
 
-    closedir(dfd);
+    if (close(fd_to) < 0 || left || rename(tmp, object) < 0)
+    {
+        unlink(tmp);
+        goto out;
+    }
+
+    stats->objects++;
+    stats->written += size;
+    res = 0;
+
+  out:
+    close(fd);
+    return res;
 }
 
-int exist_file(const char *file)
+static void _store_meta(store_entry *entry, const char *path, bool dir)
 {
-    return access(file, F_OK) == 0;
+    isfs_fst *fst = isfs_stat(path);
+
+    if (fst)
+    {
+        entry->sub = fst->sub;
+        entry->mode = fst->mode;
+        entry->attr = fst->attr;
+        entry->uid = fst->uid;
+        entry->gid = fst->gid;
+        entry->x1 = fst->x1;
+        entry->x3 = fst->x3;
+    }
+    else
+    {
+        entry->mode = dir ? 2 : 1;
+    }
 }
 
-const char *get_file_name(const char *file)
+static int _store_write_manifest(const char *keydir, u32 seq, store_hdr *hdr, const tree_job *job,
+        store_entry *entry)
 {
-    char *inner;
-    char* realpath;
-    size_t pos;
-    
-    inner = strstr(file, "//");
+    char name[_MAX_LFN + 1], tmp[_MAX_LFN + 1];
+    size_t strings = 0;
+    int res = -1;
 
-    if (!inner)
+    for (u32 i = 0; i < job->count; i++)
+        strings += strlen(job->entry[i].path) + 1;
+
+    hdr->len = job->count * sizeof(store_entry) + strings;
+    u8 *data = malloc(hdr->len);
+    if (!data)
     {
-        return NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *table = (char*)data + job->count * sizeof(store_entry);
+    char *p = table;
+    for (u32 i = 0; i < job->count; i++)
+    {
+        entry[i].path = p - table;
+        p = stpcpy(p, job->entry[i].path) + 1;
+    }
+    memcpy(data, entry, job->count * sizeof(store_entry));
+
+    hdr->magic = STORE_MAGIC;
+    hdr->count = job->count;
+    hdr->crc = crc32(data, hdr->len);
+
+    snprintf(name, sizeof(name), "%s/%08lx.man", keydir, seq);
+    snprintf(tmp, sizeof(tmp), "%s/%08lx.tmp", keydir, seq);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0)
+    {
+        if (_copy_drain(fd, hdr, sizeof(*hdr)) == 0 && _copy_drain(fd, data, hdr->len) == 0)
+            res = 0;
+        if (close(fd) < 0 || res < 0 || rename(tmp, name) < 0)
+        {
+            unlink(tmp);
+            res = -1;
+        }
+    }
+
+    if (res == 0)
+        printf("Manifest %s\n", name);
+    free(data);
+    return res;
+}
+
+int store_backup(const char *dir)
+{
+    char key[_MAX_LFN + 1], keydir[_MAX_LFN + 1], prev_name[_MAX_LFN + 1];
+    tree_job job = {0};
+    store_hdr hdr = {0}, prev_hdr = {0};
+    store_entry *entry = NULL;
+    store_stats stats = {0};
+    u8 *prev = NULL;
+    void *buf = NULL;
+    int failed = 0, saved_errno;
+    copy_stats total = {0};
+    u32 mark = read32(LT_TIMER);
+    bool isfs = isfs_get_generation(dir, &hdr.generation) == 0;
+
+    _store_key(dir, key, sizeof(key));
+    snprintf(keydir, sizeof(keydir), "%s/%s", STORE_DIR, *key ? key : "root");
+    mkdir(COPY_MANIFEST_DIR, 0777);
+    mkdir(STORE_DIR, 0777);
+    mkdir(STORE_OBJECTS, 0777);
+    if (mkdir(keydir, 0777) < 0 && errno != EEXIST)
+        return -1;
+
+    u32 seq = _store_latest(keydir);
+    if (seq)
+    {
+        snprintf(prev_name, sizeof(prev_name), "%s/%08lx.man", keydir, seq);
+        prev = _store_load(prev_name, &prev_hdr);
+        if (!prev)
+            printf("Cannot use %s: %s\n", prev_name, strerror(errno));
+    }
+
+    if (isfs && prev && prev_hdr.generation == hdr.generation)
+    {
+        printf("%s has not changed since %s\n", dir, prev_name);
+        free(prev);
+        return 0;
     }
 
-    inner += 2;
+    if (_tree_prepare(&job, dir, STORE_DIR) < 0)
+    {
+        failed++;
+        goto out;
+    }
+    printf("%lu directories, %lu files, %llu KiB\n", job.dirs, job.files, job.bytes / 1024);
+
+    entry = calloc(job.count, sizeof(store_entry));
+    buf = memalign(COPY_SLAB_ALIGN, COPY_SLAB_MAX);
+    if (!entry || !buf)
+    {
+        errno = ENOMEM;
+        failed++;
+        goto out;
+    }
+
+    console_select_flush();
+    progress_begin(job.bytes);
+
+    for (u32 i = 0; i < job.count; i++)
+    {
+        char *src = _tree_join(dir, job.entry[i].path);
+        if (!src)
+        {
+            errno = ENOMEM;
+            failed++;
+            break;
+        }
+
+        _store_meta(&entry[i], src, job.entry[i].dir);
+        if (job.entry[i].dir)
+        {
+            free(src);
+            continue;
+        }
+        entry[i].size = job.entry[i].size;
+
+        if (_store_put(src, entry[i].size, entry[i].hash, buf, &stats) < 0)
+        {
+            printf("ERROR storing %s: %s\n", src, strerror(errno));
+            failed++;
+        }
+        free(src);
+        if (failed)
+            break;
+
+        int poll = _copy_poll();
+        if (poll == COPY_POLL_ABORT)
+        {
+            printf("Abort the backup of %s?\n", dir);
+            if (console_abort_confirmation("Abort", "Continue"))
+                poll = COPY_POLL_CANCEL;
+            else
+                progress_redraw();
+        }
+        if (poll == COPY_POLL_CANCEL)
+        {
+            errno = ECANCELED;
+            failed++;
+            break;
+        }
+    }
+    progress_end();
+
+    if (!failed && _store_write_manifest(keydir, seq + 1, &hdr, &job, entry) < 0)
+    {
+        printf("ERROR writing the manifest: %s\n", strerror(errno));
+        failed++;
+    }
+
+    if (!failed)
+    {
+        printf("%lu files hashed, %lu new objects\n", stats.hashed, stats.objects);
+        total.bytes = stats.written;
+        total.ticks = _copy_ticks(&mark);
+        total.files = stats.objects;
+        copy_stats_print("Stored", &total);
+    }
+
+  out:
+    saved_errno = errno;
+    _tree_free(&job);
+    free(entry);
+    free(prev);
+    free(buf);
+    errno = saved_errno;
+    return failed ? -1 : 0;
+}
 
-    while (inner != NULL)
+int store_restore(const char *manifest, const char *dest)
+{
+    store_hdr hdr;
+    void *buf = NULL;
+    int failed = 0, saved_errno;
+    u64 total = 0;
+    bool isfs;
+    u8 *data = _store_load(manifest, &hdr);
+
+    if (!data)
+        return -1;
+
+    buf = memalign(COPY_SLAB_ALIGN, COPY_SLAB_MAX);
+    if (!buf)
     {
-        realpath = inner + 1;
-        inner = strchr(realpath, '/');
+        free(data);
+        errno = ENOMEM;
+        return -1;
     }
 
-#if 0
-    pos = realpath - file;
+    const store_entry *entry = (const store_entry*)data;
+    const char *strings = (const char*)data + hdr.count * sizeof(store_entry);
+
+    for (u32 i = 0; i < hdr.count; i++)
+        total += entry[i].size;
+    printf("Restoring %lu entries, %llu KiB\n", hdr.count, total / 1024);
+
+    // ISFS restores land in the superblock once, at the end
+    isfs = isfs_batch_begin(dest) == 0;
+    progress_begin(total);
+
+    for (u32 i = 0; i < hdr.count && !failed; i++)
+    {
+        const char *path = strings + entry[i].path;
+        int res = 0;
+
+        // the backed up folder itself is dest, which is already there
+        if (!*path)
+            continue;
+
+        char *to = _tree_join(dest, path);
+        if (!to)
+        {
+            errno = ENOMEM;
+            failed++;
+            break;
+        }
+
+        // objects are plain data, the archive entry code writes them out
+        archive_hdr meta = {
+            .mode = entry[i].mode,
+            .attr = entry[i].attr,
+            .uid = entry[i].uid,
+            .gid = entry[i].gid,
+            .x1 = entry[i].x1,
+            .x3 = entry[i].x3,
+            .size = entry[i].size,
+        };
+
+        if ((entry[i].mode & 3) == 2)
+        {
+            if (isfs)
+            {
+                isfs_fst fst = {
+                    .mode = meta.mode,
+                    .attr = meta.attr,
+                    .uid = meta.uid,
+                    .gid = meta.gid,
+                    .x1 = meta.x1,
+                    .x3 = meta.x3,
+                };
+                res = isfs_mkdir(to, &fst);
+                if (res == -EEXIST)
+                    res = 0;
+                errno = -res;
+            }
+            else if (mkdir(to, 0777) < 0 && errno != EEXIST)
+            {
+                res = -1;
+            }
+        }
+        else
+        {
+            char object[STORE_OBJECT_LEN];
+            archive_in in = {0};
+
+            _store_object(entry[i].hash, object);
+            in.fd = open(object, O_RDONLY);
+            res = in.fd < 0 ? -1 : _archive_restore_file(&in, &meta, to, isfs, buf, NULL);
+            _archive_close(&in);
+        }
+
+        if (res)
+        {
+            printf("ERROR restoring %s: %s\n", to, strerror(errno));
+            failed++;
+        }
+        free(to);
+    }
+    progress_end();
 
-    memcpy(out, file, pos);
-    out[pos] = '\0';
+    if (isfs && isfs_batch_end(dest) == -EIO)
+    {
+        errno = EIO;
+        failed++;
+    }
 
-    return out;
-#else
-    return realpath - 1;
-#endif
+    saved_errno = errno;
+    free(data);
+    free(buf);
+    errno = saved_errno;
+    return failed ? -1 : 0;
 }
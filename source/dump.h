@@ -1,10 +1,52 @@
 #pragma once
 
+#include "types.h"
+
+typedef struct {
+    u64 bytes;
+    u64 ticks;  // LT_TIMER ticks
+    u32 files;
+} copy_stats;
+
+enum {
+    COPY_VERIFY_NONE,
+    COPY_VERIFY_CRC32,
+    COPY_VERIFY_SHA1,
+};
+
+enum {
+    BATCH_COPY,
+    BATCH_MOVE,
+    BATCH_DELETE,
+};
+
+typedef struct batch_job batch_job;
+
 // 0 = success, -1, fail
 
-int copy_file(const char* from, const char* to);
-void copy_dir(const char* dir, const char* dest);
+int copy_file(const char* from, const char* to, copy_stats *total);
+int copy_single(const char *from, const char *to);
+void copy_stats_print(const char *what, const copy_stats *stats);
+int copy_dir(const char* dir, const char* dest, copy_stats *total);
+int move_dir(const char* dir, const char* dest);
+int move_file(const char *from, const char *to);
+int same_volume(const char *a, const char *b);
 int delete_file(const char *file);
-void delete_dir(const char *dir);
+int delete_dir(const char *dir);
 const char *get_file_name(const char *file);
 int exist_file(const char *file);
+int check_free_space(const char *from, const char *to);
+int copy_ini(const char* key, const char* value);
+batch_job *batch_plan(int op, char **paths, int count, const char *dest);
+int batch_run(batch_job *job);
+void batch_free(batch_job *job);
+int archive_create(const char *dir, const char *archive);
+// ".aar.gz" when archives are compressed, see the compress option
+const char *archive_suffix(void);
+// member NULL restores everything, else that entry and what is below it
+int archive_restore(const char *archive, const char *dest, const char *member);
+// incremental backups into the object store on the SD card
+int store_backup(const char *dir);
+int store_restore(const char *manifest, const char *dest);
+// offers to finish a job interrupted by power loss or POWER, 1 if one ran
+int copy_resume(void);
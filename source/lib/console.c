@@ -12,6 +12,9 @@
 #include "gfx.h"
 #include "serial.h"
 #include "smc.h"
+#include "irq.h"
+#include "sched.h"
+#include <stdio.h>
 #include <string.h>
 
 char console[MAX_LINES][MAX_LINE_LENGTH];
@@ -24,11 +27,21 @@ int border_width = 3;
 int console_tv_x = CONSOLE_TV_X, console_tv_y = CONSOLE_TV_Y, console_tv_w = CONSOLE_TV_WIDTH, console_tv_h = CONSOLE_TV_HEIGHT;
 
 
+static void console_forget(gfx_screen_t screen);
+static void console_mirror();
+
+// the lines the serial terminal shows from its top, -1 when it's unknown
+static char mirror[MAX_LINES][MAX_LINE_LENGTH];
+static int mirror_lines = -1;
+static u32 mirror_sent, mirror_dropped;
+
 void console_init()
 {
     console_flush();
     gfx_clear(GFX_TV, BLACK);
     gfx_clear(GFX_DRC, BLACK);
+    console_forget(GFX_TV);
+    console_forget(GFX_DRC);
 }
 
 void console_set_xy(int x, int y)
@@ -59,62 +72,156 @@ int console_get_border_width(int width)
     return border_width;
 }
 
-void console_show()
+// The text is kept as cells, and every screen remembers the cells it shows.
+// console_show() only draws the cells that differ from that, the border
+// and the whole text area are drawn again only once the screen was cleared
+// or printed on behind the console's back, or the layout changed.
+typedef struct {
+    u32 fg;
+    u32 bg;
+    char glyph;
+} console_cell;
+
+static console_cell cells[MAX_LINES][MAX_LINE_LENGTH];
+
+static struct {
+    bool valid;
+    bool blank;     // cleared by console_init(), nothing drawn yet
+    u32 epoch;
+    int x, y, w, h, border, border_color;
+    console_cell cell[MAX_LINES][MAX_LINE_LENGTH];
+} shown[GFX_ALL];
+
+static void console_forget(gfx_screen_t screen)
 {
-    int i = 0, x = 0, y = 0;
-    for(y = console_y; y < console_h + console_y + border_width; y++)
+    shown[screen].valid = false;
+    shown[screen].blank = true;
+    shown[screen].epoch = gfx_get_epoch(screen);
+}
+
+static void console_draw_border(gfx_screen_t screen, int cx, int cy, int cw, int ch)
+{
+    int bw = border_width;
+
+    gfx_fill_rect(screen, cx, cy, cw + bw, bw + 1, border_color);
+    gfx_fill_rect(screen, cx, cy + ch - 1, cw + bw, bw + 1, border_color);
+    gfx_fill_rect(screen, cx, cy, bw + 1, ch + bw, border_color);
+    gfx_fill_rect(screen, cx + cw - 1, cy, bw + 1, ch + bw, border_color);
+}
+
+static void console_present(gfx_screen_t screen)
+{
+    bool tv = screen == GFX_TV;
+    int bx = tv ? console_tv_x : console_x, by = tv ? console_tv_y : console_y;
+    int bw = tv ? console_tv_w : console_w, bh = tv ? console_tv_h : console_h;
+
+    if (!shown[screen].valid || shown[screen].epoch != gfx_get_epoch(screen) ||
+        shown[screen].x != console_x || shown[screen].y != console_y ||
+        shown[screen].w != bw || shown[screen].h != bh ||
+        shown[screen].border != border_width || shown[screen].border_color != border_color)
     {
-        for(x = console_x; x < console_w + console_x + border_width; x++)
-        {
-            if((x >= console_x && x <= console_x + border_width) ||
-               (y >= console_y && y <= console_y + border_width) ||
-               (x >= console_w + console_x - 1 && x <= console_w + console_x - 1 + border_width) ||
-               (y >= console_h + console_y - 1 && y <= console_h + console_y - 1 + border_width)) {
-                gfx_draw_plot(GFX_DRC, x, y, border_color);
-            }
-            else {
-                //gfx_draw_plot(GFX_DRC, x, y, background_color);
-            }
-        }
+        if (!shown[screen].blank || shown[screen].epoch != gfx_get_epoch(screen))
+            gfx_clear(screen, BLACK);
+        console_draw_border(screen, bx, by, bw, bh);
+
+        // a cleared screen shows blanks everywhere
+        for (int i = 0; i < MAX_LINES; i++)
+            for (int j = 0; j < MAX_LINE_LENGTH; j++)
+                shown[screen].cell[i][j] = (console_cell){0, 0, ' '};
+
+        shown[screen].valid = true;
+        shown[screen].blank = false;
+        shown[screen].x = console_x;
+        shown[screen].y = console_y;
+        shown[screen].w = bw;
+        shown[screen].h = bh;
+        shown[screen].border = border_width;
+        shown[screen].border_color = border_color;
     }
 
-    for(y = console_tv_y; y < console_tv_h + console_tv_y + border_width; y++)
+    for (int i = 0; i < MAX_LINES; i++)
     {
-        for(x = console_tv_x; x < console_tv_w + console_tv_x + border_width; x++)
+        for (int j = 0; j < MAX_LINE_LENGTH; j++)
         {
-            if((x >= console_tv_x && x <= console_tv_x + border_width) ||
-               (y >= console_tv_y && y <= console_tv_y + border_width) ||
-               (x >= console_tv_w + console_tv_x - 1 && x <= console_tv_w + console_tv_x - 1 + border_width) ||
-               (y >= console_tv_h + console_tv_y - 1 && y <= console_tv_h + console_tv_y - 1 + border_width)) {
-                gfx_draw_plot(GFX_TV, x, y, border_color);
-            }
-            else {
-                //gfx_draw_plot(GFX_DRC, x, y, background_color);
-            }
+            const console_cell *c = &cells[i][j];
+            console_cell *old = &shown[screen].cell[i][j];
+
+            // blanks look the same whatever their colors
+            if (c->glyph == old->glyph && (c->glyph == ' ' || (c->fg == old->fg && c->bg == old->bg)))
+                continue;
+
+            gfx_draw_char(screen, c->glyph, console_x + CHAR_WIDTH * 1 + j * 8,
+                i * CHAR_WIDTH + console_y + CHAR_WIDTH * 2, c->fg);
+            *old = *c;
         }
     }
 
-    for(i = 0; i < lines; i++) {
-        for (int j = console_x; j < console_w-CHAR_WIDTH; j += CHAR_WIDTH) {
-            gfx_draw_string(GFX_DRC, " ", j + CHAR_WIDTH * 1, i * CHAR_WIDTH + console_y + CHAR_WIDTH * 2, background_color);
-            gfx_draw_string(GFX_TV, " ", j + CHAR_WIDTH * 1, i * CHAR_WIDTH + console_y + CHAR_WIDTH * 2, background_color);
-        }
-        gfx_draw_string(GFX_DRC, console[i], console_x + CHAR_WIDTH * 1, i * CHAR_WIDTH + console_y + CHAR_WIDTH * 2, text_color);
-        gfx_draw_string(GFX_TV, console[i], console_x + CHAR_WIDTH * 1, i * CHAR_WIDTH + console_y + CHAR_WIDTH * 2, text_color);
-        //if (gfx_is_currently_headless()) 
+    shown[screen].epoch = gfx_get_epoch(screen);
+}
+
+void console_show()
+{
+    int i = 0;
+
+    for(i = 0; i < MAX_LINES; i++)
+    {
+        bool end = i >= lines;
+        for (int j = 0; j < MAX_LINE_LENGTH; j++)
         {
-            serial_printf("%s\n", console[i]);
+            char c = end ? '\0' : console[i][j];
+            if (!c)
+                end = true;
+            cells[i][j] = (console_cell){text_color, background_color, (end || c < 32 || c >= 127) ? ' ' : c};
         }
     }
+
+    console_present(GFX_DRC);
+    console_present(GFX_TV);
+
+    console_mirror();
 }
 
-void console_flush()
+// Sends the console to the serial terminal, rewriting only the lines that
+// changed in place. Anything else sent since scrolled the terminal, then the
+// screen is cleared and sent whole.
+static void console_mirror()
 {
-    //if (gfx_is_currently_headless())
-    {
+    bool full = mirror_lines < 0 || serial_get_sent() != mirror_sent || serial_get_dropped() != mirror_dropped;
+    int count = lines > mirror_lines ? lines : mirror_lines;
+    bool moved = false;
+
+    if (full) {
         serial_clear();
+        mirror_lines = 0;
+        count = lines;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *text = i < lines ? console[i] : "";
+
+        if (i < mirror_lines && !strncmp(text, mirror[i], MAX_LINE_LENGTH))
+            continue;
+
+        if (full)
+            serial_printf("%s\n", text);
+        else
+            serial_printf("\033[%d;1H\033[2K%s", i + 1, text);
+        strncpy(mirror[i], text, MAX_LINE_LENGTH);
+        moved = !full;
     }
 
+    // the cursor ends up below the last line either way
+    if (moved)
+        serial_printf("\033[%d;1H", lines + 1);
+
+    mirror_lines = lines;
+    mirror_sent = serial_get_sent();
+    mirror_dropped = serial_get_dropped();
+}
+
+void console_flush()
+{
     lines = 0;
 }
 
@@ -170,7 +277,7 @@ void console_wait_power_or_q()
     console_select_flush();
     while (1)
     {
-        int input = console_select_poll();
+        int input = console_select_wait();
         if ((input & CONSOLE_KEY_POWER) || (input & CONSOLE_KEY_Q)) return;
     }
 }
@@ -180,7 +287,7 @@ void console_wait_power_q_eject_or_p()
     console_select_flush();
     while (1)
     {
-        int input = console_select_poll();
+        int input = console_select_wait();
         if ((input & CONSOLE_KEY_POWER) || (input & CONSOLE_KEY_Q)) return;
         if ((input & CONSOLE_KEY_EJECT) || (input & CONSOLE_KEY_P)) return;
     }
@@ -207,6 +314,61 @@ void console_power_to_continue()
     console_wait_power_or_q();
 }
 
+// pages through what printf() printed so far, newest page first
+void console_scrollback()
+{
+    const int page = MAX_LINES - 4;
+    char line[MAX_LINE_LENGTH];
+    int count = gfx_scrollback_count();
+    int top = count > page ? count - page : 0;
+    int redraw = 1;
+
+    console_init();
+    console_select_flush();
+
+    while (1)
+    {
+        if (redraw)
+        {
+            console_flush();
+            int n = snprintf(line, sizeof(line), "Log (%d-%d of %d lines)", count ? top + 1 : 0, top + page < count ? top + page : count, count);
+            if (serial_get_dropped())
+                snprintf(line + n, sizeof(line) - n, ", %lu bytes lost on serial", serial_get_dropped());
+            console_add_text(line);
+            console_add_text("");
+
+            for (int i = top; i < top + page; i++)
+            {
+                // longer lines would wrap into the next row
+                strncpy(line, gfx_scrollback_line(i), sizeof(line) - 1);
+                line[sizeof(line) - 1] = '\0';
+                console_add_text(line);
+            }
+
+            console_add_text("");
+            console_add_text("[W/S] Line | [A/D] Page | [POWER/Q/EJECT/P] Return");
+            console_show();
+            redraw = 0;
+        }
+
+        int input = console_select_wait();
+        int last = count > page ? count - page : 0;
+        int prev = top;
+
+        if ((input & CONSOLE_KEY_POWER) || (input & CONSOLE_KEY_Q)) return;
+        if ((input & CONSOLE_KEY_EJECT) || (input & CONSOLE_KEY_P)) return;
+
+        if (input & (CONSOLE_KEY_UP | CONSOLE_KEY_W)) top--;
+        if (input & (CONSOLE_KEY_DOWN | CONSOLE_KEY_S)) top++;
+        if (input & (CONSOLE_KEY_LEFT | CONSOLE_KEY_A)) top -= page;
+        if (input & (CONSOLE_KEY_RIGHT | CONSOLE_KEY_D)) top += page;
+
+        if (top > last) top = last;
+        if (top < 0) top = 0;
+        redraw = top != prev;
+    }
+}
+
 int console_abort_confirmation(const char* text_power, const char* text_eject)
 {
     printf("[POWER/Q] %s | [EJECT/P] %s...\n", text_power, text_eject);
@@ -215,7 +377,7 @@ int console_abort_confirmation(const char* text_power, const char* text_eject)
 
     while (1)
     {
-        int input = console_select_poll();
+        int input = console_select_wait();
         if ((input & CONSOLE_KEY_POWER) || (input & CONSOLE_KEY_Q)) return 1;
         if ((input & CONSOLE_KEY_EJECT) || (input & CONSOLE_KEY_P)) return 0;
     }
@@ -254,7 +416,7 @@ int console_konami_code()
 
     while (true)
     {
-        int key = console_select_poll();
+        int key = console_select_wait();
         if (!key) continue;
 
         if ((key & CONSOLE_KEY_POWER) || (key & CONSOLE_KEY_Q)) return 1;
@@ -308,7 +470,19 @@ void console_select_flush()
     parsing_escape_code = 0;
     parsing_csi = 0;
 
-    smc_get_events();
+    smc_flush_events();
+}
+
+// console_select_poll() that gives the background jobs a slice, or sleeps
+// until the next interrupt, when nothing was pressed. For loops that only
+// wait for input.
+int console_select_wait()
+{
+    int input = console_select_poll();
+    if (!input && (job_current() || !sched_run()) && smc_is_sampling())
+        irq_wait();
+
+    return input;
 }
 
 int console_select_poll()
@@ -65,10 +65,13 @@ int console_konami_code();
 void console_power_or_eject_to_return();
 void console_power_to_exit();
 void console_power_to_continue();
+void console_scrollback();
+int console_abort_confirmation(const char* text_power, const char* text_eject);
 int console_abort_confirmation_power_no_eject_yes();
 int console_abort_confirmation_power_exit_eject_continue();
 int console_abort_confirmation_power_skip_eject_dump();
 void console_select_flush();
 int console_select_poll();
+int console_select_wait();
 
 #endif
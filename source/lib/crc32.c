@@ -92,14 +92,19 @@ static const uint32_t crc32_tab[] = {
 
 
 uint32_t
-crc32(const void *buf, size_t size)
+crc32_update(uint32_t crc, const void *buf, size_t size)
 {
 	const uint8_t *p = buf;
-	uint32_t crc;
 
-	crc = ~0U;
+	crc = ~crc;
 	while (size--) {
 		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-    }
-	return crc ^ ~0U;
+	}
+	return ~crc;
+}
+
+uint32_t
+crc32(const void *buf, size_t size)
+{
+	return crc32_update(0, buf, size);
 }
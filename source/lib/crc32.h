@@ -46,5 +46,7 @@
 #define __CRC32_H
 
 uint32_t crc32(const void *buf, size_t size);
+// continues a running crc32, start from 0
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size);
 
 #endif // __CRC32_H
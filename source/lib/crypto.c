@@ -21,6 +21,7 @@
 #include "seeprom.h"
 #include "crc32.h"
 #include "serial.h"
+#include "log.h"
 
 #define     AES_CMD_RESET   0
 #define     AES_CMD_DECRYPT 0x9800
@@ -300,6 +301,9 @@ void aes_set_key(u8 *key)
 
 void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 {
+    u32 start = trace_clock();
+    u32 total = blocks;
+
     // Kinda have to do both flush/invalidate on both because if you crypt
     // 1 block, an invalidate will corrupt the periphery memory in the cache
     // line.
@@ -328,12 +332,16 @@ void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 
     ahb_flush_from(WB_AES);
     ahb_flush_to(RB_IOD);
+    TRACE(TRACE_AES_DECRYPT, 0, total, 0, start);
     //dc_flushrange(dst, blocks * 16);
     //dc_invalidaterange(dst, blocks * 16);
 }
 
 void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 {
+    u32 start = trace_clock();
+    u32 total = blocks;
+
     // Kinda have to do both flush/invalidate on both because if you crypt
     // 1 block, an invalidate will corrupt the periphery memory in the cache
     // line.
@@ -362,6 +370,7 @@ void aes_encrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 
     ahb_flush_from(WB_AES);
     ahb_flush_to(RB_IOD);
+    TRACE(TRACE_AES_ENCRYPT, 0, total, 0, start);
     //dc_flushrange(dst, blocks * 16);
     //dc_invalidaterange(dst, blocks * 16);
 }
@@ -0,0 +1,229 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "deflate.h"
+#include "crc32.h"
+#include "defl_static.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The matcher keeps its tables inside the 16 KiB data cache of the ARM926:
+// 4 KiB of hash heads and 8 KiB of chain links over a 4 KiB window. Longer
+// windows find little more in NAND dumps, whose redundancy is mostly whole
+// erased or zeroed pages, and those never reach the matcher.
+#define DEFLATE_HASH_BITS   10
+#define DEFLATE_WINDOW      4096
+#define DEFLATE_MAX_CHAIN   8
+#define DEFLATE_MIN_MATCH   3
+#define DEFLATE_MAX_MATCH   258
+// a NAND page, checked whole for 0xFF or zero fill
+#define DEFLATE_PAGE        2048
+
+struct deflate_stream {
+    struct Outbuf out;
+    bool taken;         // the caller has the bytes in out, start over
+    u32 crc;
+    u32 size;           // mod 2^32, as gzip stores it
+    int last;           // the byte before the slab, -1 before the first one
+    u32 head[1 << DEFLATE_HASH_BITS];   // slab position + 1
+    u16 prev[DEFLATE_WINDOW];           // back to the previous position with the hash
+};
+
+static inline u32 _deflate_hash(const u8 *p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static void _deflate_insert(deflate_stream *z, const u8 *data, u32 pos)
+{
+    u32 h = _deflate_hash(data + pos);
+    u32 old = z->head[h];
+
+    z->prev[pos % DEFLATE_WINDOW] = (old && pos - (old - 1) <= DEFLATE_WINDOW) ? pos - (old - 1) : 0;
+    z->head[h] = pos + 1;
+}
+
+// the fill byte of an erased or zeroed page, -1 for anything else
+static int _deflate_fill(const u8 *page)
+{
+    const u32 *w = (const u32*)page;
+    u32 v = w[0];
+
+    if (v != 0 && v != 0xFFFFFFFF)
+        return -1;
+    for (int i = 1; i < DEFLATE_PAGE / sizeof(u32); i++)
+        if (w[i] != v)
+            return -1;
+    return v & 0xFF;
+}
+
+// a run is one literal and matches at distance 1, a dozen bytes per page
+static void _deflate_run(deflate_stream *z, int fill, u32 len)
+{
+    if (z->last != fill)
+    {
+        zlib_literal(&z->out, fill);
+        len--;
+    }
+    if (len >= DEFLATE_MIN_MATCH)
+        zlib_match(&z->out, 1, len);
+    else
+        while (len--)
+            zlib_literal(&z->out, fill);
+    z->last = fill;
+}
+
+static void _deflate_take(deflate_stream *z, const u8 **out, size_t *out_len)
+{
+    *out = z->out.outbuf;
+    *out_len = z->out.outlen;
+    z->taken = true;
+}
+
+static void _deflate_reset(deflate_stream *z)
+{
+    if (z->taken)
+        z->out.outlen = 0;
+    z->taken = false;
+}
+
+deflate_stream *deflate_begin(size_t slab)
+{
+    static const u8 gzip_hdr[] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    deflate_stream *z = calloc(1, sizeof(deflate_stream));
+    if (!z)
+        return NULL;
+
+    // literals above 143 take 9 bits, more than that never comes out
+    z->out.outsize = slab + slab / 8 + 64;
+    z->out.outbuf = malloc(z->out.outsize);
+    if (!z->out.outbuf)
+    {
+        free(z);
+        return NULL;
+    }
+
+    z->last = -1;
+    for (int i = 0; i < sizeof(gzip_hdr); i++)
+        outbits(&z->out, gzip_hdr[i], 8);
+    return z;
+}
+
+int deflate_slab(deflate_stream *z, const void *data, size_t len, const u8 **out, size_t *out_len)
+{
+    const u8 *p = data;
+    u32 pos = 0;
+
+    _deflate_reset(z);
+    z->crc = crc32_update(z->crc, data, len);
+    z->size += len;
+
+    // one static huffman block per slab, the chains start over with it
+    outbits(&z->out, 0, 1);
+    outbits(&z->out, 1, 2);
+    memset(z->head, 0, sizeof(z->head));
+
+    while (pos < len)
+    {
+        if (!(pos % DEFLATE_PAGE) && len - pos >= DEFLATE_PAGE)
+        {
+            int fill = _deflate_fill(p + pos);
+            if (fill >= 0)
+            {
+                _deflate_run(z, fill, DEFLATE_PAGE);
+                pos += DEFLATE_PAGE;
+                continue;
+            }
+        }
+
+        u32 best = 0, dist = 0;
+        if (len - pos >= DEFLATE_MIN_MATCH)
+        {
+            u32 max = len - pos > DEFLATE_MAX_MATCH ? DEFLATE_MAX_MATCH : len - pos;
+            u32 cand = z->head[_deflate_hash(p + pos)];
+
+            for (int chain = DEFLATE_MAX_CHAIN; cand && chain; chain--)
+            {
+                u32 c = cand - 1;
+                if (pos - c > DEFLATE_WINDOW)
+                    break;
+
+                // a longer match has to differ from the best one at its end
+                if (p[c + best] == p[pos + best])
+                {
+                    u32 n = 0;
+                    while (n < max && p[c + n] == p[pos + n])
+                        n++;
+                    if (n > best)
+                    {
+                        best = n;
+                        dist = pos - c;
+                        if (n == max)
+                            break;
+                    }
+                }
+
+                u16 back = z->prev[c % DEFLATE_WINDOW];
+                if (!back)
+                    break;
+                cand = c - back + 1;
+            }
+            _deflate_insert(z, p, pos);
+        }
+
+        if (best >= DEFLATE_MIN_MATCH)
+        {
+            zlib_match(&z->out, dist, best);
+            for (u32 i = 1; i < best && pos + i + DEFLATE_MIN_MATCH <= len; i++)
+                _deflate_insert(z, p, pos + i);
+            pos += best;
+        }
+        else
+        {
+            zlib_literal(&z->out, p[pos]);
+            pos++;
+        }
+        z->last = p[pos - 1];
+    }
+
+    // end of block
+    outbits(&z->out, 0, 7);
+    _deflate_take(z, out, out_len);
+    return 0;
+}
+
+int deflate_end(deflate_stream *z, const u8 **out, size_t *out_len)
+{
+    _deflate_reset(z);
+
+    // an empty final block, then the gzip trailer on a byte boundary
+    outbits(&z->out, 1, 1);
+    outbits(&z->out, 1, 2);
+    outbits(&z->out, 0, 7);
+    if (z->out.noutbits)
+        outbits(&z->out, 0, 8 - z->out.noutbits);
+
+    for (int i = 0; i < 4; i++)
+        outbits(&z->out, (z->crc >> (i * 8)) & 0xFF, 8);
+    for (int i = 0; i < 4; i++)
+        outbits(&z->out, (z->size >> (i * 8)) & 0xFF, 8);
+
+    _deflate_take(z, out, out_len);
+    return 0;
+}
+
+void deflate_free(deflate_stream *z)
+{
+    if (!z)
+        return;
+
+    free(z->out.outbuf);
+    free(z);
+}
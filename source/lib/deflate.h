@@ -0,0 +1,25 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _DEFLATE_H
+#define _DEFLATE_H
+
+#include "types.h"
+
+// a gzip stream built slab by slab on the uzlib static huffman encoder
+typedef struct deflate_stream deflate_stream;
+
+// slab is the largest amount of data passed to one deflate_slab() call
+deflate_stream *deflate_begin(size_t slab);
+// the compressed bytes stay valid until the next call on the stream
+int deflate_slab(deflate_stream *z, const void *data, size_t len, const u8 **out, size_t *out_len);
+int deflate_end(deflate_stream *z, const u8 **out, size_t *out_len);
+void deflate_free(deflate_stream *z);
+
+#endif
@@ -16,9 +16,52 @@
 #include "sdcard.h"
 #include "sdhc.h"
 #include "utils.h"
+#include "memory.h"
 
 static u8 buffer[SDMMC_DEFAULT_BLOCKLEN * SDHC_BLOCK_COUNT_MAX] ALIGNED(32);
 
+/* Writes from this window may still be running on the card when disk_write()
+   returns. FatFs' own sector buffers are never in it, they change right after
+   they were written. */
+static const BYTE *behind_buf;
+static UINT behind_len;
+
+#if _USE_TRIM
+/* FatFs trims one contiguous run of a cluster chain at a time. Neighbouring
+   runs are merged here and erased with a single command on the next sync. */
+static DWORD trim_start, trim_end;
+static bool trim_pending = false;
+
+static DRESULT disk_trim_flush(void)
+{
+    if (!trim_pending)
+        return RES_OK;
+
+    trim_pending = false;
+    return sdcard_erase(trim_start, trim_end) ? RES_ERROR : RES_OK;
+}
+
+static DRESULT disk_trim(const DWORD *range)
+{
+    DRESULT res = RES_OK;
+
+    if (trim_pending && range[0] == trim_end + 1) {
+        trim_end = range[1];
+        return RES_OK;
+    }
+    if (trim_pending && range[1] + 1 == trim_start) {
+        trim_start = range[0];
+        return RES_OK;
+    }
+
+    res = disk_trim_flush();
+    trim_start = range[0];
+    trim_end = range[1];
+    trim_pending = true;
+    return res;
+}
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Get Disk Status                                                       */
 /*-----------------------------------------------------------------------*/
@@ -71,6 +114,10 @@ DRESULT disk_read (
 {
     (void)pdrv;
 
+    // DMA straight into the caller's buffer when it can take it
+    if(can_sdcard_dma_addr(buff))
+        return sdcard_read(sector, count, buff) ? RES_ERROR : RES_OK;
+
     while(count) {
         u32 work = min(count, SDHC_BLOCK_COUNT_MAX);
 
@@ -103,6 +150,18 @@ DRESULT disk_write (
 {
     (void)pdrv;
 
+#if _USE_TRIM
+    // reallocated clusters must not be erased after they were written
+    if(trim_pending && sector <= trim_end && sector + count - 1 >= trim_start)
+        disk_trim_flush();
+#endif
+
+    if(can_sdcard_dma_addr((void*)buff)) {
+        if(buff >= behind_buf && buff + count * SDMMC_DEFAULT_BLOCKLEN <= behind_buf + behind_len)
+            return sdcard_write_behind(sector, count, (void*)buff) ? RES_ERROR : RES_OK;
+        return sdcard_write(sector, count, (void*)buff) ? RES_ERROR : RES_OK;
+    }
+
     while(count) {
         u32 work = min(count, SDHC_BLOCK_COUNT_MAX);
 
@@ -134,8 +193,19 @@ DRESULT disk_ioctl (
 {
     (void)pdrv;
 
-    if (cmd == CTRL_SYNC)
+    if (cmd == CTRL_SYNC) {
+        if (sdcard_sync())
+            return RES_ERROR;
+#if _USE_TRIM
+        disk_trim_flush();
+#endif
         return RES_OK;
+    }
+
+#if _USE_TRIM
+    if (cmd == CTRL_TRIM)
+        return disk_trim((const DWORD*)buff);
+#endif
 
     if (cmd == GET_SECTOR_SIZE) {
         *(u32*)buff = SDMMC_DEFAULT_BLOCKLEN;
@@ -158,6 +228,31 @@ DRESULT disk_ioctl (
 }
 #endif
 
+/*-----------------------------------------------------------------------*/
+/* Let writes from [buff, buff + len) finish in the background           */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_write_behind (
+    const void *buff,   /* Buffer the caller leaves alone until the next call */
+    UINT len            /* Its length in bytes, 0 to stop */
+)
+{
+    behind_buf = buff;
+    behind_len = len;
+    return sdcard_sync() ? RES_ERROR : RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Forget the pending trim, the card it was meant for is gone            */
+/*-----------------------------------------------------------------------*/
+
+void disk_trim_drop (void)
+{
+#if _USE_TRIM
+    trim_pending = false;
+#endif
+}
+
 DWORD get_fattime()
 {
     // NO
@@ -25,12 +25,14 @@
 #include <sys/unistd.h>
 #include <sys/types.h>
 #include <sys/syslimits.h>
+#include <sys/statvfs.h>
 
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <wchar.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <stdbool.h>
 #include <wctype.h>
 
@@ -39,11 +41,16 @@
 bool elm_initialized = false;
 bool elm_mounted = false;
 FRESULT elm_error = 0;
+// bumped by everything that can add, remove or rename a directory entry
+static uint32_t elm_generation = 0;
 
 static FATFS fatfs = {0};
 static devoptab_t devoptab = {0};
 static const char* mount = "sdmc";
 
+// FAT bytes streamed per disk_read while counting free clusters
+#define ELM_FAT_SCAN_SIZE (128 * 1024)
+
 int _ELM_open_r(struct _reent *r, void *fileStruct, const char *path, int flags, int mode);
 int _ELM_close_r(struct _reent *r, void* fd);
 ssize_t _ELM_write_r(struct _reent *r, void* fd, const char *ptr, size_t len);
@@ -94,6 +101,7 @@ void _ELM_init()
 
     dotab->link_r = _ELM_link_r;
     dotab->unlink_r = _ELM_unlink_r;
+    dotab->rmdir_r = _ELM_unlink_r; // f_unlink removes empty directories
     dotab->rename_r = _ELM_rename_r;
 
     dotab->chdir_r = _ELM_chdir_r;
@@ -299,6 +307,8 @@ int _ELM_open_r(struct _reent* r, void* fileStruct, const char* path, int flags,
         m |= FA_OPEN_EXISTING;
     }
 
+    if (m & (FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS))
+        elm_generation++;
     elm_error = f_open(fp, p, m);
 
 #if (_FS_MINIMIZE < 1) && (!_FS_READONLY)
@@ -402,6 +412,7 @@ static void _ELM_fileinfo_to_stat(const TCHAR* path, const FILINFO* fi, struct s
     st->st_gid = 2;
     st->st_rdev = st->st_dev;
     st->st_size = fi->fsize;
+    st->st_blksize = fatfs.csize * ELM_SS(&fatfs);
     st->st_mtime = _ELM_filetime_to_time(fi->ftime, fi->fdate);
     //st->st_spare1 = fi->fattrib;
 }
@@ -491,6 +502,7 @@ int _ELM_unlink_r(struct _reent *r, const char *path)
 {
 #if (_FS_MINIMIZE < 1) && (!_FS_READONLY)
     const TCHAR* p = _ELM_mbstoucs2(_ELM_realpath(path), NULL);
+    elm_generation++;
     elm_error = f_unlink(p);
     return _ELM_errnoparse(r, 0, -1);
 #else
@@ -529,6 +541,7 @@ int _ELM_rename_r(struct _reent* r, const char* path, const char* pathp)
         }
     }
 
+    elm_generation++;
     elm_error = f_rename(p, pp);
     return _ELM_errnoparse(r, 0, -1);
 #else
@@ -541,6 +554,7 @@ int _ELM_mkdir_r(struct _reent *r, const char *path, int mode)
 {
 #if (_FS_MINIMIZE < 1) && (!_FS_READONLY)
     const TCHAR* p = _ELM_mbstoucs2(_ELM_realpath(path), NULL);
+    elm_generation++;
     elm_error = f_mkdir(p);
     return _ELM_errnoparse(r, 0, -1);
 #else
@@ -650,10 +664,94 @@ int _ELM_dirclose_r(struct _reent* r, DIR_ITER* dirState)
     return _ELM_dirreset_r(r, dirState);
 }
 
+// Counts free clusters once per mount by streaming the FAT in large reads,
+// instead of f_getfree's one-sector-at-a-time window walk. The count ends up in
+// fs->free_clust, which create_chain/remove_chain keep current afterwards.
+static FRESULT _ELM_scan_free_clusters(FATFS* fs)
+{
+    DWORD entries, sect, nfree = 0;
+    UINT per_sect;
+    BYTE* buf;
+
+    if (fs->free_clust <= fs->n_fatent - 2)
+        return FR_OK;
+
+    // FAT12 entries straddle sectors, and a dirty window isn't on disk yet.
+    buf = (fs->fs_type == FS_FAT12 || fs->wflag) ? NULL : memalign(32, ELM_FAT_SCAN_SIZE);
+    if (!buf)
+    {
+        TCHAR path[3] = { L'0' + fs->drv, L':', 0 };
+        DWORD nclst;
+        return f_getfree(path, &nclst, &fs);
+    }
+
+    entries = fs->n_fatent;
+    sect = fs->fatbase;
+    per_sect = ELM_SS(fs) / (fs->fs_type == FS_FAT16 ? 2 : 4);
+
+    while (entries)
+    {
+        UINT count = (entries + per_sect - 1) / per_sect;
+        if (count > ELM_FAT_SCAN_SIZE / ELM_SS(fs))
+            count = ELM_FAT_SCAN_SIZE / ELM_SS(fs);
+
+        if (disk_read(fs->drv, buf, sect, count) != RES_OK)
+        {
+            free(buf);
+            return FR_DISK_ERR;
+        }
+        sect += count;
+
+        UINT n = count * per_sect;
+        if (n > entries)
+            n = entries;
+        entries -= n;
+
+        if (fs->fs_type == FS_FAT16)
+        {
+            const u16* p = (const u16*)buf;
+            while (n--)
+                if (!*p++) nfree++;
+        }
+        else
+        {
+            // little-endian entries: the reserved top nibble lives in the last byte
+            const u32* p = (const u32*)buf;
+            while (n--)
+                if (!(*p++ & 0xFFFFFF0F)) nfree++;
+        }
+    }
+
+    free(buf);
+
+    fs->free_clust = nfree;
+    fs->fsi_flag |= 1;
+    return FR_OK;
+}
+
 int _ELM_statvfs_r(struct _reent* r, const char* path, struct statvfs* buf)
 {
-    r->_errno = ENOSYS;
-    return -1;
+    if (!_ELM_chk_mounted(0))
+    {
+        r->_errno = ENODEV;
+        return -1;
+    }
+
+    elm_error = _ELM_scan_free_clusters(&fatfs);
+    if (elm_error != FR_OK)
+        return _ELM_errnoparse(r, 0, -1);
+
+    memset(buf, 0, sizeof(*buf));
+    buf->f_bsize = fatfs.csize * ELM_SS(&fatfs);
+    buf->f_frsize = buf->f_bsize;
+    buf->f_blocks = fatfs.n_fatent - 2;
+    buf->f_bfree = fatfs.free_clust;
+    buf->f_bavail = fatfs.free_clust;
+    buf->f_fsid = (unsigned long) &fatfs;
+    buf->f_flag = ST_NOSUID | (_FS_READONLY ? ST_RDONLY : 0);
+    buf->f_namemax = _MAX_LFN;
+
+    return 0;
 }
 
 int _ELM_ftruncate_r(struct _reent* r, void* fd, off_t len)
@@ -694,6 +792,16 @@ int _ELM_fsync_r(struct _reent* r, void* fd)
 #endif
 }
 
+uint32_t ELM_Generation(void)
+{
+    return elm_generation;
+}
+
+int ELM_WriteBehind(const void* buf, size_t len)
+{
+    return disk_write_behind(buf, len) == RES_OK ? 0 : -1;
+}
+
 int ELM_Mount(void)
 {
     _ELM_init();
@@ -729,8 +837,13 @@ void ELM_Unmount(void)
     strcpy(buffer, mount);
     strcat(buffer, ":");
     RemoveDevice(buffer);
+    // the merged trim is only sent on a sync
+    if (elm_mounted)
+        disk_ioctl(fatfs.drv, CTRL_SYNC, NULL);
     f_mount(NULL, buffer, 1);
 
+    // another card may be in the slot next time
+    elm_generation++;
     elm_mounted = false;
 }
 
@@ -738,7 +851,7 @@ int ELM_ClusterSizeFromDisk(int disk, uint32_t* size)
 {
     if (_ELM_chk_mounted(disk))
     {
-        *size = fatfs.csize * ELM_SS(fatfs);
+        *size = fatfs.csize * ELM_SS(&fatfs);
         return true;
     }
 
@@ -758,19 +871,11 @@ int ELM_ClustersFromDisk(int disk, uint32_t* clusters)
 
 int ELM_FreeClustersFromDisk(int disk, uint32_t* clusters)
 {
-    if (ELM_VALID_DISK(disk))
+    if (_ELM_chk_mounted(disk))
     {
-        FATFS *fs;
-        DWORD free_clusters = 0;
-        TCHAR path[3];
-
-        path[0] = L'0' + disk;
-        path[1] = L':';
-        path[2] = 0;
-
-        if (f_getfree(path, &free_clusters, &fs) == FR_OK)
+        if (_ELM_scan_free_clusters(&fatfs) == FR_OK)
         {
-            *clusters = free_clusters;
+            *clusters = fatfs.free_clust;
             return true;
         }
     }
@@ -59,6 +59,11 @@ int ELM_SectorsFromDisk(int disk, uint32_t* sectors);
 uint32_t ELM_GetFAT(int fildes, uint32_t cluster, uint32_t* sector);
 int ELM_DirEntry(int fildes, uint64_t* entry);
 uint32_t ELM_GetSectorCount(unsigned char drive);
+// changes whenever a directory on the card may have changed
+uint32_t ELM_Generation(void);
+// writes from [buf, buf + len) may still be running on the card after write()
+// returns; each call waits for the one running, (NULL, 0) turns it off
+int ELM_WriteBehind(const void* buf, size_t len);
 
 int dirnext(DIR_ITER *dirState, char *filename, struct stat *filestat);
 
@@ -14,20 +14,30 @@
 #include "smc.h"
 #include "gfx.h"
 #include "ff.h"
+#include "elm.h"
+#include "isfs.h"
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define PICK_DONE "[Done]"
+#define PICK_LINES (MAX_LINES - 6)
+// entries read between two input polls, a first page is shown right away
+#define PICK_PAGE PICK_LINES
+// complete listings kept after their level is left
+#define PICK_CACHE 8
 
 char *_filename;
-char _directory[_MAX_LFN + 1];
 
 picker* __picker;
-picker *picker_chain[100];
 
-int opened_pickers = 0;
+// non-NULL while pick_files() runs
+pick_selection* _selection = NULL;
 
-void picker_init(picker* new_picker);
+void picker_run(picker* root);
 void picker_print_filenames();
 void picker_update();
 void picker_next_selection();
@@ -70,129 +80,415 @@ char *pick_strcpy(char *dest, char *src)
     return dest;
 }
 
-char* pick_file(char* path, bool folderpick, char* filename_buf)
+static int picker_directories(const picker* p)
 {
-    _filename = filename_buf;
+    return p->directory.count;
+}
 
-    picker _picker = {{0}};
-    pick_strcpy(_picker.path, path);
-    _picker.folderpick = folderpick;
+static int picker_entries(const picker* p)
+{
+    return p->directory.count + p->file.count;
+}
 
-    DIR* dir;
-    struct dirent* info;
+// index counts the directories first, then the files
+static const char* picker_name(const picker* p, int index)
+{
+    const picker_entry* e = index < p->directory.count ?
+        &p->directory.entry[index] : &p->file.entry[index - p->directory.count];
+    return p->pool + e->offset;
+}
 
-    dir = opendir(path);
+// inserts name in order below the fixed entries, returns the index it got
+// or -1 when out of memory
+static int picker_add(picker* p, picker_list* list, const char* name)
+{
+    size_t len = strlen(name);
 
-    if (dir == NULL) {
-        return NULL;
+    if (p->pool_len + len + 1 > p->pool_alloc)
+    {
+        u32 alloc = p->pool_alloc ? p->pool_alloc : 1024;
+        while (p->pool_len + len + 1 > alloc)
+            alloc *= 2;
+        char* pool = realloc(p->pool, alloc);
+        if (!pool) return -1;
+        p->pool = pool;
+        p->pool_alloc = alloc;
     }
 
-    pick_strcpy(_picker.directory[0], "..");
-    _picker.directories = 1;
+    if (list->count == list->alloc)
+    {
+        int alloc = list->alloc ? list->alloc * 2 : 64;
+        picker_entry* entry = realloc(list->entry, alloc * sizeof(picker_entry));
+        if (!entry) return -1;
+        list->entry = entry;
+        list->alloc = alloc;
+    }
 
-    if (folderpick)
+    // after the last entry that does not sort above the new one
+    int lo = list == &p->directory ? p->fixed : 0, hi = list->count;
+    while (lo < hi)
     {
-        pick_strcpy(_picker.directory[1], ".");
-        _picker.directories++;
+        int mid = (lo + hi) / 2;
+        if (strcasecmp(p->pool + list->entry[mid].offset, name) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    /*
-     * TODO: More than 256 files/directories, if needed.
-     * Currently any more than that sucks up quite a bit
-     * of RAM and isn't strictly needed.
-     *
-     * At the moment though it at least caps it so it
-     * doesn't crash.
-     */
-    while(true)
+    memmove(&list->entry[lo + 1], &list->entry[lo], (list->count - lo) * sizeof(picker_entry));
+    list->entry[lo] = (picker_entry){p->pool_len, len};
+    list->count++;
+    memcpy(p->pool + p->pool_len, name, len + 1);
+    p->pool_len += len + 1;
+
+    return list == &p->directory ? lo : p->directory.count + lo;
+}
+
+// keeps the selection on the same name and the view still when an entry
+// lands above them
+static void picker_inserted(picker* p, int index)
+{
+    if (index <= p->selected)
+        p->selected++;
+
+    if (index < p->show_y)
+        p->show_y++;
+    else if (index < p->show_y + PICK_LINES)
+        p->update_needed = true;
+
+    if (p->selected >= p->show_y + PICK_LINES)
     {
-        info = readdir(dir);
+        p->show_y = p->selected - PICK_LINES + 1;
+        p->update_needed = true;
+    }
+}
 
-        if (info == NULL || info->d_name[0] == 0) break;
-        if (info->d_name[0] == '.' && info->d_name[1] == '\0') continue;
-        if (info->d_name[0] == '.' && info->d_name[1] == '.' && info->d_name[2] == '\0') continue;
+static void picker_load(picker* p, int budget)
+{
+    struct dirent* info;
+
+    while (p->dir && budget--)
+    {
+        int index = 0;
+        info = readdir(p->dir);
 
-        if ((info->d_type == DT_DIR) && _picker.directories < 255) // directory
+        if (info == NULL || info->d_name[0] == 0)
+        {
+            index = -1;
+        }
+        else if (info->d_name[0] == '.' && info->d_name[1] == '\0')
         {
-            pick_strcpy(_picker.directory[_picker.directories], info->d_name);
-            _picker.directories++;
+            continue;
+        }
+        else if (info->d_name[0] == '.' && info->d_name[1] == '.' && info->d_name[2] == '\0')
+        {
+            continue;
+        }
+        else if (info->d_type == DT_DIR) // directory
+        {
+            index = picker_add(p, &p->directory, info->d_name);
+        }
+        else if (!p->folderpick) // file
+        {
+            index = picker_add(p, &p->file, info->d_name);
+        }
+        else
+        {
+            continue;
+        }
 
+        // the end of the directory, or out of memory with what was read so far listed
+        if (index < 0)
+        {
+            closedir(p->dir);
+            p->dir = NULL;
+            p->update_needed = true;
+            break;
         }
-        else if(_picker.files < 255 && !folderpick) // file
+
+        picker_inserted(p, index);
+    }
+}
+
+static void picker_free(picker* p)
+{
+    if (p->dir)
+        closedir(p->dir);
+    free(p->pool);
+    free(p->directory.entry);
+    free(p->file.entry);
+    free(p);
+}
+
+// Left levels keep their listing in a small LRU cache, most recent first.
+// A listing is only valid for the volume generation it was read at: the ISFS
+// superblock generation or the card's count of directory changes, so any
+// write since then reads the directory again.
+static picker* picker_cache[PICK_CACHE];
+
+static bool picker_generation(const char* path, u32* generation)
+{
+    if (isfs_get_generation(path, generation) == 0)
+        return true;
+
+    if (!strncmp(path, "sdmc:", 5))
+    {
+        *generation = ELM_Generation();
+        return true;
+    }
+    return false;
+}
+
+static void picker_release(picker* p)
+{
+    u32 generation;
+
+    if (p->dir || !picker_generation(p->path, &generation) || generation != p->generation)
+    {
+        picker_free(p);
+        return;
+    }
+
+    if (picker_cache[PICK_CACHE - 1])
+        picker_free(picker_cache[PICK_CACHE - 1]);
+    memmove(&picker_cache[1], &picker_cache[0], (PICK_CACHE - 1) * sizeof(picker*));
+    picker_cache[0] = p;
+}
+
+static picker* picker_cached(const char* path, bool folderpick, picker* parent)
+{
+    u32 generation;
+    bool valid = picker_generation(path, &generation);
+
+    for (int i = 0; i < PICK_CACHE && picker_cache[i]; i++)
+    {
+        picker* p = picker_cache[i];
+        if (strcmp(p->path, path) || p->folderpick != folderpick || p->marking != (_selection != NULL))
+            continue;
+
+        memmove(&picker_cache[i], &picker_cache[i + 1], (PICK_CACHE - i - 1) * sizeof(picker*));
+        picker_cache[PICK_CACHE - 1] = NULL;
+
+        if (!valid || p->generation != generation)
         {
-            pick_strcpy(_picker.file[_picker.files], info->d_name);
-            _picker.files++;
+            picker_free(p);
+            return NULL;
         }
+
+        p->parent = parent;
+        p->selected = 0;
+        p->show_y = 0;
+        p->update_needed = true;
+        return p;
     }
+    return NULL;
+}
+
+static picker* picker_open(const char* path, bool folderpick, picker* parent)
+{
+    DIR* dir;
+    picker* p = picker_cached(path, folderpick, parent);
 
-    closedir(dir);
+    if (p)
+        return p;
+
+    dir = opendir(path);
+
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(picker));
+    if (!p)
+    {
+        closedir(dir);
+        return NULL;
+    }
 
-    picker_init(&_picker);
+    pick_snprintf(p->path, sizeof(p->path), "%s", path);
+    p->folderpick = folderpick;
+    p->marking = _selection != NULL;
+    p->parent = parent;
+    picker_generation(path, &p->generation);
+
+    const char* fixed[] = {"..", folderpick ? "." : _selection ? PICK_DONE : NULL};
+
+    for (int i = 0; i < 2 && fixed[i]; i++)
+    {
+        if (picker_add(p, &p->directory, fixed[i]) < 0)
+        {
+            closedir(dir);
+            picker_free(p);
+            return NULL;
+        }
+        p->fixed++;
+    }
+
+    // only the first page is read here, picker_run() loads the rest between
+    // input polls so the first frame does not wait for the whole directory
+    p->dir = dir;
+    picker_load(p, PICK_PAGE);
+
+    return p;
+}
+
+char* pick_file(char* path, bool folderpick, char* filename_buf)
+{
+    _filename = filename_buf;
+    _filename[0] = '\0';
+
+    picker* root = picker_open(path, folderpick, NULL);
+    if (!root)
+        return NULL;
+
+    picker_run(root);
 
     return _filename;
 }
 
-void picker_init(picker* new_picker)
+static int pick_selection_find(const char* path)
 {
-    if(opened_pickers < 0)
+    for (int i = 0; i < _selection->count; i++)
+        if (!strcmp(_selection->path[i], path))
+            return i;
+    return -1;
+}
+
+static void pick_selection_toggle(const char* path)
+{
+    int i = pick_selection_find(path);
+
+    if (i >= 0)
     {
-        opened_pickers = 0;
+        free(_selection->path[i]);
+        // keep the marking order, it is the order the batch runs in
+        memmove(&_selection->path[i], &_selection->path[i + 1], (_selection->count - i - 1) * sizeof(char*));
+        _selection->count--;
         return;
     }
 
-    __picker = new_picker;
-    __picker->selected = 0;
+    if (_selection->count == _selection->alloc)
+    {
+        int alloc = _selection->alloc ? _selection->alloc * 2 : 32;
+        char** grown = realloc(_selection->path, alloc * sizeof(char*));
+        if (!grown) return;
+        _selection->path = grown;
+        _selection->alloc = alloc;
+    }
+
+    char* copy = strdup(path);
+    if (copy)
+        _selection->path[_selection->count++] = copy;
+}
+
+void pick_selection_free(pick_selection* selection)
+{
+    for (int i = 0; i < selection->count; i++)
+        free(selection->path[i]);
+    free(selection->path);
+    memset(selection, 0, sizeof(*selection));
+}
+
+char* pick_files(char* path, pick_selection* selection, char* filename_buf)
+{
+    _selection = selection;
+    char* res = pick_file(path, false, filename_buf);
+    _selection = NULL;
+
+    return res;
+}
+
+// the open directory levels form a stack on the heap: entering a directory
+// pushes a picker, ".." pops back to the parent with its selection intact
+void picker_run(picker* root)
+{
+    __picker = root;
     __picker->update_needed = true;
 
     picker_update();
 
     while(true)
     {
-        u8 input = smc_get_events();
-
-        if(input & SMC_EJECT_BUTTON)
+        if (__picker->dir)
+            picker_load(__picker, PICK_PAGE);
+
+        // sleep between inputs only once the listing is complete
+        int input = __picker->dir ? console_select_poll() : console_select_wait();
+
+        if ((input & CONSOLE_KEY_UP) || (input & CONSOLE_KEY_W))
+            picker_prev_selection();
+        if ((input & CONSOLE_KEY_DOWN) || (input & CONSOLE_KEY_S))
+            picker_next_selection();
+        if ((input & CONSOLE_KEY_LEFT) || (input & CONSOLE_KEY_A))
+            picker_prev_jump();
+        if ((input & CONSOLE_KEY_RIGHT) || (input & CONSOLE_KEY_D))
+            picker_next_jump();
+
+        if(input & (CONSOLE_KEY_EJECT | CONSOLE_KEY_P | CONSOLE_KEY_ENTER))
         {
-            if(__picker->selected > __picker->directories - 1) // file
-            {
-                pick_sprintf(_filename, "%s/%s", __picker->path, __picker->file[__picker->selected - (__picker->directories)]);
-            }
-            else // directory
+            const char* name = picker_name(__picker, __picker->selected);
+
+            if(__picker->selected > picker_directories(__picker) - 1) // file
             {
-                if (strcmp(__picker->directory[__picker->selected], ".") == 0 && __picker->folderpick)
+                pick_snprintf(_filename, _MAX_LFN + 1, "%s/%s", __picker->path, name);
+                if (_selection)
                 {
-                    pick_sprintf(_filename, "%s/", __picker->path);
+                    pick_selection_toggle(_filename);
+                    _filename[0] = '\0';
+                    __picker->update_needed = true;
+                    picker_update();
+                    continue;
                 }
-                else if (strcmp(__picker->directory[__picker->selected], "..") == 0)
-                {
-                    if (opened_pickers < 1) // root picker
-                    {
-                        _filename = "";
-                        break;
-                    }
+                break;
+            }
 
-                    picker_init(picker_chain[--opened_pickers]);
-                }
-                else
+            if (strcmp(name, ".") == 0 && __picker->folderpick)
+            {
+                pick_snprintf(_filename, _MAX_LFN + 1, "%s/", __picker->path);
+                break;
+            }
+            else if (_selection && strcmp(name, PICK_DONE) == 0)
+            {
+                pick_snprintf(_filename, _MAX_LFN + 1, "%s/", __picker->path);
+                break;
+            }
+            else if (strcmp(name, "..") == 0)
+            {
+                if (!__picker->parent) // root picker
                 {
-                    // Throw the current directory on to our stack.
-                    picker_chain[opened_pickers++] = __picker;
+                    _filename[0] = '\0';
+                    break;
+                }
 
-                    pick_sprintf(_directory, "%s/%s", __picker->path, __picker->directory[__picker->selected]);
-                    pick_file(_directory, __picker->folderpick, _filename);
+                picker* parent = __picker->parent;
+                picker_release(__picker);
+                __picker = parent;
+            }
+            else
+            {
+                char directory[_MAX_LFN + 1];
+                pick_snprintf(directory, sizeof(directory), "%s/%s", __picker->path, name);
 
-                    // Has a file been selected yet? If not, we have to show the previous directory, user probably pressed B.
-                    if(strlen(_filename) == 0)
-                        picker_init(picker_chain[--opened_pickers]);
-                }
+                // a directory that cannot be opened leaves us where we are
+                picker* child = picker_open(directory, __picker->folderpick, __picker);
+                if (child)
+                    __picker = child;
             }
 
-            break;
+            __picker->update_needed = true;
         }
 
-        if(input & SMC_POWER_BUTTON) picker_next_selection();
+        else if(input & (CONSOLE_KEY_POWER | CONSOLE_KEY_Q)) picker_next_selection();
 
         picker_update();
     }
+
+    while (__picker)
+    {
+        picker* parent = __picker->parent;
+        picker_release(__picker);
+        __picker = parent;
+    }
 }
 
 void picker_print_filenames()
@@ -200,48 +496,85 @@ void picker_print_filenames()
     int i = 0;
     char item_buffer[100] = {0};
 
-    console_add_text(__picker->folderpick ? "Select a directory..." : "Select a file...");
+    pick_snprintf(item_buffer, MAX_LINE_LENGTH, "%s%s", __picker->folderpick ? "Select a directory..." :
+        _selection ? "Mark files, then select " PICK_DONE "..." : "Select a file...",
+        __picker->dir ? " (loading)" : "");
+    console_add_text(item_buffer);
     console_add_text("");
 
-    for(i = __picker->show_y; i < (MAX_LINES - 6) + __picker->show_y; i++)
+    for(i = __picker->show_y; i < PICK_LINES + __picker->show_y; i++)
     {
-        if(i < __picker->directories)
+        if(i >= picker_entries(__picker))
+            break;
+
+        const char* name = picker_name(__picker, i);
+
+        if(i < picker_directories(__picker))
         {
-            pick_snprintf(item_buffer, MAX_LINE_LENGTH, "  %s/ ", __picker->directory[i]);
+            if (_selection && i == 1)
+                pick_snprintf(item_buffer, MAX_LINE_LENGTH, "  %s (%d marked) ", PICK_DONE, _selection->count);
+            else
+                pick_snprintf(item_buffer, MAX_LINE_LENGTH, "  %s/ ", name);
         }
         else
         {
-            pick_snprintf(item_buffer, MAX_LINE_LENGTH, "  %s ", __picker->file[i - __picker->directories]);
+            bool marked = false;
+
+            if (_selection)
+            {
+                char full[_MAX_LFN + 1];
+                pick_snprintf(full, sizeof(full), "%s/%s", __picker->path, name);
+                marked = pick_selection_find(full) >= 0;
+            }
+            pick_snprintf(item_buffer, MAX_LINE_LENGTH, "%s%s ", marked ? "* " : "  ", name);
         }
         console_add_text(item_buffer);
     }
 }
 
+// row the cursor was last drawn on, -1 when the rows need drawing again
+static int picker_cursor = -1;
+
+static void picker_draw_cursor(int x, int y, int row)
+{
+    int header_lines_skipped = 2;
+    char* mark = row == __picker->selected - __picker->show_y ? ">" : " ";
+
+    gfx_draw_string(GFX_ALL, mark, x + CHAR_WIDTH, (row+header_lines_skipped) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
+}
+
 void picker_update()
 {
     int i = 0, x = 0, y = 0;
     console_get_xy(&x, &y);
     if(__picker->update_needed)
     {
-        console_init();
+        // only the cells that changed are drawn again
+        console_flush();
         picker_print_filenames();
         console_show();
         __picker->update_needed = false;
+        picker_cursor = -1;
     }
 
-    int header_lines_skipped = 2;
-
-    // Update cursor.
-    for(i = 0; i < (MAX_LINES - 6); i++)
+    // Update cursor, a move only touches the old and the new row.
+    int row = __picker->selected - __picker->show_y;
+    if (picker_cursor < 0)
     {
-        gfx_draw_string(GFX_DRC, i == __picker->selected - __picker->show_y ? ">" : " ", x + CHAR_WIDTH, (i+header_lines_skipped) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
-        gfx_draw_string(GFX_TV, i == __picker->selected - __picker->show_y ? ">" : " ", x + CHAR_WIDTH, (i+header_lines_skipped) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
+        for(i = 0; i < PICK_LINES; i++)
+            picker_draw_cursor(x, y, i);
     }
+    else if (picker_cursor != row)
+    {
+        picker_draw_cursor(x, y, picker_cursor);
+        picker_draw_cursor(x, y, row);
+    }
+    picker_cursor = row;
 }
 
 void picker_next_selection()
 {
-    if(__picker->selected + 1 < (__picker->files + __picker->directories))
+    if(__picker->selected + 1 < picker_entries(__picker))
         __picker->selected++;
     else
     {
@@ -275,39 +608,57 @@ void picker_prev_selection()
 
     picker_update();
 }
-void picker_next_jump()
+static void picker_select(int index)
 {
-    int jump_num = 1;
-    if(__picker->selected + 5 < (__picker->files + __picker->directories))
-        jump_num = 5;
-    else
-        jump_num = (__picker->files + __picker->directories - 1) - __picker->selected;
-    __picker->selected += jump_num;
+    __picker->selected = index;
 
-    if(__picker->selected > (MAX_LINES - 7) + __picker->show_y)
+    if(index < __picker->show_y || index >= __picker->show_y + PICK_LINES)
     {
-        __picker->show_y += jump_num;
+        __picker->show_y = index < __picker->show_y ? index : index - PICK_LINES + 1;
         __picker->update_needed = true;
     }
+}
+
+static bool picker_same_group(int a, int b)
+{
+    return tolower((unsigned char)picker_name(__picker, a)[0]) == tolower((unsigned char)picker_name(__picker, b)[0]) &&
+        (a < picker_directories(__picker)) == (b < picker_directories(__picker));
+}
+
+// the names are sorted, so these move between groups of one first letter,
+// directories and files each on their own
+void picker_next_jump()
+{
+    int count = picker_entries(__picker);
+    int i = __picker->selected;
+
+    if (i < __picker->fixed)
+        i = __picker->fixed - 1;
+    else
+        while(i + 1 < count && picker_same_group(i, i + 1))
+            i++;
+
+    if(i + 1 < count)
+        picker_select(i + 1);
 
     picker_update();
 }
 
 void picker_prev_jump()
 {
-    int jump_num = 1;
-    if(__picker->selected > 5)
-        jump_num = 5;
-    else
-        jump_num = __picker->selected;
-    __picker->selected -= jump_num;
+    int i = __picker->selected;
 
-    if(__picker->selected < __picker->show_y)
+    // to the start of this group, or of the one before when already there
+    if (i > __picker->fixed)
     {
-        __picker->show_y -= jump_num;
-        __picker->update_needed = true;
+        i--;
+        while(i > __picker->fixed && picker_same_group(i - 1, i))
+            i--;
     }
+    else if (i > 0)
+        i--;
 
+    picker_select(i);
     picker_update();
 }
 
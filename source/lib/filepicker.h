@@ -14,13 +14,33 @@
 
 #include "console.h"
 #include "ff.h"
+#include <dirent.h>
 
+// names live back to back in one string pool, the lists only hold offsets
 typedef struct {
+    u32 offset;
+    u16 len;
+} picker_entry;
+
+typedef struct {
+    picker_entry* entry;
+    int count;
+    int alloc;
+} picker_list;
+
+// every directory level is one picker on the heap, linked to the one above
+typedef struct picker {
+    struct picker* parent;
     char path[_MAX_LFN + 1];
-    char directory[256][256];
-    int directories;
-    char file[256][256];
-    int files;
+    char* pool;
+    u32 pool_len;
+    u32 pool_alloc;
+    picker_list directory;
+    picker_list file;
+    int fixed;      // "..", "." or "[Done]" stay on top of the sorted names
+    bool marking;   // listed for pick_files()
+    u32 generation; // of the volume when the listing was read
+    DIR* dir;       // open while the rest of the listing loads
     bool folderpick;
     int selected;
     bool update_needed;
@@ -28,6 +48,15 @@ typedef struct {
     int show_y;
 } picker;
 
+typedef struct {
+    char** path;
+    int count;
+    int alloc;
+} pick_selection;
+
 char* pick_file(char* path, bool folderpick, char* filename_buf);
+// EJECT on a file toggles its mark, "[Done]" returns with everything marked
+char* pick_files(char* path, pick_selection* selection, char* filename_buf);
+void pick_selection_free(pick_selection* selection);
 
 #endif
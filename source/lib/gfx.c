@@ -11,6 +11,7 @@
 #include "gfx.h"
 #include "serial.h"
 #include "gpu.h"
+#include "utils.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -20,6 +21,10 @@ void gfx_printf_to_display(bool on){
 	printf_to_display = on;
 }
 
+bool gfx_get_printf_to_display(void){
+	return printf_to_display;
+}
+
 #ifdef MINUTE_HEADLESS
 void gfx_init(void)
 {
@@ -40,6 +45,11 @@ void gfx_draw_plot(gfx_screen_t screen, int x, int y, u32 color)
 
 }
 
+void gfx_fill_rect(gfx_screen_t screen, int x, int y, int w, int h, u32 color)
+{
+
+}
+
 void gfx_clear(gfx_screen_t screen, u32 color)
 {
 
@@ -55,6 +65,26 @@ void gfx_draw_string(gfx_screen_t screen, char* str, int x, int y, u32 color)
 
 }
 
+int gfx_printf_line(gfx_screen_t screen)
+{
+	return -1;
+}
+
+u32 gfx_get_epoch(gfx_screen_t screen)
+{
+	return 0;
+}
+
+int gfx_scrollback_count(void)
+{
+	return 0;
+}
+
+const char* gfx_scrollback_line(int index)
+{
+	return "";
+}
+
 #ifndef MINUTE_BOOT1
 int printf(const char* fmt, ...)
 {
@@ -90,6 +120,7 @@ struct {
 
 	int current_y;
 	int current_x;
+	u32 epoch;
 } fbs[GFX_ALL] = {
 	[GFX_TV] =
 	{
@@ -149,14 +180,25 @@ size_t gfx_get_size(gfx_screen_t screen)
 	return gfx_get_stride(screen) * fbs[screen].height;
 }
 
+// GFX_ALL runs the loops below over both screens at once
+#define GFX_FIRST(screen) ((screen) == GFX_ALL ? 0 : (screen))
+#define GFX_LAST(screen) ((screen) == GFX_ALL ? GFX_ALL : (screen) + 1)
+
 void gfx_draw_plot(gfx_screen_t screen, int x, int y, u32 color)
 {
-	if(screen == GFX_ALL) {
-		for(int i = 0; i < GFX_ALL; i++)
-			gfx_draw_plot(i, x, y, color);
-	} else {
-	    u32* fb = &fbs[screen].ptr[x + y * (gfx_get_stride(screen) / sizeof(u32))];
-	    *fb = color;
+	for(int i = GFX_FIRST(screen); i < GFX_LAST(screen); i++)
+		fbs[i].ptr[x + y * fbs[i].width] = color;
+}
+
+void gfx_fill_rect(gfx_screen_t screen, int x, int y, int w, int h, u32 color)
+{
+	for(int i = GFX_FIRST(screen); i < GFX_LAST(screen); i++) {
+		int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+		int x1 = x + w > fbs[i].width ? fbs[i].width : x + w;
+		int y1 = y + h > fbs[i].height ? fbs[i].height : y + h;
+
+		for(int row = y0; row < y1 && x0 < x1; row++)
+			fill32(&fbs[i].ptr[x0 + row * fbs[i].width], color, (x1 - x0) * sizeof(u32));
 	}
 }
 
@@ -164,44 +206,53 @@ void gfx_clear(gfx_screen_t screen, u32 color)
 {
 	//if (gfx_currently_headless) return;
 
-	if(screen == GFX_ALL) {
-		for(int i = 0; i < GFX_ALL; i++)
-			gfx_clear(i, color);
-	} else {
-	    for(int i = 0; i < fbs[screen].width * fbs[screen].height; i++)
-	        fbs[screen].ptr[i] = color;
+	for(int i = GFX_FIRST(screen); i < GFX_LAST(screen); i++) {
+	    fill32(fbs[i].ptr, color, fbs[i].width * fbs[i].height * sizeof(u32));
 
-	    fbs[screen].current_x = 10;
-	    fbs[screen].current_y = 10;
+	    fbs[i].epoch++;
+	    fbs[i].current_x = 10;
+	    fbs[i].current_y = 10;
 	}
 }
 
+// pixel masks of the four pixels in a nibble of a glyph row, leftmost first
+#define M(n, b) (((n) & (8 >> (b))) ? 0xFFFFFFFF : 0)
+#define ROW(n) { M(n, 0), M(n, 1), M(n, 2), M(n, 3) }
+static const u32 gfx_glyph_mask[16][4] = {
+	ROW(0), ROW(1), ROW(2), ROW(3), ROW(4), ROW(5), ROW(6), ROW(7),
+	ROW(8), ROW(9), ROW(10), ROW(11), ROW(12), ROW(13), ROW(14), ROW(15),
+};
+#undef ROW
+#undef M
+
 void gfx_draw_char(gfx_screen_t screen, char c, int x, int y, u32 color)
 {
 	if (gfx_currently_headless) return;
 
-	if(screen == GFX_ALL) {
-		for(int i = 0; i < GFX_ALL; i++)
-			gfx_draw_char(i, c, x, y, color);
-	} else {
-		if(c < 32) return;
-		c -= 32;
+	if(c < 32) return;
+	c -= 32;
 
-		const u8* charData = &msx_font[(CHAR_SIZE_X * CHAR_SIZE_Y * c) / 8];
-		u32* fb = &fbs[screen].ptr[x + y * (gfx_get_stride(screen) / sizeof(u32))];
+	const u8* charData = &msx_font[(CHAR_SIZE_X * CHAR_SIZE_Y * c) / 8];
+	u32* fb[GFX_ALL];
 
-		for(int i = 0; i < CHAR_SIZE_Y; ++i)
-		{
-			u8 v = *(charData++);
+	for(int s = GFX_FIRST(screen); s < GFX_LAST(screen); s++)
+		fb[s] = &fbs[s].ptr[x + y * fbs[s].width];
 
-			for(int j = 0; j < CHAR_SIZE_X; ++j)
-			{
-				if(v & (128 >> j)) *fb = color;
-				else *fb = 0x00000000;
-				fb++;
-			}
+	// unset pixels are black, a row is two nibbles of masked color
+	for(int i = 0; i < CHAR_SIZE_Y; ++i)
+	{
+		u8 v = *(charData++);
+		const u32* hi = gfx_glyph_mask[v >> 4];
+		const u32* lo = gfx_glyph_mask[v & 0xF];
+		u32 p0 = color & hi[0], p1 = color & hi[1], p2 = color & hi[2], p3 = color & hi[3];
+		u32 p4 = color & lo[0], p5 = color & lo[1], p6 = color & lo[2], p7 = color & lo[3];
 
-			fb += (gfx_get_stride(screen) / sizeof(u32)) - CHAR_SIZE_X;
+		for(int s = GFX_FIRST(screen); s < GFX_LAST(screen); s++)
+		{
+			u32* row = fb[s];
+			row[0] = p0; row[1] = p1; row[2] = p2; row[3] = p3;
+			row[4] = p4; row[5] = p5; row[6] = p6; row[7] = p7;
+			fb[s] += fbs[s].width;
 		}
 	}
 }
@@ -209,28 +260,102 @@ void gfx_draw_char(gfx_screen_t screen, char c, int x, int y, u32 color)
 void gfx_draw_string(gfx_screen_t screen, char* str, int x, int y, u32 color)
 {
 	if (gfx_currently_headless) return;
+	if(!str) return;
 
-	if(screen == GFX_ALL) {
-		for(int i = 0; i < GFX_ALL; i++)
-			gfx_draw_string(i, str, x, y, color);
-	} else {
-		if(!str) return;
+	int dx = 0, dy = 0;
+	for(int k = 0; str[k]; k++)
+	{
+		if(str[k] >= 32 && str[k] < 128)
+			gfx_draw_char(screen, str[k], x + dx, y + dy, color);
 
-		int dx = 0, dy = 0;
-		for(int k = 0; str[k]; k++)
+		dx += 8;
+
+		if(str[k] == '\n')
 		{
-			if(str[k] >= 32 && str[k] < 128)
-				gfx_draw_char(screen, str[k], x + dx, y + dy, color);
+			dx = 0;
+			dy -= 8;
+		}
+	}
+}
 
-			dx += 8;
+// y of the last line printf() ended, -1 when it doesn't print on screen
+int gfx_printf_line(gfx_screen_t screen)
+{
+	if (gfx_currently_headless || !printf_to_display || screen == GFX_ALL)
+		return -1;
 
-			if(str[k] == '\n')
-			{
-				dx = 0;
-				dy -= 8;
-			}
-		}
+	return fbs[screen].current_y - 10;
+}
+
+// changes whenever the screen was cleared or printf() drew on it
+u32 gfx_get_epoch(gfx_screen_t screen)
+{
+	if (screen == GFX_ALL)
+		return 0;
+
+	return fbs[screen].epoch;
+}
+
+// Every printed line also goes into a ring for the scrollback viewer. The
+// screen scrolls instead of being wiped when printf() reaches the bottom:
+// the rows move up by half a screen at once, so one framebuffer move covers
+// many lines of output.
+#define GFX_LINE_HEIGHT (10)
+#define GFX_SCROLLBACK (512)
+#define GFX_SCROLLBACK_COLS (160)
+
+static struct {
+	char line[GFX_SCROLLBACK][GFX_SCROLLBACK_COLS + 1];
+	int head; // line being written
+	int count; // complete lines
+	int len;
+} scrollback;
+
+static void gfx_scrollback_put(char c)
+{
+	if (c == '\n') {
+		scrollback.head = (scrollback.head + 1) % GFX_SCROLLBACK;
+		scrollback.line[scrollback.head][0] = '\0';
+		scrollback.len = 0;
+		if (scrollback.count < GFX_SCROLLBACK - 1)
+			scrollback.count++;
+	} else if (scrollback.len < GFX_SCROLLBACK_COLS && c != '\r') {
+		scrollback.line[scrollback.head][scrollback.len++] = c;
+		scrollback.line[scrollback.head][scrollback.len] = '\0';
+	}
+}
+
+int gfx_scrollback_count(void)
+{
+	return scrollback.count;
+}
+
+// 0 is the oldest complete line that is still kept
+const char* gfx_scrollback_line(int index)
+{
+	if (index < 0 || index >= scrollback.count)
+		return "";
+
+	return scrollback.line[(scrollback.head - scrollback.count + index + GFX_SCROLLBACK) % GFX_SCROLLBACK];
+}
+
+// moves the text area up by px rows and blanks what it leaves behind
+static void gfx_scroll(gfx_screen_t screen, int px)
+{
+	u32* top = &fbs[screen].ptr[10 * fbs[screen].width];
+	int rows = fbs[screen].height - 10;
+
+	if (px >= rows) {
+		fill32(top, BLACK, rows * fbs[screen].width * sizeof(u32));
+	} else {
+		memmove(top, top + px * fbs[screen].width, (rows - px) * fbs[screen].width * sizeof(u32));
+		fill32(top + (rows - px) * fbs[screen].width, BLACK, px * fbs[screen].width * sizeof(u32));
 	}
+
+	fbs[screen].current_y -= px;
+	if (fbs[screen].current_y < 10)
+		fbs[screen].current_y = 10;
+	fbs[screen].epoch++;
 }
 
 // This sucks, should use a stdout devoptab.
@@ -250,6 +375,7 @@ int printf(const char* fmt, ...)
 			serial_line_inc();
 		}
 		serial_send(*str_iter);
+		gfx_scrollback_put(*str_iter);
 		str_iter++;
 	}
 
@@ -257,29 +383,38 @@ int printf(const char* fmt, ...)
 		return 0;
 
 	int lines = 0;
-	char* last_line = str;
 	for(int k = 0; str[k]; k++)
 	{
 		if(str[k] == '\n')
-		{
-			lines += 10;
-			last_line = &str[k + 1];
-		}
+			lines += GFX_LINE_HEIGHT;
 	}
 
 	for(int i = 0; i < GFX_ALL; i++) {
-		if(fbs[i].current_y + lines >= fbs[i].height - 20)
-			gfx_clear(i, BLACK);
+		int bottom = fbs[i].height - 20;
 
-		gfx_draw_string(i, str, fbs[i].current_x, fbs[i].current_y, WHITE);
-		if (!lines) {
-			fbs[i].current_x += ((strlen(last_line)-1) * CHAR_WIDTH);
+		if(fbs[i].current_y + lines >= bottom) {
+			int px = fbs[i].current_y + lines - bottom + GFX_LINE_HEIGHT;
+			int half = (bottom / 2) / GFX_LINE_HEIGHT * GFX_LINE_HEIGHT;
+			gfx_scroll(i, px > half ? px : half);
 		}
-		else {
-			fbs[i].current_x = 10;
+
+		int x = fbs[i].current_x, y = fbs[i].current_y;
+		for(int k = 0; str[k]; k++)
+		{
+			if(str[k] == '\n') {
+				x = 10;
+				y += GFX_LINE_HEIGHT;
+				continue;
+			}
+
+			if(x + CHAR_SIZE_X <= fbs[i].width && y + CHAR_SIZE_Y <= fbs[i].height)
+				gfx_draw_char(i, str[k], x, y, WHITE);
+			x += CHAR_SIZE_X;
 		}
 
-		fbs[i].current_y += lines;
+		fbs[i].current_x = x;
+		fbs[i].current_y = y;
+		fbs[i].epoch++;
 	}
 
     return 0;
@@ -30,8 +30,16 @@ void gfx_init(void);
 bool gfx_is_currently_headless(void);
 void gfx_draw_plot(gfx_screen_t screen, int x, int y, u32 color);
 void gfx_clear(gfx_screen_t screen, u32 color);
+void gfx_fill_rect(gfx_screen_t screen, int x, int y, int w, int h, u32 color);
+void gfx_draw_char(gfx_screen_t screen, char c, int x, int y, u32 color);
 void gfx_draw_string(gfx_screen_t screen, char* str, int x, int y, u32 color);
+int gfx_printf_line(gfx_screen_t screen);
+u32 gfx_get_epoch(gfx_screen_t screen);
+// lines printf() printed, 0 the oldest one still kept
+int gfx_scrollback_count(void);
+const char* gfx_scrollback_line(int index);
 void gfx_printf_to_display(bool on);
+bool gfx_get_printf_to_display(void);
 
 #ifdef MINUTE_BOOT1
 static inline int printf(const char* fmt, ...)
@@ -13,6 +13,7 @@
 #include "latte.h"
 #include "gfx.h"
 #include "gpio.h"
+#include "i2c.h"
 
 //#define I2C_DEBUG
 
@@ -43,33 +44,43 @@ void i2c_inout_data(u8 data, bool last)
     write32(LT_SMC_I2C_INOUT_CTRL, 1);
 }
 
-int i2c_wait_xfer_done(void)
+// 1 while a transfer is running, 0 once it completed, negative on errors
+int i2c_poll_xfer(void)
 {
-    u32 mask = 0;
+    u32 mask = read32(LT_SMC_I2C_INT_STATE) & read32(LT_SMC_I2C_INT_MASK);
 
-    for(int i = 0; i < 4999; i++)
+    if(mask & 0x1C)
     {
-        mask = read32(LT_SMC_I2C_INT_STATE) & read32(LT_SMC_I2C_INT_MASK);
-        if(mask & 0x1C)
-        {
-            clear32(LT_SMC_I2C_INT_STATE, ~read32(LT_SMC_I2C_INT_MASK));
+        clear32(LT_SMC_I2C_INT_STATE, ~read32(LT_SMC_I2C_INT_MASK));
 #ifdef I2C_DEBUG
-            printf("i2c: xfer error, mask 0x%lx!\n", mask);
+        printf("i2c: xfer error, mask 0x%lx!\n", mask);
 #endif
-            return -2;
-        }
-        if(mask & 3)
-        {
-            clear32(LT_SMC_I2C_INT_STATE, ~read32(LT_SMC_I2C_INT_MASK));
+        return -2;
+    }
+    if(mask & 3)
+    {
+        clear32(LT_SMC_I2C_INT_STATE, ~read32(LT_SMC_I2C_INT_MASK));
 #ifdef I2C_DEBUG
-            printf("i2c: xfer complete, mask 0x%lx\n", mask);
+        printf("i2c: xfer complete, mask 0x%lx\n", mask);
 #endif
-            return 0;
-        }
+        return 0;
+    }
+
+    return 1;
+}
+
+int i2c_wait_xfer_done(void)
+{
+    for(int i = 0; i < 4999; i++)
+    {
+        int res = i2c_poll_xfer();
+        if(res <= 0)
+            return res;
 
         udelay(1000);
     }
 
+    u32 mask = read32(LT_SMC_I2C_INT_STATE) & read32(LT_SMC_I2C_INT_MASK);
 #ifdef I2C_DEBUG
     printf("i2c: xfer fail, mask 0x%lx!\n", mask);
 #endif
@@ -77,10 +88,10 @@ int i2c_wait_xfer_done(void)
     return -1;
 }
 
-int i2c_write(u8 slave_7bit, const u8* data, size_t size)
+// The start/poll/finish steps let the SMC be sampled from the alarm
+// interrupt without waiting for the bus there.
+int i2c_start_write(u8 slave_7bit, const u8* data, size_t size)
 {
-    int res = 0;
-
     if(!data || size == 0 || size > 0x40)
         return -4;
 
@@ -92,17 +103,12 @@ int i2c_write(u8 slave_7bit, const u8* data, size_t size)
         i2c_inout_data(*data++, size == 0);
     }
 
-    res = i2c_wait_xfer_done();
-
-    i2c_disable_int(0x1E);
-    return res;
+    return 0;
 }
 
-int i2c_read(u8 slave_7bit, u8* data, size_t size)
+int i2c_start_read(u8 slave_7bit, size_t size)
 {
-    int res = 0;
-
-    if(!data || size == 0 || size > 0x40)
+    if(size == 0 || size > 0x40)
         return -4;
 
     i2c_enable_int(0x1D);
@@ -114,17 +120,17 @@ int i2c_read(u8 slave_7bit, u8* data, size_t size)
         i2c_inout_data(0, counter == 0);
     }
 
-    res = i2c_wait_xfer_done();
-    if(res) {
-        i2c_disable_int(0x1D);
-        return res;
-    }
+    return 0;
+}
 
+// fetches what a completed read brought in
+int i2c_finish_read(u8* data, size_t size)
+{
     if(size > ((read32(LT_SMC_I2C_INOUT_SIZE) & 0xFF0000) >> 16)) {
 #ifdef I2C_DEBUG
         printf("i2c: read size fail!\n");
 #endif
-        i2c_disable_int(0x1D);
+        i2c_end_xfer();
         return -5;
     }
 
@@ -138,12 +144,44 @@ int i2c_read(u8 slave_7bit, u8* data, size_t size)
     }
     while(pos != size);
 
-    i2c_disable_int(0x1D);
+    i2c_end_xfer();
     return 0;
 }
 
+void i2c_end_xfer(void)
+{
+    i2c_disable_int(0x1F);
+}
+
+int i2c_write(u8 slave_7bit, const u8* data, size_t size)
+{
+    int res = i2c_start_write(slave_7bit, data, size);
+    if(res)
+        return res;
+
+    res = i2c_wait_xfer_done();
+
+    i2c_end_xfer();
+    return res;
+}
+
+int i2c_read(u8 slave_7bit, u8* data, size_t size)
+{
+    if(!data)
+        return -4;
 
+    int res = i2c_start_read(slave_7bit, size);
+    if(res)
+        return res;
 
+    res = i2c_wait_xfer_done();
+    if(res) {
+        i2c_end_xfer();
+        return res;
+    }
+
+    return i2c_finish_read(data, size);
+}
 
 void ave_i2c_init(u32 clock, u32 channel)
 {
@@ -19,6 +19,14 @@ void i2c_init(u32 clock, u32 channel);
 int i2c_read(u8 slave_7bit, u8* data, size_t size);
 int i2c_write(u8 slave_7bit, const u8* data, size_t size);
 
+// a transfer in steps, for callers that can't wait on the bus
+int i2c_start_write(u8 slave_7bit, const u8* data, size_t size);
+int i2c_start_read(u8 slave_7bit, size_t size);
+int i2c_poll_xfer(void);
+int i2c_wait_xfer_done(void);
+int i2c_finish_read(u8* data, size_t size);
+void i2c_end_xfer(void);
+
 void ave_i2c_init(u32 clock, u32 channel);
 int ave_i2c_read(u8 slave_7bit, u8* data, size_t size);
 int ave_i2c_write(u8 slave_7bit, const u8* data, size_t size);
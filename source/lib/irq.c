@@ -21,6 +21,8 @@
 #include "sdcard.h"
 #include "mlc.h"
 #include "serial.h"
+#include "smc.h"
+#include "sched.h"
 
 static u32 _alarm_frequency = 0;
 
@@ -45,6 +47,8 @@ void irq_initialize(void)
 
 void irq_shutdown(void)
 {
+    smc_stop_sampling();
+    serial_set_async(0);
     write32(LT_INTMR_AHBALL_ARM, 0);
     write32(LT_INTSR_AHBALL_ARM, 0xffffffff);
     write32(LT_INTMR_AHBLT_ARM, 0);
@@ -74,6 +78,9 @@ void irq_handler(void)
             write32(LT_ALARM, read32(LT_TIMER) + _alarm_frequency);
 
         write32(LT_INTSR_AHBALL_ARM, IRQF_TIMER);
+        serial_drain(SERIAL_IRQ_BUDGET);
+        smc_alarm();
+        sched_alarm();
     }
 
     if(all_mask & IRQF_NAND) {
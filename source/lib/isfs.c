@@ -30,13 +30,12 @@
 
 #include "isfshax.h"
 
-#define ISFS_DEBUG
+#define LOG_LEVEL LOG_LEVEL_ISFS
+#define LOG_PREFIX "ISFS: "
+#include "log.h"
 
-#ifdef ISFS_DEBUG
-#   define  ISFS_debug(f, arg...) printf("ISFS: " f, ##arg);
-#else
-#   define  ISFS_debug(f, arg...)
-#endif
+// the FST fills the rest of the superblock after the header and the FAT
+#define ISFS_FST_COUNT ((ISFSSUPER_SIZE - 0x1000C) / sizeof(isfs_fst))
 
 static u8 slc_cluster_buf[CLUSTER_SIZE] ALIGNED(NAND_DATA_ALIGN);
 static u8 ecc_buf[ECC_BUFFER_ALLOC] ALIGNED(NAND_DATA_ALIGN);
@@ -142,19 +141,19 @@ static int _nand_read_page_rawfile(u32 pageno, void *data, void *ecc, FIL* file)
 #ifdef MINUTE_BOOT1
     return -128;
 #else
-    //ISFS_debug("ISFS: reading from file\n");
+    //LOG_DEBUG("reading from file\n");
     u32 off = pageno * (PAGE_SIZE + PAGE_SPARE_SIZE);
     if(f_lseek(file, off) != FR_OK){
-        ISFS_debug("ISFS: Error seeking file\n");
+        LOG_ERROR("Error seeking file\n");
         return -1;
     }
     UINT br;
     if(f_read(file, data, PAGE_SIZE, &br) != FR_OK || br != PAGE_SIZE){
-        ISFS_debug("ISFS: Error reading data from file\n");
+        LOG_ERROR("Error reading data from file\n");
         return -1;
     }
     if(f_read(file, ecc, PAGE_SPARE_SIZE, &br) != FR_OK || br != PAGE_SPARE_SIZE){
-        ISFS_debug("ISFS: Error reading ecc from file\n");
+        LOG_ERROR("Error reading ecc from file\n");
         return -1;
     }
     return 0;
@@ -201,19 +200,19 @@ int isfs_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
                 int correct = nand_correct(cluster_start + p, &cluster_data[p * PAGE_SIZE], ecc_buf);
                 /* uncorrectable ecc error or other issues */
                 if (correct < 0) {
-                    ISFS_debug("Uncorrectable ECC ERROR\n");
+                    LOG_ERROR("Uncorrectable ECC ERROR\n");
                     ecc_uncorrectable = true;
                 }
 
                 /* ECC errors, a refresh might be needed */
                 if (correct > 0){
-                    ISFS_debug("Corrected ECC ERROR\n");
+                    LOG_DEBUG("Corrected ECC ERROR\n");
                     ecc_correctable = true;
                 }
             }
                 
             if(nand_error){
-                ISFS_debug("NAND ERROR on read\n");
+                LOG_ERROR("NAND ERROR on read\n");
                 nand_error = true;
             }
 
@@ -256,11 +255,11 @@ int isfs_read_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
         matched += !memcmp(saved_hmacs[1], hmac, sizeof(hmac));
 
         if (matched == 1) {
-            ISFS_debug("HMAC partital match\n");
+            LOG_WARN("HMAC partital match\n");
             hmac_partial = true;
         }
         else if(!matched){
-            ISFS_debug("HMAC error\n");
+            LOG_ERROR("HMAC error\n");
             return ISFSVOL_ERROR_HMAC;
         }
     }
@@ -311,7 +310,7 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
     nand_initialize(ctx->bank);
 
     /* compute clusters hmac */
-    if (flags & ISFSVOL_FLAG_HMAC)
+    if ((flags & ISFSVOL_FLAG_HMAC) && !(flags & ISFSVOL_FLAG_HMAC_DATA))
     {
         hmac_ctx calc_hmac;
         hmac_init(&calc_hmac, ctx->hmac, 20);
@@ -350,7 +349,7 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
             /* if this page is unmodified, read it from nand */
             if ((curpage < startpage) || (curpage >= endpage))
             {
-                ISFS_debug("Reading existing page\n");
+                LOG_DEBUG("Reading existing page\n");
                 nand_read_page(curpage, blockpg[p], ecc_buf);
                 if (nand_correct(curpage, blockpg[p], ecc_buf) < 0)
                     return ISFSVOL_ERROR_READ;
@@ -358,6 +357,20 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
                 continue;
             }
 
+            /* file data clusters each have their own hmac */
+            u8 *srcdata = (u8*)data + (curpage - startpage) * PAGE_SIZE;
+            if ((flags & ISFSVOL_FLAG_HMAC_DATA) && clusidx == 0)
+            {
+                isfs_hmac_data seed = *(const isfs_hmac_data *)hmac_seed;
+                seed.iblk += (curpage - startpage) / CLUSTER_PAGES;
+
+                hmac_ctx calc_hmac;
+                hmac_init(&calc_hmac, ctx->hmac, 20);
+                hmac_update(&calc_hmac, (const u8 *)&seed, SHA_BLOCK_SIZE);
+                hmac_update(&calc_hmac, srcdata, CLUSTER_SIZE);
+                hmac_final(&calc_hmac, hmac);
+            }
+
             /* place hmac in page 6 and 7 of a cluster */
             memset(blocksp[p], 0, PAGE_SPARE_SIZE);
             switch (clusidx)
@@ -372,19 +385,18 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
             }
 
             /* encrypt or copy the data */
-            u8 *srcdata = (u8*)data + (curpage - startpage) * PAGE_SIZE;
             if (flags & ISFSVOL_FLAG_ENCRYPTED)
                 aes_encrypt(blockpg[p], srcdata, PAGE_SIZE / ISFSAES_BLOCK_SIZE, clusidx > 0);
             else
                 memcpy(blockpg[p], srcdata, PAGE_SIZE);
         }
-        ISFS_debug("Erase block\n");
+        LOG_DEBUG("Erase block\n");
         /* erase block */
         if (nand_erase_block(b * BLOCK_PAGES) < 0)
             return ISFSVOL_ERROR_ERASE;
 
         int write_error = 0;
-        ISFS_debug("Writing\n");
+        LOG_DEBUG("Writing\n");
         /* write block */
         for (p = 0; p < BLOCK_PAGES; p++)
             if (nand_write_page(firstblockpage + p, blockpg[p], blocksp[p]) < 0){
@@ -398,7 +410,7 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
         if (!(flags & ISFSVOL_FLAG_READBACK))
             continue;
 
-        ISFS_debug("Reading back\n");
+        LOG_DEBUG("Reading back\n");
         /* read back pages */
         for (p = 0; p < BLOCK_PAGES; p++)
         {
@@ -495,9 +507,8 @@ void isfs_print_fst(isfs_fst* fst)
 
 static void _isfs_print_fst(isfs_fst* fst)
 {
-#ifdef ISFS_DEBUG
-    isfs_print_fst(fst);
-#endif
+    if (LOG_LEVEL >= LOG_LEVEL_DEBUG)
+        isfs_print_fst(fst);
 }
 
 static void _isfs_print_dir(isfs_ctx* ctx, isfs_fst* fst)
@@ -531,7 +542,7 @@ static isfs_fst* _isfs_find_fst(isfs_ctx* ctx, const char* path, void** parent){
         *parent = &root->sub;
     u16 next = root->sub;
     while(next!=0xFFFF){
-        //ISFS_debug("remaining path: %s\n", path);
+        //LOG_DEBUG("remaining path: %s\n", path);
         isfs_fst* fst = &root[next];
         const char* remaining = NULL;
 
@@ -542,12 +553,12 @@ static isfs_fst* _isfs_find_fst(isfs_ctx* ctx, const char* path, void** parent){
         }
 
         size_t size = remaining ? remaining - path : strlen(path);
-        //ISFS_debug("remaining compute: %s size: %zu\n", remaining, size);
+        //LOG_DEBUG("remaining compute: %s size: %zu\n", remaining, size);
 
         while((remaining && _isfs_fst_is_file(fst)) // skip files
                 || (size < sizeof(fst->name) && fst->name[size]) //check if fst name length
                 || memcmp(path, fst->name, size)){ //check name
-            //ISFS_debug("current %s %zu %s %p %s\n", remaining, fst->name, size, path, fst->sib, fst->sib != 0xffff ? root[fst->sib].name : NULL);
+            //LOG_DEBUG("current %s %zu %s %p %s\n", remaining, fst->name, size, path, fst->sib, fst->sib != 0xffff ? root[fst->sib].name : NULL);
         
             if(fst->sib == 0xFFFF)
                 return NULL;
@@ -578,20 +589,20 @@ char* _isfs_do_volume(const char* path, isfs_ctx** ctx)
 
     char mount[sizeof(volume->name)] = {0};
     memcpy(mount, path, filename - path);
-    ISFS_debug("searching volume %s\n", mount);
+    LOG_DEBUG("searching volume %s\n", mount);
     for(int i = 0; i < _isfs_num_volumes(); i++)
     {
         volume = &isfs[i];
         if(strcmp(mount, volume->name)) continue;
 
         if(!volume->mounted){
-            ISFS_debug("volume %s not mounted\n", mount);
+            LOG_DEBUG("volume %s not mounted\n", mount);
             return NULL;
         }
         *ctx = volume;
         return (char*)(filename + 1);
     }
-    ISFS_debug("volume name not found\n");
+    LOG_DEBUG("volume name not found\n");
     return NULL;
 }
 
@@ -643,11 +654,11 @@ int isfs_find_super(isfs_ctx* ctx, u32 min_generation, u32 max_generation, u32 *
 
     if(newest.index == -1)
     {
-        ISFS_debug("Failed to find super block.\n");
+        LOG_ERROR("Failed to find super block.\n");
         return -3;
     }
 
-    ISFS_debug("Found super block (device=%s, version=%u, index=%d, generation=0x%lX)\n",
+    LOG_INFO("Found super block (device=%s, version=%u, index=%d, generation=0x%lX)\n",
             ctx->name, newest.version, newest.index, newest.generation);
 
     if(generation) *generation = newest.generation;
@@ -664,7 +675,7 @@ static int _isfs_load_super_range(isfs_ctx* ctx, u32 min_generation, u32 max_gen
         if(isfs_read_super(ctx, ctx->super, ctx->index) >= 0)
             break;
         else
-            ISFS_debug("Reading superblock %d failed\n", ctx->index);
+            LOG_WARN("Reading superblock %d failed\n", ctx->index);
     }
 
     return (ctx->index >= 0) ? 0 : -1;
@@ -737,6 +748,33 @@ int isfs_commit_super(isfs_ctx* ctx)
 }
 #endif //NAND_WRITE_ENABLED
 
+// finds the volume of a path without the lookup noise of _isfs_do_volume,
+// callers pass any devoptab path and only ISFS ones match
+static isfs_ctx* _isfs_path_volume(const char* path)
+{
+    const char* colon = path ? strchr(path, ':') : NULL;
+    if(!colon) return NULL;
+
+    for(int i = 0; i < _isfs_num_volumes(); i++)
+    {
+        isfs_ctx* ctx = &isfs[i];
+        size_t len = strlen(ctx->name);
+        if(ctx->mounted && colon - path == len && !memcmp(path, ctx->name, len))
+            return ctx;
+    }
+    return NULL;
+}
+
+// the generation goes up with every superblock commit on the volume
+int isfs_get_generation(const char* path, u32* generation)
+{
+    isfs_ctx* ctx = _isfs_path_volume(path);
+    if(!ctx) return -ENOENT;
+
+    *generation = _isfs_get_hdr(ctx)->generation;
+    return 0;
+}
+
 isfs_fst* isfs_stat(const char* path)
 {
     isfs_ctx* ctx = NULL;
@@ -747,39 +785,413 @@ isfs_fst* isfs_stat(const char* path)
 }
 
 #ifdef NAND_WRITE_ENABLED
-int isfs_unlink(const char* path){
+// metadata changes inside a batch are committed once by isfs_batch_end
+static int _isfs_commit(isfs_ctx* ctx)
+{
+    if(ctx->batch) {
+        ctx->dirty = true;
+        return 0;
+    }
+    ctx->dirty = false;
+    return isfs_commit_super(ctx);
+}
+
+int isfs_batch_begin(const char* path)
+{
+    isfs_ctx* ctx = _isfs_path_volume(path);
+    if(!ctx) return -ENOENT;
+
+    ctx->batch++;
+    return 0;
+}
+
+int isfs_batch_end(const char* path)
+{
+    isfs_ctx* ctx = _isfs_path_volume(path);
+    if(!ctx) return -ENOENT;
+    if(!ctx->batch) return -EINVAL;
+
+    if(--ctx->batch || !ctx->dirty)
+        return 0;
+
+    ctx->dirty = false;
+    LOG_DEBUG("committing batch on %s\n", ctx->name);
+    if(isfs_commit_super(ctx))
+        return -EIO;
+    return 0;
+}
+
+static int _isfs_remove(const char* path, bool dir){
     if(!path)
         return -1;
     isfs_ctx* ctx = NULL;
     path = _isfs_do_volume(path, &ctx);
-    ISFS_debug("volume found: %p\n", ctx);
+    LOG_DEBUG("volume found: %p\n", ctx);
     if(!ctx)return -ENOENT;
 
     void *parent;
     isfs_fst* fst = _isfs_find_fst(ctx, path, &parent);
-    ISFS_debug("fst found: %p\n", fst);
+    LOG_DEBUG("fst found: %p\n", fst);
     if(!fst) return -ENOENT;
 
-    if(!_isfs_fst_is_file(fst)) return -EISDIR;
+    if(dir) {
+        if(!_isfs_fst_is_dir(fst)) return -ENOTDIR;
+        if(fst->sub != 0xFFFF) return -ENOTEMPTY;
+        if(fst == _isfs_get_fst(ctx)) return -EBUSY;
+    } else if(!_isfs_fst_is_file(fst)) return -EISDIR;
 
     //parent might be unaligned
     memcpy(parent, &fst->sib, sizeof(fst->sib)); //remove from directory
 
-    u16* fat = _isfs_get_fat(ctx);
-    u16 cluster = fst->sub;
-    while(cluster < 0xFFFB) {  
-        u16 next_cluster = fat[cluster];
-        fat[cluster] = 0xFFFE;
-        cluster = next_cluster;
+    if(!dir) {
+        u16* fat = _isfs_get_fat(ctx);
+        u16 cluster = fst->sub;
+        while(cluster < 0xFFFB) {  
+            u16 next_cluster = fat[cluster];
+            fat[cluster] = 0xFFFE;
+            cluster = next_cluster;
+        }
     }
 
     memset(fst, 0, sizeof(isfs_fst));
 
-    int res = isfs_commit_super(ctx);
+    int res = _isfs_commit(ctx);
     if(res)
         return -EIO;
     return 0;
 }
+
+int isfs_unlink(const char* path){
+    return _isfs_remove(path, false);
+}
+
+// the directory a new entry goes into and the name it gets there
+static int _isfs_parent(isfs_ctx* ctx, const char* path, isfs_fst** dir, const char** name){
+    while(*path == '/') path++;
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = strlen(base);
+    if(!len) return -EINVAL;
+    if(len > sizeof((*dir)->name)) return -ENAMETOOLONG;
+
+    *dir = _isfs_get_fst(ctx);
+    if(base != path) {
+        char dir_path[256];
+        if(base - path >= sizeof(dir_path)) return -ENAMETOOLONG;
+        memcpy(dir_path, path, base - path - 1);
+        dir_path[base - path - 1] = '\0';
+        *dir = _isfs_find_fst(ctx, dir_path, NULL);
+        if(!*dir) return -ENOENT;
+        if(!_isfs_fst_is_dir(*dir)) return -ENOTDIR;
+    }
+
+    *name = base;
+    return 0;
+}
+
+static int _isfs_reseal(isfs_ctx* ctx, isfs_fst* fst, const char* name, u16* first);
+static void _isfs_free_chain(isfs_ctx* ctx, u16 cluster);
+
+// the entry is unlinked from its sibling chain, renamed and pushed to the
+// head of the target directory; a file's data only moves when its name
+// changes, since the name is part of every data cluster's HMAC seed
+int isfs_rename(const char* from, const char* to){
+    isfs_ctx* ctx = NULL;
+    isfs_ctx* to_ctx = NULL;
+
+    from = _isfs_do_volume(from, &ctx);
+    to = _isfs_do_volume(to, &to_ctx);
+    if(!from || !to || !ctx) return -ENOENT;
+    if(ctx != to_ctx) return -EXDEV;
+
+    isfs_fst* root = _isfs_get_fst(ctx);
+    void *parent;
+    isfs_fst* fst = _isfs_find_fst(ctx, from, &parent);
+    if(!fst || fst == root) return -ENOENT;
+
+    while(*to == '/') to++;
+    isfs_fst* dir;
+    const char* name;
+    int res = _isfs_parent(ctx, to, &dir, &name);
+    if(res) return res;
+    size_t len = strlen(name);
+
+    // a directory can't go below itself
+    while(*from == '/') from++;
+    size_t from_len = strlen(from);
+    if(!strncmp(to, from, from_len) && to[from_len] == '/') return -EINVAL;
+
+    isfs_fst* existing = _isfs_find_fst(ctx, to, NULL);
+    if(existing == fst) return 0;
+    if(existing && (!_isfs_fst_is_file(existing) || !_isfs_fst_is_file(fst)))
+        return -EEXIST;
+
+    u16 first = fst->sub;
+    bool renamed = len != strnlen(fst->name, sizeof(fst->name)) || memcmp(fst->name, name, len);
+    if(renamed && _isfs_fst_is_file(fst)) {
+        res = _isfs_reseal(ctx, fst, name, &first);
+        if(res) return res;
+    }
+
+    int batch = ctx->batch++;
+    memcpy(parent, &fst->sib, sizeof(fst->sib));
+
+    // replaces an existing file like rename(2) does, after the unlink above
+    // so neither entry's chain pointer goes stale
+    if(existing) {
+        char path[sizeof(ctx->name) + 258];
+        snprintf(path, sizeof(path), "%s:/%s", ctx->name, to);
+        res = isfs_unlink(path);
+        if(res) {
+            // put the source back where it was
+            memcpy(parent, &(u16){fst - root}, sizeof(u16));
+            if(first != fst->sub)
+                _isfs_free_chain(ctx, first);
+            ctx->batch = batch;
+            return res;
+        }
+    }
+
+    memset(fst->name, 0, sizeof(fst->name));
+    memcpy(fst->name, name, len);
+    if(first != fst->sub) {
+        _isfs_free_chain(ctx, fst->sub);
+        fst->sub = first;
+    }
+    fst->sib = dir->sub;
+    dir->sub = fst - root;
+
+    ctx->batch = batch;
+    if(_isfs_commit(ctx))
+        return -EIO;
+    return 0;
+}
+
+int isfs_rmdir(const char* path){
+    return _isfs_remove(path, true);
+}
+
+static int _isfs_alloc_fst(isfs_ctx* ctx){
+    isfs_fst* root = _isfs_get_fst(ctx);
+
+    // the root is entry 0, freed entries are zeroed
+    for(int i = 1; i < ISFS_FST_COUNT; i++)
+        if(!_isfs_fst_get_type(&root[i]))
+            return i;
+    return -ENOSPC;
+}
+
+// chains count free clusters first fit, so files written one after the
+// other into free space come out contiguous
+static int _isfs_alloc_chain(isfs_ctx* ctx, u32 count, u16* first){
+    u16* fat = _isfs_get_fat(ctx);
+    u32 found = 0;
+
+    *first = FAT_CLUSTER_LAST;
+    if(!count) return 0;
+
+    for(u32 c = 0; c < CLUSTER_COUNT && found < count; c++)
+        found += fat[c] == FAT_CLUSTER_EMPTY;
+    if(found < count) return -ENOSPC;
+
+    u16 prev = FAT_CLUSTER_LAST;
+    for(u32 c = 0; count; c++) {
+        if(fat[c] != FAT_CLUSTER_EMPTY) continue;
+        if(prev == FAT_CLUSTER_LAST)
+            *first = c;
+        else
+            fat[prev] = c;
+        fat[c] = FAT_CLUSTER_LAST;
+        prev = c;
+        count--;
+    }
+    return 0;
+}
+
+static void _isfs_free_chain(isfs_ctx* ctx, u16 cluster){
+    u16* fat = _isfs_get_fat(ctx);
+    while(cluster < FAT_CLUSTER_LAST) {
+        u16 next = fat[cluster];
+        fat[cluster] = FAT_CLUSTER_EMPTY;
+        cluster = next;
+    }
+}
+
+// Writes a file's data again with HMACs seeded for its new name. The copy
+// goes to a new chain: the old one stays valid until the FST naming the new
+// chain is committed. Redirected volumes keep no spare area and no HMACs.
+static int _isfs_reseal(isfs_ctx* ctx, isfs_fst* fst, const char* name, u16* first){
+    isfs_fst* root = _isfs_get_fst(ctx);
+    u16* fat = _isfs_get_fat(ctx);
+    u32 count = (fst->size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    int res;
+
+    *first = fst->sub;
+    if((ctx->bank & 0x80000000) || !count) return 0;
+
+    u8* buf = memalign(NAND_DATA_ALIGN, BLOCK_CLUSTERS * CLUSTER_SIZE);
+    if(!buf) return -ENOMEM;
+
+    res = _isfs_alloc_chain(ctx, count, first);
+    if(res) goto out;
+
+    isfs_hmac_data old = {
+        .x1 = fst->x1,
+        .uid = fst->uid,
+        .ifst = fst - root,
+        .x3 = fst->x3,
+    };
+    memcpy(old.name, fst->name, sizeof(old.name));
+    isfs_hmac_data seed = old;
+    memset(seed.name, 0, sizeof(seed.name));
+    memcpy(seed.name, name, strlen(name));
+
+    // runs of contiguous new clusters, up to a NAND block each
+    u16 from = fst->sub;
+    for(u16 c = *first; c < FAT_CLUSTER_LAST; ) {
+        u32 run = 1;
+        while(run < BLOCK_CLUSTERS && fat[c + run - 1] == c + run)
+            run++;
+
+        for(u32 i = 0; i < run; i++, old.iblk++) {
+            if(isfs_read_volume(ctx, from, 1, ISFSVOL_FLAG_ENCRYPTED | ISFSVOL_FLAG_HMAC,
+                    &old, buf + i * CLUSTER_SIZE) < 0) {
+                res = -EIO;
+                goto fail;
+            }
+            from = fat[from];
+        }
+
+        if(isfs_write_volume(ctx, c, run, ISFSVOL_FLAG_ENCRYPTED | ISFSVOL_FLAG_HMAC |
+                ISFSVOL_FLAG_HMAC_DATA | ISFSVOL_FLAG_READBACK, &seed, buf) < 0) {
+            res = -EIO;
+            goto fail;
+        }
+
+        seed.iblk += run;
+        c = fat[c + run - 1];
+    }
+    goto out;
+
+  fail:
+    _isfs_free_chain(ctx, *first);
+    *first = fst->sub;
+  out:
+    free(buf);
+    return res;
+}
+
+// a new entry with the ownership and attributes of meta, or of its parent
+// directory without one, linked at the head of that directory
+static isfs_fst* _isfs_create(isfs_ctx* ctx, const char* path, const isfs_fst* meta, int type, int* res){
+    isfs_fst* root = _isfs_get_fst(ctx);
+    isfs_fst* dir;
+    const char* name;
+
+    *res = _isfs_parent(ctx, path, &dir, &name);
+    if(*res) return NULL;
+    if(_isfs_find_fst(ctx, path, NULL)) {
+        *res = -EEXIST;
+        return NULL;
+    }
+
+    int index = _isfs_alloc_fst(ctx);
+    if(index < 0) {
+        *res = index;
+        return NULL;
+    }
+    if(!meta)
+        meta = dir;
+
+    isfs_fst* fst = &root[index];
+    memset(fst, 0, sizeof(isfs_fst));
+    memcpy(fst->name, name, strlen(name));
+    fst->mode = (meta->mode & ~3) | type;
+    fst->attr = meta->attr;
+    fst->uid = meta->uid;
+    fst->gid = meta->gid;
+    fst->x1 = meta->x1;
+    fst->x3 = meta->x3;
+    fst->sub = type == 2 ? 0xFFFF : FAT_CLUSTER_LAST;
+    fst->sib = dir->sub;
+    dir->sub = index;
+    return fst;
+}
+
+int isfs_mkdir(const char* path, const isfs_fst* meta){
+    isfs_ctx* ctx = NULL;
+    int res;
+
+    path = _isfs_do_volume(path, &ctx);
+    if(!path || !ctx) return -ENOENT;
+
+    if(!_isfs_create(ctx, path, meta, 2, &res))
+        return res;
+
+    if(_isfs_commit(ctx))
+        return -EIO;
+    return 0;
+}
+
+// the whole file in one go, data must be readable up to the next cluster
+// boundary; physically contiguous clusters are written in one request
+int isfs_write_file(const char* path, const isfs_fst* meta, const void* data, u32 size){
+    isfs_ctx* ctx = NULL;
+    int res;
+
+    path = _isfs_do_volume(path, &ctx);
+    if(!path || !ctx) return -ENOENT;
+
+    isfs_fst* root = _isfs_get_fst(ctx);
+    void *parent;
+    isfs_fst* fst = _isfs_create(ctx, path, meta, 1, &res);
+    if(!fst) return res;
+
+    u16 first;
+    res = _isfs_alloc_chain(ctx, (size + CLUSTER_SIZE - 1) / CLUSTER_SIZE, &first);
+    if(res) goto fail;
+
+    fst->sub = first;
+    fst->size = size;
+
+    isfs_hmac_data seed = {
+        .x1 = fst->x1,
+        .uid = fst->uid,
+        .ifst = fst - root,
+        .x3 = fst->x3,
+    };
+    memcpy(seed.name, fst->name, sizeof(seed.name));
+
+    u16* fat = _isfs_get_fat(ctx);
+    for(u16 c = first; c < FAT_CLUSTER_LAST; ) {
+        u32 count = 1;
+        while(fat[c + count - 1] == c + count)
+            count++;
+
+        res = isfs_write_volume(ctx, c, count, ISFSVOL_FLAG_ENCRYPTED | ISFSVOL_FLAG_HMAC |
+                ISFSVOL_FLAG_HMAC_DATA | ISFSVOL_FLAG_READBACK, &seed,
+                (u8*)data + seed.iblk * CLUSTER_SIZE);
+        if(res < 0) {
+            res = -EIO;
+            goto fail;
+        }
+
+        seed.iblk += count;
+        c = fat[c + count - 1];
+    }
+
+    if(_isfs_commit(ctx))
+        return -EIO;
+    return 0;
+
+  fail:
+    // nothing was committed, take the entry and its clusters back
+    _isfs_find_fst(ctx, path, &parent);
+    memcpy(parent, &fst->sib, sizeof(fst->sib));
+    _isfs_free_chain(ctx, fst->sub);
+    memset(fst, 0, sizeof(isfs_fst));
+    return res;
+}
 #endif //NAND_WRITE_ENABLED
 
 int isfs_open(isfs_file* file, const char* path)
@@ -788,11 +1200,11 @@ int isfs_open(isfs_file* file, const char* path)
 
     isfs_ctx* ctx = NULL;
     path = _isfs_do_volume(path, &ctx);
-    ISFS_debug("volume found: %p\n", ctx);
+    LOG_DEBUG("volume found: %p\n", ctx);
     if(!ctx)return -2;
 
     isfs_fst* fst = _isfs_find_fst(ctx, path, NULL);
-    ISFS_debug("fst found: %p\n", fst);
+    LOG_DEBUG("fst found: %p\n", fst);
     if(!fst) return -3;
 
     if(!_isfs_fst_is_file(fst)) return -4;
@@ -874,6 +1286,25 @@ int isfs_read(isfs_file* file, void* buffer, size_t size, size_t* bytes_read)
         size_t copy = CLUSTER_SIZE - pos;
         if(copy > size) copy = size;
 
+        // whole clusters into an aligned buffer skip the bounce buffer,
+        // and physically contiguous ones go down in a single request
+        if(!pos && size >= CLUSTER_SIZE && !((u32)buffer & (NAND_DATA_ALIGN - 1))) {
+            u16* fat = _isfs_get_fat(ctx);
+            u32 count = 1;
+            while((count + 1) * CLUSTER_SIZE <= size && fat[file->cluster + count - 1] == file->cluster + count)
+                count++;
+
+            if (isfs_read_volume(ctx, file->cluster, count, ISFSVOL_FLAG_ENCRYPTED, NULL, buffer) < 0)
+                return -4;
+
+            copy = count * CLUSTER_SIZE;
+            file->offset += copy;
+            buffer += copy;
+            size -= copy;
+            file->cluster = fat[file->cluster + count - 1];
+            continue;
+        }
+
         if (isfs_read_volume(ctx, file->cluster, 1, ISFSVOL_FLAG_ENCRYPTED, NULL, slc_cluster_buf) < 0)
             return -4;
         memcpy(buffer, slc_cluster_buf + pos, copy);
@@ -1021,6 +1452,8 @@ int isfs_unmount(int volume){
     RemoveDevice(ctx->name);
     ctx->mounted = false;
     ctx->isfshax = false;
+    ctx->batch = 0;
+    ctx->dirty = false;
 
     return 0;
 }
@@ -1051,6 +1484,9 @@ static void _isfsdev_fst_to_stat(const isfs_fst* fst, struct stat* st)
 
     st->st_mode = _isfs_fst_is_dir(fst) ? S_IFDIR : 0;
     st->st_size = fst->size;
+    st->st_blksize = CLUSTER_SIZE;
+    // the start cluster, lets batches read in on-flash order
+    st->st_ino = _isfs_fst_is_file(fst) ? fst->sub : 0;
 
     st->st_nlink = 1;
     st->st_rdev = st->st_dev;
@@ -1073,6 +1509,19 @@ static int _isfsdev_stat_r(struct _reent* r, const char* file, struct stat* st)
     return 0;
 }
 
+static int _isfsdev_fstat_r(struct _reent* r, void* fd, struct stat* st)
+{
+    isfs_file* fp = (isfs_file*) fd;
+    if(!fp->fst) {
+        r->_errno = EBADF;
+        return -1;
+    }
+
+    _isfsdev_fst_to_stat(fp->fst, st);
+
+    return 0;
+}
+
 static ssize_t _isfsdev_read_r(struct _reent* r, void* fd, char* ptr, size_t len)
 {
     isfs_file* fp = (isfs_file*) fd;
@@ -1201,6 +1650,34 @@ static int _isfsdev_unlink_r(struct _reent* r, const char* path){
     }
     return 0;
 }
+
+static int _isfsdev_rename_r(struct _reent* r, const char* from, const char* to){
+    int res = isfs_rename(from, to);
+    if(res) {
+        r->_errno = -res;
+        return -1;
+    }
+    return 0;
+}
+
+static int _isfsdev_rmdir_r(struct _reent* r, const char* path){
+    int res = isfs_rmdir(path);
+    if(res) {
+        r->_errno = -res;
+        return -1;
+    }
+    return 0;
+}
+
+// new directories take the owner and permissions of their parent
+static int _isfsdev_mkdir_r(struct _reent* r, const char* path, int mode){
+    int res = isfs_mkdir(path, NULL);
+    if(res) {
+        r->_errno = -res;
+        return -1;
+    }
+    return 0;
+}
 #endif
 
 int _isfsdev_init(isfs_ctx* ctx)
@@ -1218,13 +1695,9 @@ int _isfsdev_init(isfs_ctx* ctx)
     dotab->chdir_r = _isfsdev_stub_r;
     dotab->chmod_r = _isfsdev_stub_r;
     dotab->fchmod_r = _isfsdev_stub_r;
-    dotab->fstat_r = _isfsdev_stub_r;
     dotab->fsync_r = _isfsdev_stub_r;
     dotab->ftruncate_r = _isfsdev_stub_r;
     dotab->link_r = _isfsdev_stub_r;
-    dotab->mkdir_r = _isfsdev_stub_r;
-    dotab->rename_r = _isfsdev_stub_r;
-    dotab->rmdir_r = _isfsdev_stub_r;
     dotab->statvfs_r = _isfsdev_stub_r;
     dotab->write_r = _isfsdev_stub_r;
 
@@ -1233,14 +1706,21 @@ int _isfsdev_init(isfs_ctx* ctx)
     dotab->read_r = _isfsdev_read_r;
     dotab->seek_r = _isfsdev_seek_r;
     dotab->stat_r = _isfsdev_stat_r;
+    dotab->fstat_r = _isfsdev_fstat_r;
     dotab->dirclose_r = _isfsdev_dirclose_r;
     dotab->diropen_r = _isfsdev_diropen_r;
     dotab->dirnext_r = _isfsdev_dirnext_r;
     dotab->dirreset_r = _isfsdev_dirreset_r;
 #ifdef NAND_WRITE_ENABLED
     dotab->unlink_r = _isfsdev_unlink_r;
+    dotab->rmdir_r = _isfsdev_rmdir_r;
+    dotab->rename_r = _isfsdev_rename_r;
+    dotab->mkdir_r = _isfsdev_mkdir_r;
 #else
     dotab->unlink_r = _isfsdev_stub_r;
+    dotab->rmdir_r = _isfsdev_stub_r;
+    dotab->rename_r = _isfsdev_stub_r;
+    dotab->mkdir_r = _isfsdev_stub_r;
 #endif
 
     AddDevice(dotab);
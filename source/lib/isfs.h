@@ -26,6 +26,7 @@
 #define ISFSVOL_FLAG_HMAC       1
 #define ISFSVOL_FLAG_ENCRYPTED  2
 #define ISFSVOL_FLAG_READBACK   4
+#define ISFSVOL_FLAG_HMAC_DATA  8 // one hmac per cluster, iblk of the seed counts up
 
 #define ISFSVOL_OK              0
 #define ISFSVOL_ECC_CORRECTED   0x10
@@ -71,6 +72,8 @@ typedef struct {
     u32 version;
     bool mounted;
     bool isfshax;
+    int batch;
+    bool dirty;
     u8 isfshax_slots[ISFSHAX_REDUNDANCY];
     u32 aes[0x10/sizeof(u32)];
     u8 hmac[0x14];
@@ -123,6 +126,7 @@ int isfs_load_keys(isfs_ctx* ctx);
 
 void isfs_print_fst(isfs_fst* fst);
 isfs_fst* isfs_stat(const char* path);
+int isfs_get_generation(const char* path, u32* generation);
 
 int isfs_open(isfs_file* file, const char* path);
 int isfs_close(isfs_file* file);
@@ -141,6 +145,13 @@ int isfs_write_volume(const isfs_ctx* ctx, u32 start_cluster, u32 cluster_count,
 int isfs_write_super(isfs_ctx *ctx, void *super, int index);
 int isfs_commit_super(isfs_ctx* ctx);
 int isfs_super_mark_slot(isfs_ctx *ctx, u32 index, u16 marker);
+int isfs_unlink(const char* path);
+int isfs_rmdir(const char* path);
+int isfs_rename(const char* from, const char* to);
+int isfs_mkdir(const char* path, const isfs_fst* meta);
+int isfs_write_file(const char* path, const isfs_fst* meta, const void* data, u32 size);
+int isfs_batch_begin(const char* path);
+int isfs_batch_end(const char* path);
 #endif
 
 u16* _isfs_get_fat(isfs_ctx* ctx);
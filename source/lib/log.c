@@ -0,0 +1,80 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "log.h"
+#include "irq.h"
+
+#include <errno.h>
+
+// LT_TIMER ticks per second
+#define TRACE_TICKS_S   1898000
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 ticks_s;
+    u32 count;
+    u32 lost;   // events overwritten before the dump
+    u32 entry_size;
+} trace_hdr;
+
+static trace_entry trace_ring[TRACE_ENTRIES];
+static u32 trace_next = 0;
+
+// start comes from trace_clock() when the operation began
+void trace_event(u16 event, u16 status, u32 a, u32 b, u32 start)
+{
+    u32 now = read32(LT_TIMER);
+
+    // drivers trace from interrupt handlers too
+    u32 cookie = irq_kill();
+    trace_entry *e = &trace_ring[trace_next++ % TRACE_ENTRIES];
+    irq_restore(cookie);
+
+    e->start = start;
+    e->ticks = now - start;
+    e->event = event;
+    e->status = status;
+    e->a = a;
+    e->b = b;
+}
+
+// writes the ring oldest first, tracedecode.py turns it into text
+int trace_dump(const char* path)
+{
+    u32 cookie = irq_kill();
+    u32 next = trace_next;
+    irq_restore(cookie);
+
+    u32 count = next < TRACE_ENTRIES ? next : TRACE_ENTRIES;
+    trace_hdr hdr = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .ticks_s = TRACE_TICKS_S,
+        .count = count,
+        .lost = next - count,
+        .entry_size = sizeof(trace_entry),
+    };
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (u32 i = next - count; ok && i != next; i++)
+        ok = fwrite(&trace_ring[i % TRACE_ENTRIES], sizeof(trace_entry), 1, f) == 1;
+
+    if (fclose(f) || !ok) {
+        if (!errno)
+            errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include "types.h"
+#include "latte.h"
+#include "utils.h"
+
+#include <stdio.h>
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+// Per subsystem levels, override with e.g. -DLOG_LEVEL_ISFS=LOG_LEVEL_DEBUG.
+// The BSD drivers' DPRINTF(n, ...) counts up from LOG_LEVEL_DEBUG, so
+// LOG_LEVEL_DEBUG + 3 shows everything they print.
+#ifndef LOG_LEVEL_ISFS
+#define LOG_LEVEL_ISFS      LOG_LEVEL_WARN
+#endif
+#ifndef LOG_LEVEL_NAND
+#define LOG_LEVEL_NAND      LOG_LEVEL_ERROR
+#endif
+#ifndef LOG_LEVEL_SDHC
+#define LOG_LEVEL_SDHC      LOG_LEVEL_ERROR
+#endif
+#ifndef LOG_LEVEL_SDCARD
+#define LOG_LEVEL_SDCARD    LOG_LEVEL_ERROR
+#endif
+#ifndef LOG_LEVEL_MLC
+#define LOG_LEVEL_MLC       LOG_LEVEL_ERROR
+#endif
+
+// a source file picks its subsystem before including this header
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO
+#endif
+#ifndef LOG_PREFIX
+#define LOG_PREFIX          ""
+#endif
+
+// The level is a constant, so a disabled call compiles to nothing while its
+// arguments still get type checked.
+#define LOG(level, f, arg...) do { if ((level) <= LOG_LEVEL) printf(LOG_PREFIX f, ##arg); } while (0)
+#define LOG_ERROR(f, arg...)  LOG(LOG_LEVEL_ERROR, f, ##arg)
+#define LOG_WARN(f, arg...)   LOG(LOG_LEVEL_WARN, f, ##arg)
+#define LOG_INFO(f, arg...)   LOG(LOG_LEVEL_INFO, f, ##arg)
+#define LOG_DEBUG(f, arg...)  LOG(LOG_LEVEL_DEBUG, f, ##arg)
+#define DPRINTF(n, s)         do { if (LOG_LEVEL_DEBUG + (n) <= LOG_LEVEL) printf s; } while (0)
+
+// Hot path events go to a binary ring instead of being formatted. Keep the
+// numbers in sync with tracedecode.py.
+enum {
+    TRACE_NAND_READ = 1,    // a: page, status: error
+    TRACE_NAND_WRITE,       // a: page, status: error
+    TRACE_NAND_ERASE,       // a: page, status: error
+    TRACE_AES_DECRYPT,      // a: blocks
+    TRACE_AES_ENCRYPT,      // a: blocks
+    TRACE_SDHC_CMD,         // a: host << 8 | opcode, b: data length, status: error
+};
+
+#ifndef LOG_TRACE
+#define LOG_TRACE           1
+#endif
+
+#define TRACE_ENTRIES       2048
+#define TRACE_MAGIC         0x54524345 // TRCE
+#define TRACE_VERSION       1
+
+typedef struct {
+    u32 start;  // LT_TIMER
+    u32 ticks;
+    u16 event;
+    u16 status;
+    u32 a;
+    u32 b;
+} trace_entry;
+
+void trace_event(u16 event, u16 status, u32 a, u32 b, u32 start);
+int trace_dump(const char* path);
+
+static inline u32 trace_clock(void)
+{
+    return LOG_TRACE ? read32(LT_TIMER) : 0;
+}
+
+#define TRACE(event, status, a, b, start) do { if (LOG_TRACE) trace_event(event, status, a, b, start); } while (0)
+
+#endif
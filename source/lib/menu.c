@@ -57,7 +57,7 @@ void menu_init(menu* new_menu)
     {
         menu_show();
 
-        int console_input = console_select_poll();
+        int console_input = console_select_wait();
         int do_select = 0;
 
         if ((console_input & CONSOLE_KEY_UP) || (console_input & CONSOLE_KEY_W)) {
@@ -147,8 +147,7 @@ void menu_show()
 
     // Update cursor.
     for(i = 0; i < __menu->entries; i++) {
-        gfx_draw_string(GFX_DRC, i == __menu->selected ? ">" : " ", x + CHAR_WIDTH, (i+3+__menu->subtitles) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
-        gfx_draw_string(GFX_TV, i == __menu->selected ? ">" : " ", x + CHAR_WIDTH, (i+3+__menu->subtitles) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
+        gfx_draw_string(GFX_ALL, i == __menu->selected ? ">" : " ", x + CHAR_WIDTH, (i+3+__menu->subtitles) * CHAR_WIDTH + y + CHAR_WIDTH * 2, GREEN);
     }
     if (/*gfx_is_currently_headless() && */!__menu->selected_showed) 
     {
@@ -24,6 +24,7 @@ struct {
     {"mcp", mcp_ini},
     {"boot", boot_ini},
     {"clocks", clocks_ini},
+    {"copy", copy_ini},
 
     {NULL, NULL}
 };
@@ -25,5 +25,6 @@ int minini_init(void);
 
 int mcp_ini();
 int boot_ini();
+int copy_ini();
 
 #endif
@@ -24,15 +24,10 @@
 #include "irq.h"
 #endif
 
-// #define MLC_DEBUG
 #define MLC_SUPPORT_WRITE
 
-#ifdef MLC_DEBUG
-static int mlcdebug = 3;
-#define DPRINTF(n,s)    do { if ((n) <= mlcdebug) printf s; } while (0)
-#else
-#define DPRINTF(n,s)    do {} while(0)
-#endif
+#define LOG_LEVEL LOG_LEVEL_MLC
+#include "log.h"
 
 static struct sdhc_host mlc_host;
 static bool initialized = false;
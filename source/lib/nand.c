@@ -22,15 +22,12 @@
 #include "gfx.h"
 #include "types.h"
 
-//#define NAND_DEBUG  1
 #define NAND_SUPPORT_WRITE 1
 #define NAND_SUPPORT_ERASE 1
 
-#ifdef NAND_DEBUG
-#   define  NAND_debug(f, arg...) printf("NAND: " f, ##arg);
-#else
-#   define  NAND_debug(f, arg...)
-#endif
+#define LOG_LEVEL LOG_LEVEL_NAND
+#define LOG_PREFIX "NAND: "
+#include "log.h"
 
 #define NAND_RESET      0xff
 #define NAND_CHIPID     0x90
@@ -84,9 +81,9 @@ void nand_irq(void)
 }
 
 static void __nand_wait(void) {
-    NAND_debug("waiting...\n");
+    LOG_DEBUG("waiting...\n");
     while(read32(NAND_CTRL) & NAND_BUSY_MASK);
-    NAND_debug("wait done\n");
+    LOG_DEBUG("wait done\n");
     if(read32(NAND_CTRL) & NAND_ERROR)
         printf("NAND: Error on wait\n");
     ahb_flush_from(WB_FLA);
@@ -96,7 +93,7 @@ static void __nand_wait(void) {
 void nand_send_command(u32 command, u32 bitmask, u32 flags, u32 num_bytes) {
     u32 cmd = NAND_BUSY_MASK | (bitmask << 24) | (command << 16) | flags | num_bytes;
 
-    NAND_debug("nand_send_command(%x, %x, %x, %x) -> %x\n",
+    LOG_DEBUG("nand_send_command(%x, %x, %x, %x) -> %x\n",
         command, bitmask, flags, num_bytes, cmd);
 
     write32(NAND_CTRL, 0x7fffffff);
@@ -126,7 +123,7 @@ void __nand_setup_dma(u8 *data, u8 *spare) {
 }
 
 int nand_reset(u32 bank) {
-    NAND_debug("nand_reset()\n");
+    LOG_DEBUG("nand_reset()\n");
 
     write32(NAND_CTRL, 0);
     while(read32(NAND_CTRL) & NAND_CMD_EXEC);
@@ -217,6 +214,7 @@ void nand_wait(void) {
 }
 
 int nand_read_page(u32 pageno, void *data, void *ecc) {
+    u32 start = trace_clock();
     irq_flag = 0;
     last_page_read = pageno;  // needed for error reporting
     __nand_set_address(0, pageno);
@@ -233,15 +231,16 @@ int nand_read_page(u32 pageno, void *data, void *ecc) {
     ahb_flush_from(WB_FLA);
     dc_invalidaterange(data, PAGE_SIZE);
     dc_invalidaterange(ecc, ECC_BUFFER_ALLOC);
-    if (read32(NAND_CTRL) & NAND_ERROR)
-        return -1;
-    return 0;
+    int error = (read32(NAND_CTRL) & NAND_ERROR) != 0;
+    TRACE(TRACE_NAND_READ, error, pageno, 0, start);
+    return error ? -1 : 0;
 }
 
 #ifdef NAND_SUPPORT_WRITE
 int nand_write_page_raw(u32 pageno, void *data, void *ecc) {
+    u32 start = trace_clock();
     irq_flag = 0;
-    NAND_debug("nand_write_page_raw(%u, %p, %p)\n", pageno, data, ecc);
+    LOG_DEBUG("nand_write_page_raw(%u, %p, %p)\n", pageno, data, ecc);
 
 #if 0
     // this is a safety check to prevent you from accidentally wiping out boot1 or boot2.
@@ -258,16 +257,19 @@ int nand_write_page_raw(u32 pageno, void *data, void *ecc) {
     nand_send_command(NAND_WRITE_PRE, 0x1f, NAND_FLAGS_WR, 0x840);
     __nand_wait();
     nand_send_command(NAND_WRITE_POST, 0, NAND_FLAGS_IRQ | NAND_FLAGS_WAIT, 0);
-    if(nand_check_error()){
-        NAND_debug("nand_write_page(%d) failed\n", pageno);
+    int error = nand_check_error();
+    TRACE(TRACE_NAND_WRITE, error != 0, pageno, 0, start);
+    if(error){
+        LOG_WARN("nand_write_page(%d) failed\n", pageno);
         return -1;
     }
     return 0;
 }
 
 int nand_write_page(u32 pageno, void *data, void *spare) {
+    u32 start = trace_clock();
     irq_flag = 0;
-    NAND_debug("nand_write_page(%u, %p, %p)\n", pageno, data, spare);
+    LOG_DEBUG("nand_write_page(%u, %p, %p)\n", pageno, data, spare);
 
 #if 0
     // this is a safety check to prevent you from accidentally wiping out boot1 or boot2.
@@ -317,8 +319,10 @@ int nand_write_page(u32 pageno, void *data, void *spare) {
     /* program page*/
     nand_send_command(NAND_WRITE_POST, 0, NAND_FLAGS_IRQ | NAND_FLAGS_WAIT, 0);
     nand_wait();
-    if(nand_check_error()){
-        NAND_debug("nand_write_page(%d) failed\n", pageno);
+    int error = nand_check_error();
+    TRACE(TRACE_NAND_WRITE, error != 0, pageno, 0, start);
+    if(error){
+        LOG_WARN("nand_write_page(%d) failed\n", pageno);
         return -1;
     }
     return 0;
@@ -328,8 +332,9 @@ int nand_write_page(u32 pageno, void *data, void *spare) {
 
 #ifdef NAND_SUPPORT_ERASE
 int nand_erase_block(u32 pageno) {
+    u32 start = trace_clock();
     irq_flag = 0;
-    NAND_debug("nand_erase_block(%d)\n", pageno);
+    LOG_DEBUG("nand_erase_block(%d)\n", pageno);
 
 #if 0
     // this is a safety check to prevent you from accidentally wiping out boot1 or boot2.
@@ -342,11 +347,13 @@ int nand_erase_block(u32 pageno) {
     nand_send_command(NAND_ERASE_PRE, 0x1c, 0, 0);
     __nand_wait();
     nand_send_command(NAND_ERASE_POST, 0, NAND_FLAGS_IRQ | NAND_FLAGS_WAIT, 0);
-    if(nand_check_error()){
-        NAND_debug("nand_erase_block(%d) failed\n", pageno);
+    int error = nand_check_error();
+    TRACE(TRACE_NAND_ERASE, error != 0, pageno, 0, start);
+    if(error){
+        LOG_WARN("nand_erase_block(%d) failed\n", pageno);
         return -1;
     }
-    NAND_debug("nand_erase_block(%d) done\n", pageno);
+    LOG_DEBUG("nand_erase_block(%d) done\n", pageno);
     return 0;
 }
 #endif
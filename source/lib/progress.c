@@ -0,0 +1,183 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "progress.h"
+#include "gfx.h"
+#include "latte.h"
+#include "utils.h"
+#include "sched.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// LT_TIMER ticks per millisecond
+#define PROGRESS_TICKS_MS   1898
+// four redraws a second are plenty to read and cost nothing next to a slab
+#define PROGRESS_INTERVAL   (250 * PROGRESS_TICKS_MS)
+#define PROGRESS_COLS       80
+#define PROGRESS_X          10
+#define PROGRESS_CHAR_X     8
+
+static struct {
+    bool active;
+    bool job;
+    u64 total;
+    u64 done;
+    u64 ticks;
+    u32 mark;
+    u32 last_draw;
+    u64 stage[PROGRESS_STAGES];
+
+    int y[GFX_ALL];
+    // the screen's epoch when the bar was placed, printf() moves it
+    u32 epoch[GFX_ALL];
+    // what each screen shows, only cells that differ are drawn again
+    char shown[GFX_ALL][PROGRESS_COLS + 1];
+} progress;
+
+static void _progress_clock(void)
+{
+    u32 now = read32(LT_TIMER);
+    progress.ticks += now - progress.mark;
+    progress.mark = now;
+}
+
+static u32 _progress_percent(u64 part, u64 whole)
+{
+    return whole ? (u32)(part * 100 / whole) : 0;
+}
+
+static void _progress_draw(void)
+{
+    char line[PROGRESS_COLS + 1];
+    u64 ms = progress.ticks / PROGRESS_TICKS_MS;
+    u64 kbps = ms ? progress.done * 1000 / 1024 / ms : 0;
+    u64 stages = progress.stage[PROGRESS_READ] + progress.stage[PROGRESS_HASH] + progress.stage[PROGRESS_WRITE] +
+            progress.stage[PROGRESS_ZIP];
+    u32 eta = 0;
+
+    if (kbps && progress.total > progress.done)
+        eta = (progress.total - progress.done) / 1024 / kbps;
+
+    int len = snprintf(line, sizeof(line), "%6llu/%-6llu MiB %3lu%% %4llu.%llu MiB/s ETA %3lu:%02lu  rd %2lu%% hash %2lu%% wr %2lu%% zip %2lu%%",
+            progress.done >> 20, progress.total >> 20, _progress_percent(progress.done, progress.total),
+            kbps / 1024, kbps % 1024 * 10 / 1024, eta / 60, eta % 60,
+            _progress_percent(progress.stage[PROGRESS_READ], stages),
+            _progress_percent(progress.stage[PROGRESS_HASH], stages),
+            _progress_percent(progress.stage[PROGRESS_WRITE], stages),
+            _progress_percent(progress.stage[PROGRESS_ZIP], stages));
+    if (len < 0)
+        return;
+    if (len > PROGRESS_COLS)
+        len = PROGRESS_COLS;
+    memset(line + len, ' ', PROGRESS_COLS - len);
+
+    for (int s = 0; s < GFX_ALL; s++)
+    {
+        // a job sent to the background leaves the screen to the menu
+        if (progress.y[s] < 0 || !gfx_get_printf_to_display())
+            continue;
+
+        // something printed or cleared since, the bar's line is gone
+        if (gfx_get_epoch(s) != progress.epoch[s])
+        {
+            progress_redraw();
+            return;
+        }
+
+        for (int i = 0; i < PROGRESS_COLS; i++)
+        {
+            if (progress.shown[s][i] == line[i])
+                continue;
+            gfx_draw_char(s, line[i], PROGRESS_X + i * PROGRESS_CHAR_X, progress.y[s], WHITE);
+            progress.shown[s][i] = line[i];
+        }
+    }
+
+    progress.last_draw = read32(LT_TIMER);
+}
+
+static void _progress_reset(u64 total)
+{
+    memset(progress.stage, 0, sizeof(progress.stage));
+    progress.total = total;
+    progress.done = 0;
+    progress.ticks = 0;
+    progress.mark = read32(LT_TIMER);
+}
+
+void progress_job_begin(u64 total)
+{
+    _progress_reset(total);
+    progress.job = true;
+}
+
+void progress_job_end(void)
+{
+    progress.job = false;
+}
+
+void progress_begin(u64 size)
+{
+    if (!progress.job)
+        _progress_reset(size);
+    else
+        progress.mark = read32(LT_TIMER);
+
+    progress.active = true;
+    progress_redraw();
+}
+
+void progress_end(void)
+{
+    if (!progress.active)
+        return;
+
+    _progress_clock();
+    _progress_draw();
+    progress.active = false;
+}
+
+void progress_advance(u64 bytes)
+{
+    if (!progress.active)
+        return;
+
+    progress.done += bytes;
+    sched_progress(progress.done, progress.total);
+    _progress_clock();
+    if (progress.mark - progress.last_draw >= PROGRESS_INTERVAL)
+        _progress_draw();
+}
+
+void progress_stage(int stage, u32 ticks)
+{
+    progress.stage[stage] += ticks;
+}
+
+void progress_redraw(void)
+{
+    if (!progress.active)
+        return;
+
+    // an empty line from printf keeps the bar above whatever comes next
+    printf("\n");
+    for (int s = 0; s < GFX_ALL; s++)
+    {
+        progress.y[s] = gfx_printf_line(s);
+        progress.epoch[s] = gfx_get_epoch(s);
+    }
+
+    // the time spent at the prompt isn't transfer time
+    progress.mark = read32(LT_TIMER);
+
+    // no character is drawn as \0, so every cell differs
+    memset(progress.shown, 0, sizeof(progress.shown));
+    _progress_draw();
+}
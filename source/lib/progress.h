@@ -0,0 +1,37 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include "types.h"
+
+// stages a transfer spends its time in
+enum {
+    PROGRESS_READ,
+    PROGRESS_HASH,
+    PROGRESS_WRITE,
+    PROGRESS_ZIP,
+
+    PROGRESS_STAGES,
+};
+
+// a job spans several files and keeps one bar for all of them
+void progress_job_begin(u64 total);
+void progress_job_end(void);
+
+// reserves the line below the cursor for the bar of a file
+void progress_begin(u64 size);
+void progress_end(void);
+void progress_advance(u64 bytes);
+void progress_stage(int stage, u32 ticks);
+// text was printed below the bar, draws it again under the cursor
+void progress_redraw(void);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#include "sched.h"
+#include "gfx.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+// The frame sched_switch() pops to start a job: the callee-saved registers,
+// then the return address, which enters sched_entry(). Host tests switch
+// with host/sched_switch.S, and x86-64 wants the entry stack 8 bytes off a
+// 16 byte boundary, as if sched_entry() had been called.
+#ifdef __x86_64__
+#define SCHED_FRAME_WORDS   (7) // rbp, rbx, r12-r15, return address
+#define SCHED_FRAME_SLACK   (1)
+#else
+#define SCHED_FRAME_WORDS   (9) // r4-r11, lr
+#define SCHED_FRAME_SLACK   (0)
+#endif
+
+void sched_switch(uintptr_t *save_sp, uintptr_t sp);
+
+static job *jobs = NULL;
+static job *current = NULL;
+static uintptr_t sched_sp;
+static volatile u32 sched_ticks = 0;
+static u32 slice_start;
+
+void sched_alarm(void)
+{
+    sched_ticks++;
+}
+
+static void sched_entry(void)
+{
+    job *j = current;
+
+    j->result = j->fn(j->arg);
+    if (j->cancel && j->result < 0)
+        j->state = JOB_CANCELLED;
+    else if (j->result < 0)
+        j->state = JOB_FAILED;
+    else
+        j->state = JOB_DONE;
+    j->error = j->result < 0 ? errno : 0;
+
+    // the scheduler frees the stack, this never comes back
+    sched_switch(&j->sp, sched_sp);
+}
+
+job *job_start(const char *name, int (*fn)(void *arg), void *arg)
+{
+    job *j = calloc(1, sizeof(job));
+    if (!j)
+        return NULL;
+
+    j->stack = memalign(16, JOB_STACK_SIZE);
+    if (!j->stack)
+    {
+        free(j);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    snprintf(j->name, sizeof(j->name), "%s", name);
+    j->fn = fn;
+    j->arg = arg;
+    j->state = JOB_QUEUED;
+
+    uintptr_t *frame = (uintptr_t *)((u8 *)j->stack + JOB_STACK_SIZE) - SCHED_FRAME_WORDS - SCHED_FRAME_SLACK;
+    memset(frame, 0, (SCHED_FRAME_WORDS - 1) * sizeof(uintptr_t));
+    frame[SCHED_FRAME_WORDS - 1] = (uintptr_t)sched_entry;
+    j->sp = (uintptr_t)frame;
+
+    job **tail = &jobs;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = j;
+
+    return j;
+}
+
+void job_yield(void)
+{
+    if (!current || sched_ticks - slice_start < JOB_SLICE)
+        return;
+
+    sched_switch(&current->sp, sched_sp);
+}
+
+job *job_current(void)
+{
+    return current;
+}
+
+bool job_cancelled(void)
+{
+    return current && current->cancel;
+}
+
+bool job_in_background(void)
+{
+    return current && current->background;
+}
+
+void job_detach(job *j)
+{
+    j->background = true;
+    if (j == current)
+        gfx_printf_to_display(false);
+}
+
+void job_cancel(job *j)
+{
+    j->cancel = true;
+}
+
+bool job_finished(job *j)
+{
+    return j->state >= JOB_DONE;
+}
+
+job *job_first(void)
+{
+    return jobs;
+}
+
+// forgets a finished job
+void job_reap(job *j)
+{
+    if (!job_finished(j))
+        return;
+
+    for (job **p = &jobs; *p; p = &(*p)->next)
+    {
+        if (*p == j)
+        {
+            *p = j->next;
+            break;
+        }
+    }
+
+    free(j->stack);
+    free(j);
+}
+
+int sched_run(void)
+{
+    job *j = jobs;
+    int left = 0;
+
+    // jobs don't run other jobs
+    if (current)
+        return 1;
+
+    while (j && job_finished(j))
+        j = j->next;
+    if (!j)
+        return 0;
+
+    bool display = gfx_get_printf_to_display();
+    if (j->background)
+        gfx_printf_to_display(false);
+
+    // errno is global, each side keeps its own
+    int error = errno;
+    errno = j->error;
+
+    j->state = JOB_RUNNING;
+    current = j;
+    slice_start = sched_ticks;
+    sched_switch(&sched_sp, j->sp);
+    current = NULL;
+
+    if (!job_finished(j))
+        j->error = errno;
+    errno = error;
+    gfx_printf_to_display(display);
+
+    if (job_finished(j))
+    {
+        free(j->stack);
+        j->stack = NULL;
+    }
+
+    for (j = jobs; j; j = j->next)
+        left += !job_finished(j);
+
+    return left;
+}
+
+void sched_progress(u64 done, u64 total)
+{
+    if (!current)
+        return;
+
+    current->done = done;
+    current->total = total;
+}
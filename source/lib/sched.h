@@ -0,0 +1,67 @@
+/*
+ *  minute - a port of the "mini" IOS replacement for the Wii U.
+ *
+ *  Copyright (C) 2016          SALT
+ *
+ *  This code is licensed to you under the terms of the GNU GPL, version 2;
+ *  see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+ */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+
+// Jobs run on their own stacks and hand the CPU back in job_yield(). They
+// run one at a time in the order they were started, since they share the
+// copy engine's progress and journal, and the UI runs them between inputs.
+#define JOB_STACK_SIZE  (0x20000)
+#define JOB_NAME_LEN    (96)
+// alarm ticks a job keeps the CPU before job_yield() lets the UI run
+#define JOB_SLICE       (20)
+
+enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED,
+};
+
+typedef struct job job;
+struct job {
+    job *next;
+    char name[JOB_NAME_LEN];
+    int (*fn)(void *arg);
+    void *arg;
+
+    int state;
+    int result;
+    int error;          // errno of a failed job
+    bool background;    // its output doesn't go to the screen
+    bool cancel;
+    u64 done;           // bytes, as the progress bar counts them
+    u64 total;
+
+    uintptr_t sp;
+    void *stack;
+};
+
+// fn owns arg, a negative result marks the job failed
+job *job_start(const char *name, int (*fn)(void *arg), void *arg);
+void job_yield(void);
+job *job_current(void);
+bool job_cancelled(void);
+bool job_in_background(void);
+void job_detach(job *j);
+void job_cancel(job *j);
+bool job_finished(job *j);
+job *job_first(void);
+void job_reap(job *j);
+
+// runs the oldest unfinished job for a slice, returns how many are left
+int sched_run(void);
+void sched_alarm(void);
+void sched_progress(u64 done, u64 total);
+
+#endif
@@ -27,14 +27,18 @@
 #endif
 
 extern bool elm_mounted;
-//#define SDCARD_DEBUG
 
-#ifdef SDCARD_DEBUG
-static int sdcarddebug = 2;
-#define DPRINTF(n,s)    do { if ((n) <= sdcarddebug) printf s; } while (0)
-#else
-#define DPRINTF(n,s)    do {} while(0)
-#endif
+#define LOG_LEVEL LOG_LEVEL_SDCARD
+#include "log.h"
+
+// failed commands are retried this many times, waiting twice as long each time
+#define SDCARD_RETRIES          2
+#define SDCARD_RETRY_DELAY      1000
+// erasing a large range can keep the card busy for a long time
+#define SDCARD_ERASE_TIMEOUT    60000
+// good transfers before a degraded card tries the faster mode again
+#define SDCARD_REPROBE_MIN      256
+#define SDCARD_REPROBE_MAX      65536
 
 static struct sdhc_host sdcard_host;
 
@@ -46,22 +50,43 @@ struct sdcard_ctx {
     int new_card; // set to 1 everytime a new card is inserted
     int multiple_fallback;
 
+    u32 reprobe_in;
+    u32 reprobe_backoff;
+    int reprobe_mode; // mode on trial since the last re-probe, or -1
+
     u32 num_sectors;
     u16 rca;
+    u16 ccc;
 };
 
 static struct sdcard_ctx card;
+static struct sdcard_stats stats;
+
+// a write left running by sdcard_write_behind(), see sdcard_sync()
+static struct {
+    struct sdmmc_command cmd;
+    void *data;
+    u32 blk_start;
+    u32 blk_count;
+} behind;
 
 void sdcard_attach(sdmmc_chipset_handle_t handle)
 {
+    // a write or an erase left for later was meant for the card that was
+    // in the slot, unmounting must not send it to this one
+    behind.data = NULL;
 #ifndef MINUTE_BOOT1
+    disk_trim_drop();
     //bool should_remount = elm_mounted;
     ELM_Unmount();
 #endif
 
     memset(&card, 0, sizeof(card));
+    memset(&stats, 0, sizeof(stats));
 
     card.handle = handle;
+    card.reprobe_backoff = SDCARD_REPROBE_MIN;
+    card.reprobe_mode = -1;
 
     DPRINTF(0, ("sdcard: attached new SD/MMC card\n"));
 
@@ -331,6 +356,7 @@ void sdcard_needs_discover(void)
 
     u16 ccc = SD_CSD_CCC(csd_bytes);
     printf("CCC (hex): %03X\n", ccc);
+    card.ccc = ccc;
 
     if(!(ccc & SD_CSD_CCC_CMD6)){
         printf("sdcard: CMD6 not supported, stay in SDR12");
@@ -480,8 +506,133 @@ int sdcard_ack_card(void)
     return -1;
 }
 
+static int sdcard_xfer_mode(u32 blk_count, void *data)
+{
+    if (sdcard_host.no_dma || !can_sdcard_dma_addr(data))
+        return SDCARD_MODE_PIO;
+    return blk_count > 1 ? SDCARD_MODE_MULTI : SDCARD_MODE_SINGLE;
+}
+
+// Run `cmd', retrying failures with a growing delay before giving up on the mode.
+static void sdcard_exec_retry(struct sdmmc_command *cmd, int mode)
+{
+    struct sdmmc_command orig = *cmd;
+
+    for (int i = 0; ; i++) {
+        sdhc_exec_command(card.handle, cmd);
+        if (!cmd->c_error) {
+            stats.mode[mode].ok++;
+            break;
+        }
+
+        stats.mode[mode].errors++;
+        if (i == SDCARD_RETRIES)
+            break;
+
+        printf("sdcard: command %d failed with %d, retrying\n", cmd->c_opcode, cmd->c_error);
+        stats.mode[mode].retries++;
+        udelay(SDCARD_RETRY_DELAY << i);
+        *cmd = orig;
+    }
+}
+
+// Step down to the next slower mode. Returns 0 when there is nothing left.
+static int sdcard_degrade(u32 blk_count)
+{
+    if (blk_count > 1 && !card.multiple_fallback) {
+        printf("sdcard: trying only single blocks?\n");
+        card.multiple_fallback = 1;
+    }
+    else if (blk_count <= 1 && !sdcard_host.no_dma) {
+        printf("sdcard: trying without DMA?\n");
+        sdcard_host.no_dma = 1;
+    }
+    else {
+        return 0;
+    }
+
+    // a re-probe that failed again waits twice as long next time
+    if (card.reprobe_mode >= 0) {
+        card.reprobe_backoff = min(card.reprobe_backoff * 2, SDCARD_REPROBE_MAX);
+        card.reprobe_mode = -1;
+    }
+
+    card.reprobe_in = card.reprobe_backoff;
+    stats.fallbacks++;
+    return 1;
+}
+
+// Count a good transfer, and give the faster mode another go once enough went by.
+static void sdcard_recover(int mode)
+{
+    if (card.reprobe_mode == mode) {
+        card.reprobe_backoff = SDCARD_REPROBE_MIN;
+        card.reprobe_mode = -1;
+    }
+
+    if (!card.multiple_fallback && !sdcard_host.no_dma)
+        return;
+    if (card.reprobe_in && --card.reprobe_in)
+        return;
+
+    // the card misbehaved since the erase was queued, don't send it
+#ifndef MINUTE_BOOT1
+    disk_trim_drop();
+#endif
+
+    if (sdcard_host.no_dma) {
+        printf("sdcard: re-probing DMA\n");
+        sdcard_host.no_dma = 0;
+        card.reprobe_mode = SDCARD_MODE_SINGLE;
+    }
+    else {
+        printf("sdcard: re-probing multi-block transfers\n");
+        card.multiple_fallback = 0;
+        card.reprobe_mode = SDCARD_MODE_MULTI;
+    }
+
+    card.reprobe_in = card.reprobe_backoff;
+    stats.reprobes++;
+}
+
+void sdcard_get_stats(struct sdcard_stats *out)
+{
+    memcpy(out, &stats, sizeof(stats));
+    out->reprobe_in = card.reprobe_in;
+    out->multiple_fallback = card.multiple_fallback;
+    out->no_dma = sdcard_host.no_dma;
+}
+
+// Finish the write sdcard_write_behind() left running. The data is still in
+// place, so a failed write is tried again the slow way, with retries and
+// fallbacks; if that fails too, whoever waits gets the error.
+int sdcard_sync(void)
+{
+#ifndef LOADER
+    void *data = behind.data;
+
+    if (!data)
+        return 0;
+
+    behind.data = NULL;
+    if (sdcard_end_write(&behind.cmd) == 0) {
+        stats.mode[SDCARD_MODE_MULTI].ok++;
+        sdcard_recover(SDCARD_MODE_MULTI);
+        return 0;
+    }
+
+    stats.mode[SDCARD_MODE_MULTI].errors++;
+    return sdcard_write(behind.blk_start, behind.blk_count, data);
+#else
+    return 0;
+#endif
+}
+
 int sdcard_start_read(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf)
 {
+    if (sdcard_sync())
+        return -1;
+
 //  printf("%s(%u, %u, %p)\n", __FUNCTION__, blk_start, blk_count, data);
     if (card.inserted == 0) {
         printf("sdcard: READ: no card inserted.\n");
@@ -571,6 +722,10 @@ int sdcard_end_read(struct sdmmc_command* cmdbuf)
 int sdcard_read(u32 blk_start, u32 blk_count, void *data)
 {
     struct sdmmc_command cmd;
+    int mode;
+
+    if (sdcard_sync())
+        return -1;
 
 retry_single:
     // TODO: wtf is this bug
@@ -606,7 +761,7 @@ retry_single:
     }
 
     while(blk_count){
-        u32 cmd_blk_count = min(blk_count, SDHC_BLOCK_COUNT_MAX);
+        u32 cmd_blk_count = min(blk_count, sdhc_max_block_count(card.handle));
         memset(&cmd, 0, sizeof(cmd));
 
         if(blk_count > 1) {
@@ -624,20 +779,13 @@ retry_single:
         cmd.c_datalen = cmd_blk_count * SDMMC_DEFAULT_BLOCKLEN;
         cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
         cmd.c_flags = SCF_RSP_R1 | SCF_CMD_READ;
-        sdhc_exec_command(card.handle, &cmd);
+        mode = sdcard_xfer_mode(cmd_blk_count, data);
+        sdcard_exec_retry(&cmd, mode);
 
         if (cmd.c_error) {
             printf("sdcard: MMC_READ_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmd.c_error);
-            if (blk_count > 1 && !card.multiple_fallback) {
-                printf("sdcard: trying only single blocks?\n");
-                card.multiple_fallback = 1;
-                goto retry_single; 
-            }
-            else if (blk_count <= 1 && !sdcard_host.no_dma) {
-                printf("sdcard: trying without DMA?\n");
-                sdcard_host.no_dma = 1;
+            if (sdcard_degrade(blk_count))
                 goto retry_single;
-            }
             return -1;
         } 
     #ifndef MINUTE_BOOT1 //on boot1 we get somehow ILLEGAL COMMAND (bit 22)
@@ -651,6 +799,7 @@ retry_single:
             DPRINTF(2, ("sdcard: MMC_READ_BLOCK_MULTIPLE done\n"));
         else
             DPRINTF(2, ("sdcard: MMC_READ_BLOCK_SINGLE done\n"));
+        sdcard_recover(mode);
 
         blk_count -= cmd_blk_count;
         blk_start += cmd_blk_count;
@@ -663,6 +812,9 @@ retry_single:
 #ifndef LOADER
 int sdcard_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf)
 {
+    if (sdcard_sync())
+        return -1;
+
     if (card.inserted == 0) {
         printf("sdcard: WRITE: no card inserted.\n");
         return -1;
@@ -750,11 +902,12 @@ int sdcard_end_write(struct sdmmc_command* cmdbuf)
 int sdcard_write(u32 blk_start, u32 blk_count, void *data)
 {
     struct sdmmc_command cmd;
+    int mode;
 
-    if (sdcard_host.no_dma) {
-        panic(0);
-    }
+    if (sdcard_sync())
+        return -1;
 
+    // a degraded card writes by PIO until the re-probe countdown, like reads
 retry_single:
     // TODO: wtf is this bug
     if ((!can_sdcard_dma_addr(data) || card.multiple_fallback) && blk_count > 1) { // !can_sdcard_dma_addr(data) && 
@@ -786,7 +939,7 @@ retry_single:
     }
 
     while(blk_count){
-        u32 cmd_blk_count = min(blk_count, SDHC_BLOCK_COUNT_MAX);
+        u32 cmd_blk_count = min(blk_count, sdhc_max_block_count(card.handle));
         memset(&cmd, 0, sizeof(cmd));
 
         if(blk_count > 1) {
@@ -804,20 +957,13 @@ retry_single:
         cmd.c_datalen = cmd_blk_count * SDMMC_DEFAULT_BLOCKLEN;
         cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
         cmd.c_flags = SCF_RSP_R1;
-        sdhc_exec_command(card.handle, &cmd);
+        mode = sdcard_xfer_mode(cmd_blk_count, data);
+        sdcard_exec_retry(&cmd, mode);
 
         if (cmd.c_error) {
             printf("sdcard: MMC_WRITE_BLOCK_%s failed with %d\n", blk_count > 1 ? "MULTIPLE" : "SINGLE", cmd.c_error);
-            if (blk_count > 1 && !card.multiple_fallback) {
-                printf("sdcard: trying only single blocks?\n");
-                card.multiple_fallback = 1;
-                goto retry_single; 
-            }
-            else if (blk_count <= 1 && !sdcard_host.no_dma) {
-                printf("sdcard: trying without DMA?\n");
-                sdcard_host.no_dma = 1;
+            if (sdcard_degrade(blk_count))
                 goto retry_single;
-            }
             return -1;
         } else if(MMC_R1(cmd.c_resp) & MMC_R1_ANY_ERROR){
             printf("sdcard: write reported error. status: %08lx\n", MMC_R1(cmd.c_resp));
@@ -827,6 +973,7 @@ retry_single:
             DPRINTF(2, ("sdcard: MMC_WRITE_BLOCK_MULTIPLE done\n"));
         else
             DPRINTF(2, ("sdcard: MMC_WRITE_BLOCK_SINGLE done\n"));
+        sdcard_recover(mode);
 
         blk_count -= cmd_blk_count;
         blk_start += cmd_blk_count;
@@ -836,10 +983,212 @@ retry_single:
     return 0;
 }
 
+// Writes like sdcard_write(), but leaves the last command running on the
+// card: the CPU is free until the next call into the driver or sdcard_sync(),
+// and `data' must stay untouched until then. Degraded cards, and buffers the
+// DMA can't reach, write synchronously.
+int sdcard_write_behind(u32 blk_start, u32 blk_count, void *data)
+{
+    u32 max = sdhc_max_block_count(card.handle);
+    u32 head = blk_count > max ? (blk_count - 1) / max * max : 0;
+    int ret;
+
+    if (sdcard_sync())
+        return -1;
+
+    if (sdcard_xfer_mode(blk_count - head, data) != SDCARD_MODE_MULTI || card.multiple_fallback)
+        return sdcard_write(blk_start, blk_count, data);
+
+    if (head) {
+        ret = sdcard_write(blk_start, head, data);
+        if (ret)
+            return ret;
+        blk_start += head;
+        blk_count -= head;
+        data += head * SDMMC_DEFAULT_BLOCKLEN;
+    }
+
+    if (sdcard_start_write(blk_start, blk_count, data, &behind.cmd))
+        return sdcard_write(blk_start, blk_count, data);
+
+    behind.blk_start = blk_start;
+    behind.blk_count = blk_count;
+    behind.data = data;
+    return 0;
+}
+
+static int sdcard_rw_sg(u32 blk_start, struct sdmmc_sg *sg, int sgcount, int write)
+{
+    struct sdmmc_command cmd;
+    u32 len = 0;
+    int descs = 0;
+
+    if (sdcard_sync())
+        return -1;
+
+    for (int i = 0; i < sgcount; i++) {
+        len += sg[i].sg_len;
+        descs += (sg[i].sg_len + SDHC_ADMA2_SEG_MAX - 1) / SDHC_ADMA2_SEG_MAX;
+    }
+
+    if (!sgcount || len % SDMMC_DEFAULT_BLOCKLEN) {
+        printf("sdcard: segments are not a multiple of the block size\n");
+        return -1;
+    }
+
+    // no ADMA2, or more than one command's worth: go segment by segment
+    if (!sdhc_can_sg(card.handle) || descs > SDHC_ADMA2_DESC_MAX ||
+        len / SDMMC_DEFAULT_BLOCKLEN > sdhc_max_block_count(card.handle)) {
+        for (int i = 0; i < sgcount; i++) {
+            u32 count = sg[i].sg_len / SDMMC_DEFAULT_BLOCKLEN;
+            int ret;
+
+            if (sg[i].sg_len % SDMMC_DEFAULT_BLOCKLEN) {
+                printf("sdcard: segment is not a multiple of the block size\n");
+                return -1;
+            }
+
+            ret = write ? sdcard_write(blk_start, count, sg[i].sg_addr)
+                        : sdcard_read(blk_start, count, sg[i].sg_addr);
+            if (ret) return ret;
+            blk_start += count;
+        }
+        return 0;
+    }
+
+    if (card.inserted == 0) {
+        printf("sdcard: no card inserted.\n");
+        return -1;
+    }
+
+    if (card.selected == 0) {
+        if (sdcard_select() < 0) {
+            printf("sdcard: cannot select card.\n");
+            return -1;
+        }
+    }
+
+    if (card.new_card == 1) {
+        printf("sdcard: new card inserted but not acknowledged yet.\n");
+        return -1;
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+    if (len > SDMMC_DEFAULT_BLOCKLEN)
+        cmd.c_opcode = write ? MMC_WRITE_BLOCK_MULTIPLE : MMC_READ_BLOCK_MULTIPLE;
+    else
+        cmd.c_opcode = write ? MMC_WRITE_BLOCK_SINGLE : MMC_READ_BLOCK_SINGLE;
+    if (card.sdhc_blockmode)
+        cmd.c_arg = blk_start;
+    else
+        cmd.c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
+    cmd.c_sg = sg;
+    cmd.c_sgcount = sgcount;
+    cmd.c_datalen = len;
+    cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
+    cmd.c_flags = write ? SCF_RSP_R1 : (SCF_RSP_R1 | SCF_CMD_READ);
+    sdhc_exec_command(card.handle, &cmd);
+
+    if (cmd.c_error) {
+        printf("sdcard: %s of %d segments failed with %d\n", write ? "write" : "read", sgcount, cmd.c_error);
+        return -1;
+    } else if(MMC_R1(cmd.c_resp) & MMC_R1_ANY_ERROR){
+        printf("sdcard: %s reported error. status: %08lx\n", write ? "write" : "read", MMC_R1(cmd.c_resp));
+        return -2;
+    }
+
+    return 0;
+}
+
+int sdcard_readv(u32 blk_start, struct sdmmc_sg *sg, int sgcount)
+{
+    return sdcard_rw_sg(blk_start, sg, sgcount, 0);
+}
+
+int sdcard_writev(u32 blk_start, struct sdmmc_sg *sg, int sgcount)
+{
+    return sdcard_rw_sg(blk_start, sg, sgcount, 1);
+}
+
+int sdcard_erase(u32 blk_start, u32 blk_end)
+{
+    struct sdmmc_command cmd;
+
+    if (sdcard_sync())
+        return -1;
+
+    if (card.inserted == 0) {
+        printf("sdcard: ERASE: no card inserted.\n");
+        return -1;
+    }
+
+    if (!(card.ccc & SD_CSD_CCC_ERASE))
+        return -1;
+
+    if (card.selected == 0) {
+        if (sdcard_select() < 0) {
+            printf("sdcard: ERASE: cannot select card.\n");
+            return -1;
+        }
+    }
+
+    if (card.new_card == 1) {
+        printf("sdcard: new card inserted but not acknowledged yet.\n");
+        return -1;
+    }
+
+    if (!card.sdhc_blockmode) {
+        blk_start *= SDMMC_DEFAULT_BLOCKLEN;
+        blk_end *= SDMMC_DEFAULT_BLOCKLEN;
+    }
+
+    DPRINTF(2, ("sdcard: SD_ERASE_WR_BLK_START\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = SD_ERASE_WR_BLK_START;
+    cmd.c_arg = blk_start;
+    cmd.c_flags = SCF_RSP_R1;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: SD_ERASE_WR_BLK_START failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    DPRINTF(2, ("sdcard: SD_ERASE_WR_BLK_END\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = SD_ERASE_WR_BLK_END;
+    cmd.c_arg = blk_end;
+    cmd.c_flags = SCF_RSP_R1;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: SD_ERASE_WR_BLK_END failed with %d\n", cmd.c_error);
+        return -1;
+    }
+
+    DPRINTF(2, ("sdcard: SD_ERASE\n"));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.c_opcode = SD_ERASE;
+    cmd.c_arg = 0;
+    cmd.c_flags = SCF_RSP_R1B;
+    cmd.c_timeout = SDCARD_ERASE_TIMEOUT;
+    sdhc_exec_command(card.handle, &cmd);
+    if (cmd.c_error) {
+        printf("sdcard: SD_ERASE failed with %d\n", cmd.c_error);
+        return -1;
+    } else if(MMC_R1(cmd.c_resp) & MMC_R1_ANY_ERROR){
+        printf("sdcard: erase reported error. status: %08lx\n", MMC_R1(cmd.c_resp));
+        return -2;
+    }
+
+    return sdcard_wait_data();
+}
+
 int sdcard_wait_data(void)
 {
     struct sdmmc_command cmd;
 
+    if (sdcard_sync())
+        return -1;
+
     do
     {
         DPRINTF(2, ("sdcard: MMC_SEND_STATUS\n"));
@@ -897,6 +1246,7 @@ void sdcard_init(void)
 
 void sdcard_exit(void)
 {
+    sdcard_sync();
 #ifdef CAN_HAZ_IRQ
     irq_disable(IRQ_SD0);
 #endif
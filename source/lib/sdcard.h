@@ -16,6 +16,29 @@
 #include "bsdtypes.h"
 #include "sdmmc.h"
 
+/* transfer modes, fastest first */
+enum {
+    SDCARD_MODE_MULTI,      /* multi-block DMA */
+    SDCARD_MODE_SINGLE,     /* single-block DMA */
+    SDCARD_MODE_PIO,        /* CPU transfers */
+    SDCARD_MODE_COUNT
+};
+
+struct sdcard_mode_stats {
+    u32 ok;
+    u32 errors;
+    u32 retries;
+};
+
+struct sdcard_stats {
+    struct sdcard_mode_stats mode[SDCARD_MODE_COUNT];
+    u32 fallbacks;
+    u32 reprobes;
+    u32 reprobe_in;         /* good transfers left before the next re-probe */
+    int multiple_fallback;
+    int no_dma;
+};
+
 void sdcard_init(void);
 void sdcard_exit(void);
 void sdcard_irq(void);
@@ -28,14 +51,22 @@ int sdcard_select(void);
 int sdcard_check_card(void);
 int sdcard_ack_card(void);
 int sdcard_get_sectors(void);
+void sdcard_get_stats(struct sdcard_stats *stats);
 
 int sdcard_read(u32 blk_start, u32 blk_count, void *data);
 int sdcard_write(u32 blk_start, u32 blk_count, void *data);
 
+int sdcard_readv(u32 blk_start, struct sdmmc_sg *sg, int sgcount);
+int sdcard_writev(u32 blk_start, struct sdmmc_sg *sg, int sgcount);
+int sdcard_erase(u32 blk_start, u32 blk_end);
+
 int sdcard_start_read(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf);
 int sdcard_end_read(struct sdmmc_command* cmdbuf);
 
 int sdcard_start_write(u32 blk_start, u32 blk_count, void *data, struct sdmmc_command* cmdbuf);
 int sdcard_end_write(struct sdmmc_command* cmdbuf);
 
+int sdcard_write_behind(u32 blk_start, u32 blk_count, void *data);
+int sdcard_sync(void);
+
 #endif
@@ -33,7 +33,8 @@
 #include "irq.h"
 #endif
 
-//#define SDHC_DEBUG
+#define LOG_LEVEL LOG_LEVEL_SDHC
+#include "log.h"
 
 #define	EREMOTEIO	121
 #define SDHC_COMMAND_TIMEOUT    500
@@ -95,6 +96,14 @@ static inline void bus_space_write_1(bus_space_handle_t ioh, u32 r, u8 v)
 
 /* flag values */
 #define SHF_USE_DMA     0x0001
+#define SHF_USE_ADMA2   0x0002
+
+/* descriptors are fetched little-endian by the controller */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SDHC_ADMA2_LE32(x)  __builtin_bswap32(x)
+#else
+#define SDHC_ADMA2_LE32(x)  (x)
+#endif
 
 #define HREAD1(hp, reg)                         \
     (bus_space_read_1((hp)->ioh, (reg)))
@@ -125,12 +134,8 @@ int sdhc_wait_intr_debug(const char *func, int line, struct sdhc_host *, int, in
 void    sdhc_transfer_data(struct sdhc_host *, struct sdmmc_command *);
 void    sdhc_read_data(struct sdhc_host *, u_char *, int);
 void    sdhc_write_data(struct sdhc_host *, u_char *, int);
-#ifdef SDHC_DEBUG
-int sdhcdebug = 3;
-#define DPRINTF(n,s)    do { if ((n) <= sdhcdebug) printf s; } while (0)
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
 void    sdhc_dump_regs(struct sdhc_host *);
-#else
-#define DPRINTF(n,s)    do {} while(0)
 #endif
 
 void do_nothing(sdmmc_chipset_handle_t handle){
@@ -148,7 +153,7 @@ sdhc_host_found(struct sdhc_host *hp, struct sdhc_host_params *pa, bus_space_tag
     int error = 1;
     int max_clock;
 
-#ifdef SDHC_DEBUG
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
     u_int16_t version;
 
     version = HREAD2(hp, SDHC_HOST_CTL_VERSION);
@@ -183,6 +188,14 @@ sdhc_host_found(struct sdhc_host *hp, struct sdhc_host_params *pa, bus_space_tag
     if (usedma && ISSET(caps, SDHC_DMA_SUPPORT))
         SET(hp->flags, SHF_USE_DMA);
 
+    /* Prefer ADMA2 when the descriptor table itself is reachable by DMA. */
+    if (usedma && ISSET(caps, SDHC_ADMA2_SUPP) &&
+        SDHC_SPEC_VERSION(hp->version) >= SDHC_SPEC_V2 &&
+        can_sdcard_dma_addr(hp->adma2)) {
+        SET(hp->flags, SHF_USE_ADMA2);
+        printf("sdhc: using ADMA2\n");
+    }
+
     /*
      * Determine the base clock frequency. (2.2.24)
      */
@@ -532,6 +545,7 @@ sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
     int error;
 
+    hp->trace_start = trace_clock();
     if (cmd->c_datalen > 0)
         hp->data_command = 1;
 
@@ -556,6 +570,13 @@ sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     }
 }
 
+static inline void
+sdhc_trace(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+    TRACE(TRACE_SDHC_CMD, cmd->c_error, (hp->pa.rb << 8) | cmd->c_opcode,
+        cmd->c_datalen, hp->trace_start);
+}
+
 void
 sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -564,6 +585,12 @@ sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
      * is marked done for any other reason.
      */
 
+    /* The command never started, there is nothing to wait for. */
+    if (ISSET(cmd->c_flags, SCF_ITSDONE) && cmd->c_error != 0) {
+        sdhc_trace(hp, cmd);
+        return;
+    }
+
 #ifdef MINUTE_BOOT1
     udelay(10); // whyyyyyyyy?
 #endif
@@ -577,12 +604,14 @@ sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
     if (ISSET(status, SDHC_ERROR_TIMEOUT)){
         cmd->c_error = ETIMEDOUT;
         printf("timeout dump: error_intr: 0x%x intr: 0x%x\n", hp->intr_error_status, hp->intr_status);
+        sdhc_trace(hp, cmd);
         return;
     }
 
     if (ISSET(status, SDHC_ERROR_INTERRUPT)){
         printf("sdhc: ERROR interrupt, status=0x%X\n", status);
         cmd->c_error = 1;
+        sdhc_trace(hp, cmd);
         return;
     }
 
@@ -615,6 +644,7 @@ sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
         cmd->c_opcode, cmd->c_flags, cmd->c_error, (cmd->c_resp[0] >> 9) & 15));
     SET(cmd->c_flags, SCF_ITSDONE);
     hp->data_command = 0;
+    sdhc_trace(hp, cmd);
 }
 
 void
@@ -633,6 +663,91 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 #endif
 }
 
+/*
+ * Largest block count a single command may carry on this host.
+ */
+u_int32_t
+sdhc_max_block_count(struct sdhc_host *hp)
+{
+    if (!hp->no_dma && ISSET(hp->flags, SHF_USE_ADMA2))
+        return SDHC_ADMA2_BLOCK_COUNT_MAX;
+    return SDHC_BLOCK_COUNT_MAX;
+}
+
+/*
+ * Return non-zero if commands may carry a segment list (c_sg).
+ */
+int
+sdhc_can_sg(struct sdhc_host *hp)
+{
+    return !hp->no_dma && ISSET(hp->flags, SHF_USE_ADMA2);
+}
+
+/*
+ * Describe the data buffer(s) of `cmd' in the ADMA2 descriptor table,
+ * doing the cache maintenance for every segment on the way.
+ */
+static int
+sdhc_adma2_build(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+    struct sdmmc_sg single;
+    struct sdmmc_sg *sg = cmd->c_sg;
+    int sgcount = cmd->c_sgcount;
+    int total = 0;
+    int n = 0;
+
+    if (sg == NULL) {
+        single.sg_addr = cmd->c_data;
+        single.sg_len = cmd->c_datalen;
+        sg = &single;
+        sgcount = 1;
+    }
+
+    for (int i = 0; i < sgcount; i++) {
+        u_char *addr = sg[i].sg_addr;
+        u_int32_t len = sg[i].sg_len;
+
+        /* Partial cache lines can't be invalidated safely. */
+        if (!len || (len & 0x1F) || !can_sdcard_dma_addr(addr)) {
+            printf("sdhc: bad ADMA2 segment %p+%lx\n", addr, len);
+            return EINVAL;
+        }
+
+        if (ISSET(cmd->c_flags, SCF_CMD_READ))
+            dc_invalidaterange(addr, len);
+        else
+            dc_flushrange(addr, len);
+
+        total += len;
+        while (len) {
+            u_int32_t seg = MIN(len, SDHC_ADMA2_SEG_MAX);
+
+            if (n == SDHC_ADMA2_DESC_MAX) {
+                printf("sdhc: ADMA2 table full\n");
+                return EINVAL;
+            }
+
+            hp->adma2[n].attr_len = SDHC_ADMA2_LE32(SDHC_ADMA2_VALID |
+                SDHC_ADMA2_ACT_TRAN | (seg << SDHC_ADMA2_LEN_SHIFT));
+            hp->adma2[n].addr = SDHC_ADMA2_LE32((u32)addr);
+            addr += seg;
+            len -= seg;
+            n++;
+        }
+    }
+
+    if (total != cmd->c_datalen) {
+        printf("sdhc: ADMA2 segments cover %d of %d bytes\n", total, cmd->c_datalen);
+        return EINVAL;
+    }
+
+    hp->adma2[n - 1].attr_len |= SDHC_ADMA2_LE32(SDHC_ADMA2_END);
+    dc_flushrange(hp->adma2, n * sizeof(struct sdhc_adma2_desc));
+    ahb_flush_to(hp->pa.rb);
+
+    return 0;
+}
+
 int
 sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -662,11 +777,25 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     }
 
     /* Check limit imposed by 9-bit block count. (1.7.2) */
-    if (blkcount > SDHC_BLOCK_COUNT_MAX) {
+    if (blkcount > sdhc_max_block_count(hp)) {
         printf("sdhc: too much data\n");
         return EINVAL;
     }
 
+    /* Pick the transfer engine for this command. */
+    hp->xfer_mode = SDHC_XFER_PIO;
+    if (cmd->c_datalen > 0 && !hp->no_dma) {
+        if (ISSET(hp->flags, SHF_USE_ADMA2) &&
+            (cmd->c_sg != NULL || can_sdcard_dma_addr(cmd->c_data)))
+            hp->xfer_mode = SDHC_XFER_ADMA2;
+        else if (ISSET(hp->flags, SHF_USE_DMA) && can_sdcard_dma_addr(cmd->c_data))
+            hp->xfer_mode = SDHC_XFER_SDMA;
+    }
+    if (cmd->c_sg != NULL && hp->xfer_mode != SDHC_XFER_ADMA2) {
+        printf("sdhc: segment list needs ADMA2\n");
+        return EINVAL;
+    }
+
     /* Prepare transfer mode register value. (2.2.5) */
     mode = 0;
     if (ISSET(cmd->c_flags, SCF_CMD_READ))
@@ -679,7 +808,7 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
             mode |= SDHC_AUTO_CMD12_ENABLE;
         }
     }
-    if (!hp->no_dma && can_sdcard_dma_addr(cmd->c_data) && ISSET(hp->flags, SHF_USE_DMA))
+    if (hp->xfer_mode != SDHC_XFER_PIO)
         mode |= SDHC_DMA_ENABLE;
 
     /*
@@ -692,7 +821,7 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
         command |= SDHC_CRC_CHECK_ENABLE;
     if (ISSET(cmd->c_flags, SCF_RSP_IDX))
         command |= SDHC_INDEX_CHECK_ENABLE;
-    if (cmd->c_data != NULL)
+    if (cmd->c_data != NULL || cmd->c_sg != NULL)
         command |= SDHC_DATA_PRESENT_SELECT;
 
     if (!ISSET(cmd->c_flags, SCF_RSP_PRESENT))
@@ -709,11 +838,26 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     if ((error = sdhc_wait_state(hp, SDHC_CMD_INHIBIT_MASK, 0)) != 0)
         return error;
 
-    if ((mode & SDHC_DMA_ENABLE) && cmd->c_datalen > 0) 
+    if (hp->xfer_mode == SDHC_XFER_ADMA2)
+    {
+        if ((error = sdhc_adma2_build(hp, cmd)) != 0)
+            return error;
+
+        cmd->c_resid = blkcount;
+        cmd->c_buf = cmd->c_data;
+
+        HWRITE1(hp, SDHC_HOST_CTL, (HREAD1(hp, SDHC_HOST_CTL) &
+            ~SDHC_DMA_SELECT_MASK) | SDHC_DMA_SELECT_ADMA2);
+        HWRITE4(hp, SDHC_ADMA_SYSTEM_ADDR, (u32)hp->adma2);
+    }
+    else if (hp->xfer_mode == SDHC_XFER_SDMA)
     {
         cmd->c_resid = blkcount;
         cmd->c_buf = cmd->c_data;
 
+        if (ISSET(hp->flags, SHF_USE_ADMA2))
+            HCLR1(hp, SDHC_HOST_CTL, SDHC_DMA_SELECT_MASK);
+
         if (ISSET(cmd->c_flags, SCF_CMD_READ)) {
             dc_invalidaterange(cmd->c_data, cmd->c_datalen);
         } else {
@@ -740,6 +884,66 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
     return 0;
 }
 
+/*
+ * The data port is little-endian.  ARMv5 has no REV, this is the usual
+ * four instruction eor/ror swap.
+ */
+static inline u32
+sdhc_swab32(u32 v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    u32 t = v ^ ((v >> 16) | (v << 16));
+    t &= ~0x00FF0000;
+    v = (v >> 8) | (v << 24);
+    return v ^ (t >> 8);
+#else
+    return v;
+#endif
+}
+
+/*
+ * The port goes through read32()/write32() like every other register, so
+ * the host stand-in in host/sdhc_sim.c can serve it.
+ */
+#define SDHC_PORT_READ(hp)      read32((hp)->ioh + SDHC_DATA)
+#define SDHC_PORT_WRITE(hp, v)  write32((hp)->ioh + SDHC_DATA, (v))
+
+/* Drain `words' from the data port once a block is known to be ready. */
+static void
+sdhc_pio_read(struct sdhc_host *hp, u32 *p, u32 words)
+{
+    for (; words >= 8; words -= 8, p += 8) {
+        p[0] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[1] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[2] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[3] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[4] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[5] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[6] = sdhc_swab32(SDHC_PORT_READ(hp));
+        p[7] = sdhc_swab32(SDHC_PORT_READ(hp));
+    }
+    while (words--)
+        *p++ = sdhc_swab32(SDHC_PORT_READ(hp));
+}
+
+/* Fill `words' into the data port once there is room for a block. */
+static void
+sdhc_pio_write(struct sdhc_host *hp, const u32 *p, u32 words)
+{
+    for (; words >= 8; words -= 8, p += 8) {
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[0]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[1]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[2]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[3]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[4]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[5]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[6]));
+        SDHC_PORT_WRITE(hp, sdhc_swab32(p[7]));
+    }
+    while (words--)
+        SDHC_PORT_WRITE(hp, sdhc_swab32(*p++));
+}
+
 void
 sdhc_transfer_data(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -749,7 +953,25 @@ sdhc_transfer_data(struct sdhc_host *hp, struct sdmmc_command *cmd)
     error = 0;
 
     DPRINTF(1,("resp=%#x datalen=%d\n", MMC_R1(cmd->c_resp), cmd->c_datalen));
-    if (!hp->no_dma && can_sdcard_dma_addr(cmd->c_data) && ISSET(hp->flags, SHF_USE_DMA)) {
+    if (hp->xfer_mode == SDHC_XFER_ADMA2) {
+        /* The whole table runs without boundary interrupts. */
+        status = sdhc_wait_intr(hp, SDHC_TRANSFER_COMPLETE,
+                SDHC_TRANSFER_TIMEOUT);
+        if (!ISSET(status, SDHC_TRANSFER_COMPLETE)) {
+            printf("ADMA2 failed: %04x %02x %04x\n", status,
+                HREAD1(hp, SDHC_ADMA_ERROR_STATUS), HREAD2(hp, SDHC_BLOCK_COUNT));
+            error = ISSET(status, SDHC_ERROR_TIMEOUT) ? ETIMEDOUT : EIO;
+        }
+
+        if (ISSET(cmd->c_flags, SCF_CMD_READ)) {
+            if (cmd->c_sg) {
+                for (int i = 0; i < cmd->c_sgcount; i++)
+                    dc_invalidaterange(cmd->c_sg[i].sg_addr, cmd->c_sg[i].sg_len);
+            } else {
+                dc_invalidaterange(cmd->c_data, cmd->c_datalen);
+            }
+        }
+    } else if (hp->xfer_mode == SDHC_XFER_SDMA) {
         for(;;) {
             status = sdhc_wait_intr(hp, SDHC_TRANSFER_COMPLETE |
                     SDHC_DMA_INTERRUPT,
@@ -767,39 +989,33 @@ sdhc_transfer_data(struct sdhc_host *hp, struct sdmmc_command *cmd)
         }
         dc_invalidaterange(cmd->c_data, cmd->c_datalen);
     } else {
-        //printf("fail.\n");
-
-        if (ISSET(cmd->c_flags, SCF_CMD_READ))
-        {
-            //HWRITE2(hp, SDHC_NINTR_STATUS, SDHC_COMMAND_COMPLETE|SDHC_DMA_INTERRUPT);
-#ifdef CAN_HAZ_IRQ
-            hp->intr_status;
-#endif
+        u32 *p = cmd->c_data;
+        u32 words = cmd->c_datalen / sizeof(u32);
+        u32 blkwords = MIN(cmd->c_datalen, cmd->c_blklen) / sizeof(u32);
+        int read = ISSET(cmd->c_flags, SCF_CMD_READ);
+        u32 ready = read ? SDHC_BUFFER_READ_ENABLE : SDHC_BUFFER_WRITE_ENABLE;
+
+        /* The buffer enable bits are per block, not per word. (1.7.3) */
+        while (words) {
+            u32 n = MIN(words, blkwords);
+
+            if (sdhc_wait_state(hp, ready, ready) != 0) {
+                printf("PIO timeout, %lu words left\n", words);
+                error = ETIMEDOUT;
+                break;
+            }
 
-            u32* out_ptr = cmd->c_data;
-            for (u32 i = 0; i < cmd->c_datalen / sizeof(u32); i++)
-            {
-                sdhc_wait_state(hp, SDHC_BUFFER_READ_ENABLE, SDHC_BUFFER_READ_ENABLE); 
+            if (read)
+                sdhc_pio_read(hp, p, n);
+            else
+                sdhc_pio_write(hp, p, n);
 
-                u32 val_raw = HREAD4(hp, SDHC_DATA);
-                *out_ptr = (val_raw >> 24) | ((val_raw >> 8) & 0xFF00) | ((val_raw << 8) & 0xFF0000) | (val_raw << 24);
-                out_ptr++;
-            }
-        }
-        else {
-            u32* in_ptr = cmd->c_data;
-            for (u32 i = 0; i < cmd->c_datalen / sizeof(u32); i++)
-            {
-                sdhc_wait_state(hp, SDHC_BUFFER_WRITE_ENABLE, SDHC_BUFFER_WRITE_ENABLE); 
-
-                u32 val_raw = *in_ptr;
-                HWRITE4(hp, SDHC_DATA, (val_raw >> 24) | ((val_raw >> 8) & 0xFF00) | ((val_raw << 8) & 0xFF0000) | (val_raw << 24));
-                in_ptr++;
-            }
+            p += n;
+            words -= n;
         }
     }
 
-#ifdef SDHC_DEBUG
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
     /* XXX I forgot why I wanted to know when this happens :-( */
     if ((cmd->c_opcode == 52 || cmd->c_opcode == 53) &&
         ISSET(MMC_R1(cmd->c_resp), 0xcb00))
@@ -944,7 +1160,7 @@ sdhc_intr(struct sdhc_host *hp)
         DPRINTF(2,("sdhc: error interrupt, status=0x%x, signal=0x%x\n", error, signal));
 
         if (ISSET(error, SDHC_CMD_TIMEOUT_ERROR|
-            SDHC_DATA_TIMEOUT_ERROR)) {
+            SDHC_DATA_TIMEOUT_ERROR|SDHC_ADMA_ERROR)) {
             hp->intr_error_status |= error;
             hp->intr_status |= status;
         }
@@ -960,7 +1176,7 @@ sdhc_intr(struct sdhc_host *hp)
         hp->intr_status |= status;
     }
 
-    if (ISSET(status, SDHC_DMA_INTERRUPT)) {
+    if (ISSET(status, SDHC_DMA_INTERRUPT) && hp->xfer_mode == SDHC_XFER_SDMA) {
         DPRINTF(2,("sdhc: dma left:%#x\n", HREAD2(hp, SDHC_BLOCK_COUNT)));
         // this works because our virtual memory
         // addresses are equal to the physical memory
@@ -991,7 +1207,7 @@ sdhc_intr(struct sdhc_host *hp)
     return 1;
 }
 
-#ifdef SDHC_DEBUG
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
 void
 sdhc_dump_regs(struct sdhc_host *hp)
 {
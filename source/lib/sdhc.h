@@ -32,6 +32,18 @@ struct sdhc_host_params {
     enum wb_client wb;
 };
 
+/* ADMA2 descriptor, 32-bit addressing (1.13.4); stored little-endian */
+struct sdhc_adma2_desc {
+    u_int32_t attr_len;     /* attributes in [15:0], length in [31:16] */
+    u_int32_t addr;         /* segment physical address */
+};
+
+#ifdef MINUTE_BOOT1
+#define SDHC_ADMA2_DESC_MAX     1
+#else
+#define SDHC_ADMA2_DESC_MAX     32
+#endif
+
 struct sdhc_host {
     bus_space_tag_t iot;        /* host register set tag */
     bus_space_handle_t ioh;     /* host register set handle */
@@ -44,6 +56,10 @@ struct sdhc_host {
     volatile u_int16_t intr_error_status;    /* soft error status */
     int data_command;
     int no_dma;
+    int xfer_mode;          /* SDHC_XFER_* of the command in flight */
+    u_int32_t trace_start;      /* LT_TIMER when it was issued */
+
+    struct sdhc_adma2_desc adma2[SDHC_ADMA2_DESC_MAX] ALIGNED(32);
 
     struct sdhc_host_params pa;
 };
@@ -54,6 +70,11 @@ void    sdhc_power(int, void *);
 void    sdhc_shutdown(struct sdhc_host *);
 int sdhc_intr(struct sdhc_host *);
 
+/* data transfer modes */
+#define SDHC_XFER_PIO           0
+#define SDHC_XFER_SDMA          1
+#define SDHC_XFER_ADMA2         2
+
 /* Host standard register set */
 #define SDHC_DMA_ADDR           0x00
 #define SDHC_BLOCK_SIZE         0x04
@@ -63,6 +84,9 @@ int sdhc_intr(struct sdhc_host *);
 #else
 #define SDHC_BLOCK_COUNT_MAX        256
 #endif
+/* ADMA2 segments are split at 32 KiB, the descriptor table bounds a command */
+#define SDHC_ADMA2_SEG_MAX      0x8000
+#define SDHC_ADMA2_BLOCK_COUNT_MAX  (SDHC_ADMA2_DESC_MAX * SDHC_ADMA2_SEG_MAX / 512)
 #define SDHC_ARGUMENT           0x08
 #define SDHC_TRANSFER_MODE      0x0c
 #define SDHC_MULTI_BLOCK_MODE       (1<<5)
@@ -111,6 +135,9 @@ int sdhc_intr(struct sdhc_host *);
 #define SDHC_CMD_INHIBIT_MASK       0x0003
 #define SDHC_HOST_CTL           0x28
 #define SDHC_8BIT_MODE          (1<<5)
+#define SDHC_DMA_SELECT_MASK        (3<<3)
+#define SDHC_DMA_SELECT_ADMA2       (2<<3)
+#define SDHC_DMA_SELECT_SDMA        (0<<3)
 #define SDHC_HIGH_SPEED         (1<<2)
 #define SDHC_4BIT_MODE          (1<<1)
 #define SDHC_LED_ON         (1<<0)
@@ -178,6 +205,7 @@ int sdhc_intr(struct sdhc_host *);
 #define SDHC_VOLTAGE_SUPP_3_3V      (1<<24)
 #define SDHC_DMA_SUPPORT        (1<<22)
 #define SDHC_HIGH_SPEED_SUPP        (1<<21)
+#define SDHC_ADMA2_SUPP         (1<<19)
 #define SDHC_BASE_FREQ_SHIFT        8
 #define SDHC_BASE_FREQ_MASK     0x3f
 #define SDHC_BASE_FREQ_MASK_V3      0xff
@@ -185,6 +213,8 @@ int sdhc_intr(struct sdhc_host *);
 #define SDHC_TIMEOUT_FREQ_SHIFT     0
 #define SDHC_TIMEOUT_FREQ_MASK      0x1f
 #define SDHC_MAX_CAPABILITIES       0x48
+#define SDHC_ADMA_ERROR_STATUS      0x54
+#define SDHC_ADMA_SYSTEM_ADDR       0x58
 #define SDHC_SLOT_INTR_STATUS       0xfc
 #define SDHC_HOST_CTL_VERSION       0xfe
 #define SDHC_SPEC_VERS_SHIFT        0
@@ -195,6 +225,15 @@ int sdhc_intr(struct sdhc_host *);
 #define  SDHC_SPEC_V2           1
 #define  SDHC_SPEC_V3           2
 
+/* ADMA2 descriptor attributes (1.13.4) */
+#define SDHC_ADMA2_VALID        (1<<0)
+#define SDHC_ADMA2_END          (1<<1)
+#define SDHC_ADMA2_INT          (1<<2)
+#define SDHC_ADMA2_ACT_NOP      (0<<4)
+#define SDHC_ADMA2_ACT_TRAN     (2<<4)
+#define SDHC_ADMA2_ACT_LINK     (3<<4)
+#define SDHC_ADMA2_LEN_SHIFT        16
+
 /* SDHC_CLOCK_CTL encoding */
 #define SDHC_SDCLK_DIV(div)                     \
     (((div) & SDHC_SDCLK_DIV_MASK) << SDHC_SDCLK_DIV_SHIFT)
@@ -231,6 +270,8 @@ void sdhc_card_intr_mask(struct sdhc_host *hp, int);
 void sdhc_card_intr_ack(struct sdhc_host *hp);
 
 void sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *);
+u_int32_t sdhc_max_block_count(struct sdhc_host *hp);
+int sdhc_can_sg(struct sdhc_host *hp);
 
 void sdhc_async_command(struct sdhc_host *hp, struct sdmmc_command *);
 void sdhc_async_response(struct sdhc_host *hp, struct sdmmc_command *);
@@ -67,12 +67,20 @@ struct sdmmc_task {
 
 #define sdmmc_task_pending(xtask) ((xtask)->onqueue)
 
+/* one scatter/gather segment of an ADMA2 data transfer */
+struct sdmmc_sg {
+    void        *sg_addr;   /* segment buffer, DMA capable */
+    u_int32_t    sg_len;    /* segment length, multiple of 32 */
+};
+
 struct sdmmc_command {
 //  struct sdmmc_task c_task;   /* task queue entry */
     u_int16_t    c_opcode;  /* SD or MMC command index */
     u_int32_t    c_arg;     /* SD/MMC command argument */
     sdmmc_response   c_resp;    /* response buffer */
     void        *c_data;    /* buffer to send or read into */
+    struct sdmmc_sg *c_sg;      /* segment list replacing c_data (ADMA2 only) */
+    int      c_sgcount; /* number of segments in c_sg */
     int      c_datalen; /* length of data buffer */
     int      c_blklen;  /* block length */
     int      c_flags;   /* see below */
@@ -317,6 +325,7 @@ struct sdmmc_function {
 #define  SD_CSD_SPEED_50_MHZ        0x5a
 #define SD_CSD_CCC(resp)        MMC_RSP_BITS((resp), 84, 12)
 #define SD_CSD_CCC_CMD6         (1<<10)
+#define SD_CSD_CCC_ERASE        (1<<5)
 #define  SD_CSD_CCC_ALL         0x5f5
 #define SD_CSD_READ_BL_LEN(resp)    MMC_RSP_BITS((resp), 80, 4)
 #define SD_CSD_READ_BL_PARTIAL(resp)    MMC_RSP_BITS((resp), 79, 1)
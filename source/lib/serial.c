@@ -12,6 +12,7 @@
 #include "gpio.h"
 #include "utils.h"
 #include "gfx.h"
+#include "irq.h"
 #include <string.h>
 
 u8 serial_buffer[256];
@@ -19,8 +20,24 @@ u16 serial_len = 0;
 static u8 _serial_allow_zeros = 0;
 u32 serial_line = 0;
 
+// Output queue: code running with interrupts enabled is the only producer,
+// serial_drain() the only consumer. Each byte is taken with interrupts off,
+// so the alarm interrupt and an idle-time drain never send the same byte.
+#define SERIAL_TX_SIZE (0x2000)
+#define SERIAL_TX_MASK (SERIAL_TX_SIZE - 1)
+
+static u8 serial_tx[SERIAL_TX_SIZE];
+static volatile u32 serial_tx_head = 0;
+static volatile u32 serial_tx_tail = 0;
+static u32 serial_tx_dropped = 0;
+static u32 serial_sent = 0;
+static u8 serial_async = 0;
+
+static void _serial_send(u8 val);
+
 void serial_fatal()
 {
+    serial_flush();
     while (1) {
         serial_send(0x55);
         serial_send(0xAA);
@@ -74,12 +91,15 @@ void serial_send_u32(u32 val)
 }
 
 int serial_in_read(u8* out) {
+    // the drain fills serial_buffer from the alarm interrupt
+    u32 cookie = irq_kill();
     memset(out, 0, sizeof(serial_buffer));
     memcpy(out, serial_buffer, serial_len);
     out[255] = 0;
 
     u16 read_len = serial_len;
     serial_len = 0;
+    irq_restore(cookie);
 
     return read_len;
 }
@@ -124,7 +144,13 @@ void serial_clear()
 
 void serial_poll()
 {
-    serial_send(0);
+    // Input only comes in while bits go out. Queued output reads the wire
+    // just as well, so send a bounded share of it and only clock out a
+    // poll byte when there is nothing queued.
+    if (serial_tx_head == serial_tx_tail)
+        _serial_send(0);
+    else
+        serial_drain(SERIAL_IRQ_BUDGET);
 }
 
 void serial_allow_zeros()
@@ -137,7 +163,72 @@ void serial_disallow_zeros()
     _serial_allow_zeros = 0;
 }
 
+// sends up to max queued bytes, returns how many are still queued
+int serial_drain(int max)
+{
+    while (max--)
+    {
+        u32 cookie = irq_kill();
+        u32 tail = serial_tx_tail;
+        if (tail == serial_tx_head) {
+            irq_restore(cookie);
+            return 0;
+        }
+
+        _serial_send(serial_tx[tail & SERIAL_TX_MASK]);
+        serial_tx_tail = tail + 1;
+        irq_restore(cookie);
+    }
+
+    return serial_tx_head - serial_tx_tail;
+}
+
+void serial_flush()
+{
+    while (serial_drain(SERIAL_TX_SIZE));
+}
+
+void serial_set_async(int on)
+{
+    if (!on)
+        serial_flush();
+    serial_async = on;
+}
+
+u32 serial_get_dropped()
+{
+    return serial_tx_dropped;
+}
+
+// bytes handed to serial_send() so far, whether they went out or not
+u32 serial_get_sent()
+{
+    return serial_sent;
+}
+
 void serial_send(u8 val)
+{
+    serial_sent++;
+
+    // exception and interrupt handlers can't wait for the alarm
+    if (!serial_async || (get_cpsr() & CPSR_IRQDIS)) {
+        serial_flush();
+        _serial_send(val);
+        return;
+    }
+
+    u32 head = serial_tx_head;
+    if (head - serial_tx_tail >= SERIAL_TX_SIZE) {
+        serial_tx_dropped++;
+        return;
+    }
+
+    serial_tx[head & SERIAL_TX_MASK] = val;
+    __asm__ volatile ("" ::: "memory");
+    serial_tx_head = head + 1;
+}
+
+static void _serial_send(u8 val)
 {
     u8 read_val = 0;
     u8 read_val_valid = 0;
@@ -12,6 +12,10 @@
 
 #include "types.h"
 
+// queued bytes sent per alarm interrupt, each takes about 30us on the wire
+#define SERIAL_IRQ_BUDGET 8
+#define SERIAL_IRQ_MS 1
+
 void serial_fatal();
 void serial_force_terminate();
 void serial_send_u32(u32 val);
@@ -20,6 +24,11 @@ void serial_poll();
 void serial_allow_zeros();
 void serial_disallow_zeros();
 void serial_send(u8 val);
+int serial_drain(int max);
+void serial_flush();
+void serial_set_async(int on);
+u32 serial_get_dropped();
+u32 serial_get_sent();
 void serial_line_inc();
 void serial_clear();
 void serial_line_noscroll();
@@ -31,10 +31,16 @@ A million repetitions of "a"
 #define SHA_CMD_FLAG_ERR  (1<<29)
 #define SHA_CMD_AREA_BLOCK ((1<<10) - 1)
 
+// context whose blocks the engine is hashing in the background, if any
+static sha_ctx* sha_pending = NULL;
+
 static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE], u32 blocks)
 {
     if(blocks == 0) return;
 
+    // the engine has a single set of state registers
+    if(sha_pending) sha_wait(sha_pending);
+
     /* Copy ctx->state[] to working vars */
     write32(SHA_H0, state[0]);
     write32(SHA_H1, state[1]);
@@ -71,6 +77,49 @@ static void sha_transform(u32 state[SHA_HASH_WORDS], u8 buffer[SHA_BLOCK_SIZE],
     state[4] = read32(SHA_H4);
 }
 
+int sha_start(sha_ctx* ctx, const void* inbuf, u32 blocks)
+{
+    // only whole blocks on a block boundary can skip the context buffer
+    if(blocks == 0 || blocks > SHA_ENGINE_BLOCKS) return -1;
+    if(((ctx->count[0] >> 3) & 63) || ((u32)inbuf & (SHA_BLOCK_SIZE - 1))) return -1;
+
+    if(sha_pending) sha_wait(sha_pending);
+
+    u32 bits = blocks * SHA_BLOCK_BITS;
+    if((ctx->count[0] += bits) < bits)
+        ctx->count[1]++;
+
+    write32(SHA_H0, ctx->state[0]);
+    write32(SHA_H1, ctx->state[1]);
+    write32(SHA_H2, ctx->state[2]);
+    write32(SHA_H3, ctx->state[3]);
+    write32(SHA_H4, ctx->state[4]);
+
+    dc_flushrange(inbuf, blocks * SHA_BLOCK_SIZE);
+    ahb_flush_to(RB_SHA);
+
+    write32(SHA_SRC, dma_addr((void*)inbuf));
+    write32(SHA_CTRL, (read32(SHA_CTRL) & ~(SHA_CMD_AREA_BLOCK)) | (blocks - 1));
+    write32(SHA_CTRL, read32(SHA_CTRL) | SHA_CMD_FLAG_EXEC);
+
+    sha_pending = ctx;
+    return 0;
+}
+
+void sha_wait(sha_ctx* ctx)
+{
+    if(sha_pending != ctx) return;
+
+    while (read32(SHA_CTRL) & SHA_CMD_FLAG_EXEC);
+    sha_pending = NULL;
+
+    ctx->state[0] = read32(SHA_H0);
+    ctx->state[1] = read32(SHA_H1);
+    ctx->state[2] = read32(SHA_H2);
+    ctx->state[3] = read32(SHA_H3);
+    ctx->state[4] = read32(SHA_H4);
+}
+
 void sha_init(sha_ctx* ctx)
 {
     memset(ctx, 0, sizeof(sha_ctx));
@@ -87,6 +136,8 @@ void sha_update(sha_ctx* ctx, const void* inbuf, size_t size)
     unsigned int i, j;
     u8* data = (u8*)inbuf;
 
+    sha_wait(ctx);
+
     j = (ctx->count[0] >> 3) & 63;
     if ((ctx->count[0] += size << 3) < (size << 3))
         ctx->count[1]++;
@@ -33,4 +33,13 @@ void sha_final(sha_ctx* ctx, void* outbuf);
 
 void sha_hash(const void* inbuf, void* outbuf, size_t size);
 
+// the engine takes at most this many blocks per command
+#define SHA_ENGINE_BLOCKS (1024)
+
+// Hashes whole blocks of a 64-byte aligned buffer in the background. Fails if
+// the context holds a partial block; the buffer must stay untouched until
+// sha_wait(), which any other use of the engine also implies.
+int sha_start(sha_ctx* ctx, const void* inbuf, u32 blocks);
+void sha_wait(sha_ctx* ctx);
+
 #endif
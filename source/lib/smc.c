@@ -23,6 +23,7 @@
 #include "gpio.h"
 #include "serial.h"
 #include "rtc.h"
+#include "irq.h"
 
 // 0x00 - odd on (raw)
 // 0x01 - odd off (raw)
@@ -103,31 +104,80 @@
 
 static int smc_perma_disable = 0;
 
+// Once smc_start_sampling() was called, the alarm interrupt reads the event
+// register one bus step per tick and queues what it reports, so waiting for
+// a button costs neither the CPU nor the I2C bus. Register accesses from
+// the foreground claim the bus first and make the sampler back off.
+#define SMC_QUEUE_SIZE          16
+// alarm ticks between samples, and for a bus step to complete
+#define SMC_SAMPLE_INTERVAL     10
+#define SMC_SAMPLE_TIMEOUT      5000
+
+enum {
+    SMC_SAMPLE_IDLE,
+    SMC_SAMPLE_CHECK_ADDR,
+    SMC_SAMPLE_CHECK_READ,
+    SMC_SAMPLE_EVENT_ADDR,
+    SMC_SAMPLE_EVENT_READ,
+};
+
+static int smc_sampling = 0;
+static volatile int smc_sample_state = SMC_SAMPLE_IDLE;
+static int smc_sample_ticks = 0;
+static volatile int smc_claimed = 0;
+static u8 smc_queue[SMC_QUEUE_SIZE];
+static volatile u32 smc_queue_head = 0;
+static volatile u32 smc_queue_tail = 0;
+
+static void smc_claim(void)
+{
+    u32 cookie = irq_kill();
+    smc_claimed++;
+    if (smc_sample_state != SMC_SAMPLE_IDLE) {
+        // let the step on the bus finish, the sample is taken again later
+        i2c_wait_xfer_done();
+        i2c_end_xfer();
+        smc_sample_state = SMC_SAMPLE_IDLE;
+    }
+    irq_restore(cookie);
+}
+
+static void smc_release(void)
+{
+    smc_claimed--;
+}
+
 int smc_read_register(u8 offset, u8* data)
 {
     int res = 0;
 
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
     res = i2c_write(I2C_SLAVE_SMC, &offset, 1);
-    if(res) return res;
+    if(!res)
+        res = i2c_read(I2C_SLAVE_SMC, data, 1);
 
-    res = i2c_read(I2C_SLAVE_SMC, data, 1);
+    smc_release();
     return res;
 }
 
 int smc_write_register(u8 offset, u8 data)
 {
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
     u8 cmd[2] = {offset, data};
-    return i2c_write(I2C_SLAVE_SMC, cmd, 2);
+    int ret = i2c_write(I2C_SLAVE_SMC, cmd, 2);
+    smc_release();
+    return ret;
 }
 
 int smc_write_register_multiple(u8 offset, u8* data, u32 count)
 {
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
@@ -136,6 +186,7 @@ int smc_write_register_multiple(u8 offset, u8* data, u32 count)
     memcpy(tmp+1, data, count);
     int ret = i2c_write(I2C_SLAVE_SMC, tmp, count);
     free(tmp);
+    smc_release();
     return ret;
 }
 
@@ -143,13 +194,15 @@ int smc_read_register_multiple(u8 offset, u8* data, u32 count)
 {
     int res = 0;
 
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
     res = i2c_write(I2C_SLAVE_SMC, &offset, 1);
-    if(res) return res;
+    if(!res)
+        res = i2c_read(I2C_SLAVE_SMC, data, count);
 
-    res = i2c_read(I2C_SLAVE_SMC, data, count);
+    smc_release();
     return res;
 }
 
@@ -170,18 +223,24 @@ int smc_mask_register(u8 offset, u8 mask, u8 val)
 
 int smc_write_raw(u8 data)
 {
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
-    return i2c_write(I2C_SLAVE_SMC, &data, 1);
+    int ret = i2c_write(I2C_SLAVE_SMC, &data, 1);
+    smc_release();
+    return ret;
 }
 
 int smc_write_raw_multiple(u8* data, u32 count)
 {
+    smc_claim();
     // Clock is 10000 in C2W, but 5000 in IOS...
     i2c_init(5000, 1);
 
-    return i2c_write(I2C_SLAVE_SMC, data, count);
+    int ret = i2c_write(I2C_SLAVE_SMC, data, count);
+    smc_release();
+    return ret;
 }
 
 int smc_set_notification_led(u8 val)
@@ -289,10 +348,119 @@ int smc_set_wifi_idk(int state)
     smc_mask_register(0x46, 1, state ? 1 : 0);
 }
 
+// starts writing the address of the register the sample reads next
+static void _smc_sample_begin(u8 offset, int state)
+{
+    i2c_init(5000, 1);
+    if (i2c_start_write(I2C_SLAVE_SMC, &offset, 1)) {
+        i2c_end_xfer();
+        smc_sample_state = SMC_SAMPLE_IDLE;
+        return;
+    }
+
+    smc_sample_state = state;
+    smc_sample_ticks = 0;
+}
+
+static void _smc_sample_read(int state)
+{
+    i2c_end_xfer();
+    if (i2c_start_read(I2C_SLAVE_SMC, 1)) {
+        i2c_end_xfer();
+        smc_sample_state = SMC_SAMPLE_IDLE;
+        return;
+    }
+
+    smc_sample_state = state;
+    smc_sample_ticks = 0;
+}
+
+// called from the alarm interrupt, never waits on the bus
+void smc_alarm(void)
+{
+    if (!smc_sampling || smc_claimed || smc_perma_disable)
+        return;
+
+    if (smc_sample_state == SMC_SAMPLE_IDLE) {
+        if (++smc_sample_ticks >= SMC_SAMPLE_INTERVAL)
+            _smc_sample_begin(0x40, SMC_SAMPLE_CHECK_ADDR);
+        return;
+    }
+
+    int res = i2c_poll_xfer();
+    if (res > 0 && ++smc_sample_ticks < SMC_SAMPLE_TIMEOUT)
+        return;
+    if (res) {
+        write32(LT_SMC_I2C_INT_STATE, read32(LT_SMC_I2C_INT_STATE));
+        i2c_end_xfer();
+        smc_sample_state = SMC_SAMPLE_IDLE;
+        smc_sample_ticks = 0;
+        return;
+    }
+
+    u8 data = 0;
+    switch (smc_sample_state) {
+        case SMC_SAMPLE_CHECK_ADDR:
+            _smc_sample_read(SMC_SAMPLE_CHECK_READ);
+            return;
+        case SMC_SAMPLE_CHECK_READ:
+            if (i2c_finish_read(&data, 1))
+                break;
+            // same sanity check as smc_get_events()
+            if (data == 0 || data == 0xFF) {
+                smc_perma_disable = 1;
+                break;
+            }
+            _smc_sample_begin(0x41, SMC_SAMPLE_EVENT_ADDR);
+            return;
+        case SMC_SAMPLE_EVENT_ADDR:
+            _smc_sample_read(SMC_SAMPLE_EVENT_READ);
+            return;
+        case SMC_SAMPLE_EVENT_READ:
+            if (!i2c_finish_read(&data, 1) && data && data != 0xFF &&
+                smc_queue_head - smc_queue_tail < SMC_QUEUE_SIZE) {
+                smc_queue[smc_queue_head % SMC_QUEUE_SIZE] = data;
+                smc_queue_head++;
+            }
+            break;
+    }
+
+    smc_sample_state = SMC_SAMPLE_IDLE;
+    smc_sample_ticks = 0;
+}
+
+void smc_start_sampling(void)
+{
+    smc_sampling = 1;
+}
+
+void smc_stop_sampling(void)
+{
+    smc_claim();
+    smc_sampling = 0;
+    smc_queue_tail = smc_queue_head;
+    smc_release();
+}
+
+int smc_is_sampling(void)
+{
+    return smc_sampling;
+}
+
 u8 smc_get_events(void)
 {
     if (smc_perma_disable) return 0;
 
+    // one queued sample per call, so two presses stay two presses
+    if (smc_sampling) {
+        u32 cookie = irq_kill();
+        u8 data = 0;
+        if (smc_queue_tail != smc_queue_head)
+            data = smc_queue[smc_queue_tail++ % SMC_QUEUE_SIZE];
+        irq_restore(cookie);
+        return data;
+    }
+
     u8 data = 0;
 
     // Extra safety???
@@ -313,13 +481,20 @@ u8 smc_get_events(void)
     return data;
 }
 
+// drops whatever was pressed so far
+void smc_flush_events(void)
+{
+    for (int i = 0; i <= SMC_QUEUE_SIZE && smc_get_events(); i++);
+}
+
 u8 smc_wait_events(u8 mask)
 {
-    smc_get_events();
+    smc_flush_events();
 
     while(true) {
         u8 data = smc_get_events();
         if(data & mask) return data & mask;
+        if(smc_sampling) irq_wait();
     }
 }
 
@@ -60,6 +60,11 @@ int smc_write_raw_multiple(u8* data, u32 count);
 
 u8 smc_get_events(void);
 u8 smc_wait_events(u8 mask);
+void smc_flush_events(void);
+void smc_alarm(void);
+void smc_start_sampling(void);
+void smc_stop_sampling(void);
+int smc_is_sampling(void);
 
 int smc_set_notification_led(u8 val);
 int smc_set_odd_power(bool enable);
@@ -219,6 +219,8 @@ void memset16(void *dst, u16 value, u32 size);
 void memcpy16(void *dst, void *src, u32 size);
 void memset8(void *dst, u8 value, u32 size);
 void memcpy8(void *dst, void *src, u32 size);
+// like memset32 but with burst stores, only for memory (framebuffers, buffers)
+void fill32(void *dst, u32 value, u32 size);
 
 void hexdump(const void *d, int len);
 void udelay(u32 d);
@@ -36,11 +36,14 @@
 #include <crypto.h>
 #include <sdcard.h>
 #include <isfs.h>
+#include <log.h>
+#include <sched.h>
 // c runtime
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #define APP_NAME "Antani file manager"
 
@@ -59,6 +62,13 @@ enum e_action_mode
     ACTION_COPY_DIR,
     ACTION_MOVE_DIR,
     ACTION_DELETE_DIR,
+    ACTION_COPY_MARKED,
+    ACTION_MOVE_MARKED,
+    ACTION_DELETE_MARKED,
+    ACTION_ARCHIVE_DIR,
+    ACTION_RESTORE_ARCHIVE,
+    ACTION_STORE_DIR,
+    ACTION_RESTORE_STORE,
 };
 
 enum e_diskround
@@ -75,6 +85,7 @@ typedef struct select_context
     int action_mode;
     bool dirpick_source;
     bool dirpick_dest;
+    pick_selection selection;
 } select_context;
 
 static int reset_mode = EXIT_MODE_CYCLE;
@@ -85,6 +96,279 @@ static select_context global_context = {0};
 
 static void error_wait(char *message);
 static void enable_display(void);
+void main_sdstats(void)
+{
+    static const char *mode_names[SDCARD_MODE_COUNT] = {
+        "Multi-block DMA",
+        "Single-block DMA",
+        "PIO",
+    };
+    struct sdcard_stats st;
+    char line[MAX_LINE_LENGTH];
+
+    sdcard_get_stats(&st);
+
+    gfx_clear(GFX_ALL, BLACK);
+    console_init();
+
+    console_add_text("SD card transfer statistics:\n");
+    for (int i = 0; i < SDCARD_MODE_COUNT; i++)
+    {
+        u32 total = st.mode[i].ok + st.mode[i].errors;
+        snprintf(line, sizeof(line), "%-17s ok %-8lu errors %-6lu retries %-6lu (%lu.%lu%% failed)",
+            mode_names[i], st.mode[i].ok, st.mode[i].errors, st.mode[i].retries,
+            total ? st.mode[i].errors * 100 / total : 0,
+            total ? st.mode[i].errors * 1000 / total % 10 : 0);
+        console_add_text(line);
+    }
+    console_add_text("");
+
+    snprintf(line, sizeof(line), "Fallbacks: %lu, re-probes: %lu", st.fallbacks, st.reprobes);
+    console_add_text(line);
+    if (st.no_dma || st.multiple_fallback)
+        snprintf(line, sizeof(line), "Degraded to %s, next re-probe in %lu transfers",
+            st.no_dma ? "PIO" : "single blocks", st.reprobe_in);
+    else
+        snprintf(line, sizeof(line), "Running at full speed");
+    console_add_text(line);
+
+    console_show();
+    console_power_to_continue();
+}
+
+void main_viewlog(void)
+{
+    gfx_clear(GFX_ALL, BLACK);
+    console_scrollback();
+}
+
+// decode on the host with tracedecode.py
+#define TRACE_DIR   "sdmc:/antani"
+#define TRACE_PATH  TRACE_DIR "/trace.bin"
+
+void main_dumptrace(void)
+{
+    gfx_clear(GFX_ALL, BLACK);
+
+    mkdir(TRACE_DIR, 0777);
+    if (trace_dump(TRACE_PATH) < 0)
+        printf("Cannot write %s: %s\n", TRACE_PATH, strerror(errno));
+    else
+        printf("Trace written to %s\n", TRACE_PATH);
+
+    console_power_to_continue();
+}
+
+static const char *job_state_name(int state)
+{
+    static const char *names[] = {"queued", "running", "done", "failed", "cancelled"};
+    return names[state];
+}
+
+void main_jobs(void)
+{
+    char line[MAX_LINE_LENGTH];
+    int sel = 0;
+    u32 shown = ~0;
+
+    console_select_flush();
+    while (1)
+    {
+        job *j;
+        int count = 0;
+        u32 summary = 0;
+
+        for (j = job_first(); j; j = j->next, count++)
+            summary = summary * 31 + j->state * 101 + (j->total ? (u32)(j->done * 100 / j->total) : 0);
+        if (sel >= count)
+            sel = count ? count - 1 : 0;
+        summary = summary * 31 + sel;
+
+        // only draw again when a job moved on
+        if (summary != shown)
+        {
+            shown = summary;
+            gfx_clear(GFX_ALL, BLACK);
+            console_init();
+            console_add_text("Jobs:\n");
+            if (!count)
+                console_add_text("Nothing is running.");
+
+            int i = 0;
+            for (j = job_first(); j && i < MAX_LINES - 6; j = j->next, i++)
+            {
+                snprintf(line, sizeof(line), "%c %-9s %3lu%%  %.70s", i == sel ? '>' : ' ', job_state_name(j->state),
+                    j->total ? (u32)(j->done * 100 / j->total) : 0, j->name);
+                console_add_text(line);
+            }
+            console_add_text("");
+            console_add_text("W/S: select, EJECT/P: cancel or clear the job, POWER/Q: return");
+            console_show();
+        }
+
+        int input = console_select_wait();
+        if (input & (CONSOLE_KEY_POWER | CONSOLE_KEY_Q))
+            break;
+        if ((input & (CONSOLE_KEY_UP | CONSOLE_KEY_W)) && sel > 0)
+            sel--;
+        if ((input & (CONSOLE_KEY_DOWN | CONSOLE_KEY_S)) && sel < count - 1)
+            sel++;
+        if ((input & (CONSOLE_KEY_EJECT | CONSOLE_KEY_P)) && count)
+        {
+            j = job_first();
+            for (int k = 0; k < sel; k++)
+                j = j->next;
+
+            if (job_finished(j))
+                job_reap(j);
+            else
+                job_cancel(j);
+            shown = ~0;
+        }
+    }
+
+    gfx_clear(GFX_ALL, BLACK);
+}
+
+// a disk operation run as a job, it keeps its own copy of the paths
+typedef struct disk_job
+{
+    int action_mode;
+    char source[_MAX_LFN + 1];
+    char dest[_MAX_LFN + 1];
+    batch_job *batch;
+} disk_job;
+
+// disk_job_run() result of a job left running in the background
+#define DISK_JOB_BACKGROUND (1)
+
+static int disk_job_fn(void *arg)
+{
+    disk_job *dj = arg;
+    int res = -1;
+
+    switch (dj->action_mode)
+    {
+    case ACTION_COPY:
+        res = copy_single(dj->source, dj->dest);
+        break;
+    case ACTION_MOVE:
+        res = move_file(dj->source, dj->dest);
+        break;
+    case ACTION_COPY_DIR:
+        res = copy_dir(dj->source, dj->dest, NULL);
+        break;
+    case ACTION_MOVE_DIR:
+        res = move_dir(dj->source, dj->dest);
+        break;
+    case ACTION_COPY_MARKED:
+    case ACTION_MOVE_MARKED:
+        res = batch_run(dj->batch);
+        break;
+    case ACTION_ARCHIVE_DIR:
+        res = archive_create(dj->source, dj->dest);
+        break;
+    case ACTION_RESTORE_ARCHIVE:
+        res = archive_restore(dj->source, dj->dest, NULL);
+        break;
+    case ACTION_STORE_DIR:
+        res = store_backup(dj->source);
+        break;
+    case ACTION_RESTORE_STORE:
+        res = store_restore(dj->source, dj->dest);
+        break;
+    default:
+        errno = EINVAL;
+        break;
+    }
+
+    int error = errno;
+    if (dj->batch)
+        batch_free(dj->batch);
+    free(dj);
+    errno = error;
+
+    return res;
+}
+
+// Deletes run in the foreground, but a paused job may hold the files open or
+// have an ISFS batch going, so they wait until every job has ended.
+static bool disk_jobs_busy(void)
+{
+    for (job *j = job_first(); j; j = j->next)
+    {
+        if (!job_finished(j))
+        {
+            printf("Wait for the background jobs to finish first, see Jobs in the main menu.\n");
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Runs the operation as a job and watches it until it ends, unless B sends
+// it to the background. The batch, if any, belongs to the job from now on.
+static int disk_job_run(const char *what, int action_mode, const char *source, const char *dest, batch_job *batch)
+{
+    disk_job *dj = calloc(1, sizeof(disk_job));
+    if (!dj)
+    {
+        if (batch)
+            batch_free(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    dj->action_mode = action_mode;
+    strncpy(dj->source, source, _MAX_LFN);
+    strncpy(dj->dest, dest, _MAX_LFN);
+    dj->batch = batch;
+
+    char name[JOB_NAME_LEN];
+    snprintf(name, sizeof(name), "%s %s", what, source);
+    job *j = job_start(name, disk_job_fn, dj);
+    // no room for another stack, do it the old way
+    if (!j)
+        return disk_job_fn(dj);
+
+    printf("Press B to continue in the background.\n");
+    bool waiting = false;
+    while (!job_finished(j) && !j->background)
+    {
+        // the jobs ahead of this one run with the screen off, the buttons
+        // are still ours
+        if (j->state == JOB_QUEUED)
+        {
+            if (!waiting)
+                printf("Waiting for the jobs started before this one...\n");
+            waiting = true;
+            if (console_select_poll() & CONSOLE_KEY_B)
+                job_detach(j);
+        }
+        sched_run();
+    }
+
+    if (!job_finished(j))
+        return DISK_JOB_BACKGROUND;
+
+    int res = j->result;
+    errno = j->error;
+    job_reap(j);
+
+    return res;
+}
+
+static void disk_job_report(int res)
+{
+    if (res == DISK_JOB_BACKGROUND)
+        printf("Running in the background, see Jobs in the main menu.\n");
+    else if (res >= 0)
+        printf("Success!\n");
+    else
+        printf("Failed: %s!\n", strerror(errno));
+}
+
 static int disk_round(const char *base, bool select_dir, select_context *ctx);
 static void disk_bootstrap(const char *base, select_context *ctx);
 
@@ -98,14 +382,25 @@ static menu menu_main = {
         {"Copy file", &main_copy},
         {"Move file", &main_move},
         {"Delete file", &main_delete},
-        //{"Copy folder", &main_copyfolder}, // TODO: enable and test...
-        //{"Move folder", &main_movefolder},
-        //{"Delete folder", &main_deletefolder},
+        {"Copy folder", &main_copyfolder},
+        {"Move folder", &main_movefolder},
+        {"Delete folder", &main_deletefolder},
+        {"Copy marked files", &main_copymarked},
+        {"Move marked files", &main_movemarked},
+        {"Delete marked files", &main_deletemarked},
+        {"Backup folder to archive", &main_archivefolder},
+        {"Restore archive", &main_restorearchive},
+        {"Incremental backup to store", &main_storefolder},
+        {"Restore from store", &main_restorestore},
+        {"SD card statistics", &main_sdstats},
+        {"View log", &main_viewlog},
+        {"Dump trace to SD", &main_dumptrace},
+        {"Jobs", &main_jobs},
         {"Hardware reset", &main_reset},
         {"Power off", &main_shutdown},
         {"Credits", &main_credits},
     },
-    6, // number of options
+    20, // number of options
     0,
     0
 };
@@ -162,6 +457,12 @@ u32 _main(void *base)
     mem_initialize();
 
     irq_initialize();
+#ifdef CAN_HAZ_IRQ
+    // from here on serial output is queued and sent from the alarm
+    irq_set_alarm(SERIAL_IRQ_MS, 1);
+    irq_enable(IRQ_TIMER);
+    serial_set_async(1);
+#endif
     printf("Interrupts initialized\n");
 
     // Read OTP and SEEPROM
@@ -206,7 +507,11 @@ u32 _main(void *base)
     // init ini file
     minini_init();
 
-    smc_get_events();
+    smc_flush_events();
+#ifdef CAN_HAZ_IRQ
+    // buttons are sampled by the alarm from now on, menus sleep between them
+    smc_start_sampling();
+#endif
     //leave ODD Power on for HDDs
     if (has_no_otp_bin || 
             (seeprom.bc.sata_device != SATA_TYPE_GEN2HDD && 
@@ -219,15 +524,27 @@ u32 _main(void *base)
     }
 
     enable_display();
+
+    if (copy_resume())
+        console_power_to_continue();
+
     printf("Showing menu...\n");
 
     while (reset_mode == EXIT_MODE_CYCLE)
     {
+        pick_selection_free(&global_context.selection);
         memset(&global_context, 0, sizeof(global_context));
         menu_init(&menu_main);
     }
 
-    smc_get_events();
+    // a job left in the background would be cut off halfway
+    if (sched_run())
+    {
+        printf("Waiting for the background jobs to finish...\n");
+        while (sched_run());
+    }
+
+    smc_flush_events();
     smc_set_odd_power(true);
 
     gpu_cleanup();
@@ -312,6 +629,75 @@ void main_deletefolder(void)
     menu_init(&menu_devs);
 }
 
+static bool is_marked_action(int action_mode)
+{
+    return action_mode == ACTION_COPY_MARKED || action_mode == ACTION_MOVE_MARKED ||
+        action_mode == ACTION_DELETE_MARKED;
+}
+
+void main_copymarked(void)
+{
+    global_context.action_mode = ACTION_COPY_MARKED;
+    global_context.dirpick_source = false;
+    global_context.dirpick_dest = true;
+    menu_init(&menu_devs);
+}
+
+void main_movemarked(void)
+{
+    global_context.action_mode = ACTION_MOVE_MARKED;
+    global_context.dirpick_source = false;
+    global_context.dirpick_dest = true;
+    menu_init(&menu_devs);
+}
+
+void main_deletemarked(void)
+{
+    global_context.action_mode = ACTION_DELETE_MARKED;
+    global_context.dirpick_source = false;
+    global_context.dirpick_dest = false;
+    menu_init(&menu_devs);
+}
+
+void main_archivefolder(void)
+{
+    global_context.action_mode = ACTION_ARCHIVE_DIR;
+    global_context.dirpick_source = true;
+    global_context.dirpick_dest = true;
+    menu_init(&menu_devs);
+}
+
+void main_restorearchive(void)
+{
+    global_context.action_mode = ACTION_RESTORE_ARCHIVE;
+    global_context.dirpick_source = false;
+    global_context.dirpick_dest = true;
+    menu_init(&menu_devs);
+}
+
+void main_storefolder(void)
+{
+    global_context.action_mode = ACTION_STORE_DIR;
+    global_context.dirpick_source = true;
+    global_context.dirpick_dest = false;
+    menu_init(&menu_devs);
+}
+
+void main_restorestore(void)
+{
+    global_context.action_mode = ACTION_RESTORE_STORE;
+    global_context.dirpick_source = false;
+    global_context.dirpick_dest = true;
+    menu_init(&menu_devs);
+}
+
+// actions whose destination is the picked folder itself
+static bool is_folder_dest_action(int action_mode)
+{
+    return is_marked_action(action_mode) || action_mode == ACTION_ARCHIVE_DIR ||
+        action_mode == ACTION_RESTORE_ARCHIVE || action_mode == ACTION_RESTORE_STORE;
+}
+
 void main_reset(void)
 {
     gfx_clear(GFX_ALL, BLACK);
@@ -343,6 +729,16 @@ void main_credits(void)
     console_power_to_continue();
 }
 
+// "sdmc://dir/" -> "sdmc://dir", the slash right after the volume stays
+static void strip_trailing_slash(char *path)
+{
+    const char *volume = strchr(path, ':');
+    size_t len = strlen(path);
+
+    while (len > 0 && path[len - 1] == '/' && (!volume || path + len - 1 > volume + 1))
+        path[--len] = '\0';
+}
+
 static int disk_round(const char *base, bool select_dir, select_context *ctx)
 {
     const char *path, *path2;
@@ -352,7 +748,10 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
 
     gfx_clear(GFX_ALL, BLACK);
 
-    path = pick_file((char*)base, select_dir, filename_buf);
+    if (is_marked_action(ctx->action_mode) && ctx->source_filename[0] == '\0')
+        path = pick_files((char*)base, &ctx->selection, filename_buf);
+    else
+        path = pick_file((char*)base, select_dir, filename_buf);
     errnox = errno;
 
     console_init();
@@ -361,13 +760,21 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
     {
         if (path[0] != '\0')
         {
-            if (ctx->source_filename[0] != '\0')
+            if (ctx->source_filename[0] != '\0' && is_folder_dest_action(ctx->action_mode))
+            {
+                // marked files keep their names inside the picked folder
+                strncpy(ctx->dest_filename, path, _MAX_LFN);
+                strip_trailing_slash(ctx->dest_filename);
+                is_ok = 1;
+            }
+            else if (ctx->source_filename[0] != '\0')
             {
                 path2 = get_file_name(ctx->source_filename);
     
                 if (path2 != NULL)
                 {
                     strncpy(ctx->dest_filename, path, _MAX_LFN);
+                    strip_trailing_slash(ctx->dest_filename);
                     strcat(ctx->dest_filename, path2);
                     is_ok = 1;
                 }
@@ -379,6 +786,7 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
             else
             {
                 strncpy(ctx->source_filename, path, _MAX_LFN);
+                strip_trailing_slash(ctx->source_filename);
                 is_ok = 1;
             }    
         }
@@ -397,6 +805,8 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
         switch (ctx->action_mode)
         {
         case ACTION_DELETE:
+            if (disk_jobs_busy())
+                break;
             printf("Are you sure you want to delete file %s?\n", ctx->source_filename);
             if (!console_abort_confirmation_power_no_eject_yes())
             {
@@ -440,17 +850,17 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
                             }
                         }
     
+                        if (is_ok && check_free_space(ctx->source_filename, ctx->dest_filename) < 0)
+                        {
+                            ret = DISK_ROUND_EXIT;
+                            is_ok = 0;
+                            printf("Cannot copy %s: %s!\n", ctx->source_filename, strerror(errno));
+                        }
+
                         if (is_ok)
                         {
                             ret = DISK_ROUND_EXIT;
-                            if (copy_file(ctx->source_filename, ctx->dest_filename) >= 0)
-                            {
-                                printf("Success!\n");
-                            }
-                            else
-                            {
-                                printf("Failed: %s!\n", strerror(errno));
-                            }    
+                            disk_job_report(disk_job_run("Copy", ACTION_COPY, ctx->source_filename, ctx->dest_filename, NULL));
                         }
                     }    
                 }
@@ -482,25 +892,217 @@ static int disk_round(const char *base, bool select_dir, select_context *ctx)
                             }
                         }
 
+                        // a move within one device only relinks, it needs no space
+                        if (is_ok && !same_volume(ctx->source_filename, ctx->dest_filename) &&
+                            check_free_space(ctx->source_filename, ctx->dest_filename) < 0)
+                        {
+                            ret = DISK_ROUND_EXIT;
+                            is_ok = 0;
+                            printf("Cannot copy %s: %s!\n", ctx->source_filename, strerror(errno));
+                        }
+
                         if (is_ok)
                         {
                             ret = DISK_ROUND_EXIT;
-                            if (copy_file(ctx->source_filename, ctx->dest_filename) >= 0)
-                            {
-                                if (delete_file(ctx->source_filename) >= 0)
-                                {
-                                    printf("Success!\n");
-                                }
-                                else
-                                {
-                                    printf("Deletion fail: %s!\n", strerror(errno));
-                                }
-                            }
-                            else
+                            disk_job_report(disk_job_run("Move", ACTION_MOVE, ctx->source_filename, ctx->dest_filename, NULL));
+                        }
+                    }
+                }
+            }
+            break;
+        case ACTION_COPY_MARKED:
+        case ACTION_MOVE_MARKED:
+        case ACTION_DELETE_MARKED:
+            if (ctx->selection.count == 0)
+            {
+                printf("No files were marked!\n");
+            }
+            else if (ctx->action_mode != ACTION_DELETE_MARKED && ctx->dest_filename[0] == '\0')
+            {
+                ret = DISK_ROUND_ASK_DEST;
+            }
+            else
+            {
+                static const int ops[] = {BATCH_COPY, BATCH_MOVE, BATCH_DELETE};
+                static const char *verbs[] = {"copy", "move", "delete"};
+                int op = ops[ctx->action_mode - ACTION_COPY_MARKED];
+                if (op == BATCH_DELETE && disk_jobs_busy())
+                    break;
+                batch_job *job = batch_plan(op, ctx->selection.path, ctx->selection.count, ctx->dest_filename);
+
+                if (!job)
+                {
+                    printf("Cannot %s the marked files: %s!\n", verbs[op], strerror(errno));
+                    break;
+                }
+
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+                if (op == BATCH_DELETE)
+                    printf("Are you sure you want to delete the marked files?\n");
+                else
+                    printf("Are you sure you want to %s the marked files to %s?\n", verbs[op], ctx->dest_filename);
+
+                if (console_abort_confirmation_power_no_eject_yes())
+                {
+                    batch_free(job);
+                }
+                else if (op == BATCH_DELETE)
+                {
+                    // deleting doesn't stop for the menu, it stays in the foreground
+                    ret = DISK_ROUND_EXIT;
+                    printf(batch_run(job) >= 0 ? "Success!\n" : "Failed!\n");
+                    batch_free(job);
+                }
+                else
+                {
+                    static const char *names[] = {"Copy marked to", "Move marked to"};
+                    ret = DISK_ROUND_EXIT;
+                    disk_job_report(disk_job_run(names[op], ctx->action_mode, ctx->dest_filename, ctx->dest_filename, job));
+                }
+            }
+            break;
+        case ACTION_ARCHIVE_DIR:
+            if (ctx->dest_filename[0] == '\0')
+            {
+                ret = DISK_ROUND_ASK_DEST;
+            }
+            else
+            {
+                char archive[_MAX_LFN + 1];
+                const char *name = get_file_name(ctx->source_filename);
+                size_t len = strlen(ctx->dest_filename);
+
+                // the archive is named after the folder, "root" for a whole device
+                snprintf(archive, sizeof(archive), "%s%s%s%s", ctx->dest_filename,
+                    (len && ctx->dest_filename[len - 1] == '/') ? "" : "/", name ? name + 1 : "root",
+                    archive_suffix());
+
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+                printf("Are you sure you want to back up the folder %s to %s?\n", ctx->source_filename, archive);
+                if (!console_abort_confirmation_power_no_eject_yes())
+                {
+                    if (exist_file(archive))
+                    {
+                        printf("The file %s already exists, do you want to replace it?\n", archive);
+                        if (console_abort_confirmation_power_no_eject_yes())
+                        {
+                            is_ok = 0;
+                        }
+                    }
+
+                    if (is_ok)
+                    {
+                        ret = DISK_ROUND_EXIT;
+                        disk_job_report(disk_job_run("Back up", ACTION_ARCHIVE_DIR, ctx->source_filename, archive, NULL));
+                    }
+                }
+            }
+            break;
+        case ACTION_RESTORE_ARCHIVE:
+            if (ctx->dest_filename[0] == '\0')
+            {
+                ret = DISK_ROUND_ASK_DEST;
+            }
+            else
+            {
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+                printf("Are you sure you want to restore the archive %s into %s?\n", ctx->source_filename, ctx->dest_filename);
+                printf("Files that already exist will be replaced.\n");
+                if (!console_abort_confirmation_power_no_eject_yes())
+                {
+                    ret = DISK_ROUND_EXIT;
+                    disk_job_report(disk_job_run("Restore", ACTION_RESTORE_ARCHIVE, ctx->source_filename, ctx->dest_filename, NULL));
+                }
+            }
+            break;
+        case ACTION_STORE_DIR:
+            printf("Are you sure you want to back up the folder %s to the store?\n", ctx->source_filename);
+            if (!console_abort_confirmation_power_no_eject_yes())
+            {
+                disk_job_report(disk_job_run("Store", ACTION_STORE_DIR, ctx->source_filename, "", NULL));
+            }
+            else
+            {
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+            }
+            break;
+        case ACTION_RESTORE_STORE:
+            if (ctx->dest_filename[0] == '\0')
+            {
+                ret = DISK_ROUND_ASK_DEST;
+            }
+            else
+            {
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+                printf("Are you sure you want to restore the backup %s into %s?\n", ctx->source_filename, ctx->dest_filename);
+                printf("Files that already exist will be replaced.\n");
+                if (!console_abort_confirmation_power_no_eject_yes())
+                {
+                    ret = DISK_ROUND_EXIT;
+                    disk_job_report(disk_job_run("Restore", ACTION_RESTORE_STORE, ctx->source_filename, ctx->dest_filename, NULL));
+                }
+            }
+            break;
+        case ACTION_DELETE_DIR:
+            if (get_file_name(ctx->source_filename) == NULL)
+            {
+                printf("You cannot delete the root of a device!\n");
+                break;
+            }
+            if (disk_jobs_busy())
+                break;
+            printf("Are you sure you want to delete the folder %s and everything inside it?\n", ctx->source_filename);
+            if (!console_abort_confirmation_power_no_eject_yes())
+            {
+                if (delete_dir(ctx->source_filename) >= 0)
+                {
+                    printf("Success!\n");
+                }
+                else
+                {
+                    printf("Failed: %s!\n", strerror(errno));
+                }
+            }
+            else
+            {
+                ret = DISK_ROUND_EXIT_NO_WAIT;
+            }
+            break;
+        case ACTION_COPY_DIR:
+        case ACTION_MOVE_DIR:
+            if (ctx->dest_filename[0] == '\0')
+            {
+                ret = DISK_ROUND_ASK_DEST;
+            }
+            else
+            {
+                const char *verb = ctx->action_mode == ACTION_MOVE_DIR ? "move" : "copy";
+
+                if (strcmp(ctx->source_filename, ctx->dest_filename) == 0)
+                {
+                    printf("You cannot %s a folder to the same directory where it exists!\n", verb);
+                }
+                else
+                {
+                    ret = DISK_ROUND_EXIT_NO_WAIT;
+                    printf("Are you sure you want to %s the folder %s to %s?\n", verb, ctx->source_filename, ctx->dest_filename);
+                    if (!console_abort_confirmation_power_no_eject_yes())
+                    {
+                        if (exist_file(ctx->dest_filename))
+                        {
+                            printf("The folder %s already exists, do you want to merge into it?\n", ctx->dest_filename);
+                            if (console_abort_confirmation_power_no_eject_yes())
                             {
-                                printf("Copy fail: %s!\n", strerror(errno));
+                                is_ok = 0;
                             }
                         }
+
+                        if (is_ok)
+                        {
+                            ret = DISK_ROUND_EXIT;
+                            disk_job_report(disk_job_run(ctx->action_mode == ACTION_MOVE_DIR ? "Move" : "Copy",
+                                ctx->action_mode, ctx->source_filename, ctx->dest_filename, NULL));
+                        }
                     }
                 }
             }
@@ -20,6 +20,17 @@ void main_delete(void);
 void main_copyfolder(void);
 void main_movefolder(void);
 void main_deletefolder(void);
+void main_copymarked(void);
+void main_movemarked(void);
+void main_deletemarked(void);
+void main_archivefolder(void);
+void main_restorearchive(void);
+void main_storefolder(void);
+void main_restorestore(void);
+void main_sdstats(void);
+void main_viewlog(void);
+void main_dumptrace(void);
+void main_jobs(void);
 void main_reset(void);
 void main_shutdown(void);
 void main_credits(void);
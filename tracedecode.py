@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Decodes the trace ring written by "Dump trace to SD" (sdmc:/antani/trace.bin).
+# usage: tracedecode.py trace.bin [--summary]
+
+import sys, struct
+
+TRACE_MAGIC = 0x54524345 # TRCE
+TRACE_VERSION = 1
+
+# keep in sync with the enum in source/lib/log.h
+EVENTS = {
+    1: "nand_read",
+    2: "nand_write",
+    3: "nand_erase",
+    4: "aes_decrypt",
+    5: "aes_encrypt",
+    6: "sdhc_cmd",
+}
+
+# AHB read buffer clients of the two SD hosts
+HOSTS = {9: "sd", 11: "mlc"}
+
+def describe(event, status, a, b):
+    name = EVENTS.get(event, "event%d" % event)
+    if name.startswith("nand"):
+        return name, "page 0x%X" % a
+    if name.startswith("aes"):
+        return name, "%d blocks" % a
+    if name == "sdhc_cmd":
+        host = HOSTS.get(a >> 8, "host%d" % (a >> 8))
+        return "%s_cmd%d" % (host, a & 0xFF), "%d bytes" % b
+    return name, "a=0x%X b=0x%X" % (a, b)
+
+data = open(sys.argv[1], "rb").read()
+summary = "--summary" in sys.argv[2:]
+
+# the console is big-endian
+magic, version, ticks_s, count, lost, entry_size = struct.unpack(">IIIIII", data[:24])
+if magic != TRACE_MAGIC or version != TRACE_VERSION:
+    print("ERROR: not a version %d trace (magic 0x%08X, version %d)." % (TRACE_VERSION, magic, version))
+    sys.exit(1)
+
+ticks_us = ticks_s / 1000000.0
+entries = []
+for i in range(count):
+    off = 24 + i * entry_size
+    entries.append(struct.unpack(">IIHHII", data[off:off + 20]))
+
+print("%d events, %d older ones overwritten" % (count, lost))
+
+if not entries:
+    sys.exit(0)
+
+if summary:
+    stats = {}
+    for start, ticks, event, status, a, b in entries:
+        name, _ = describe(event, status, a, b)
+        s = stats.setdefault(name, [0, 0, 0, 0])
+        s[0] += 1
+        s[1] += ticks
+        s[2] = max(s[2], ticks)
+        s[3] += status != 0
+    print("%-16s %8s %12s %10s %10s %7s" % ("event", "count", "total us", "avg us", "max us", "errors"))
+    for name, (n, total, worst, errors) in sorted(stats.items(), key=lambda x: -x[1][1]):
+        print("%-16s %8d %12.0f %10.1f %10.1f %7d" % (name, n, total / ticks_us, total / ticks_us / n, worst / ticks_us, errors))
+    sys.exit(0)
+
+# LT_TIMER wraps every ~37 minutes, times are relative to the first event
+first = entries[0][0]
+for start, ticks, event, status, a, b in entries:
+    name, args = describe(event, status, a, b)
+    t = ((start - first) & 0xFFFFFFFF) / ticks_us
+    err = " error %d" % status if status else ""
+    print("%12.1f us  %-14s %-16s %8.1f us%s" % (t, name, args, ticks / ticks_us, err))